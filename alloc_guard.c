@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+
+#include "alloc_guard.h"
+#include "utils.h"
+
+/*
+ * Replaces the malloc family for the whole process, including the C library and the linked libraries.
+ * Once armed, every allocation is counted and the first ones are printed with the thread name and the
+ * calling address (resolve it with addr2line -e transmit). The allocations are forwarded to the glibc
+ * implementation, which is reachable through its __libc_ entry points without going through dlsym(),
+ * which itself allocates.
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static _Atomic bool armed = false;
+static _Atomic uint64_t allocations = 0;
+static __thread bool exempt = false;
+
+static void record(const char *function, size_t size, void *caller) {
+    if (!atomic_load_explicit(&armed, memory_order_relaxed) || exempt)
+        return;
+    uint64_t count = atomic_fetch_add(&allocations, 1) + 1;
+    if (count > ALLOC_GUARD_MAX_REPORTS)
+        return;
+
+    // snprintf() and write() do not allocate, unlike printf() on a stream without a buffer yet
+    char thread[16] = { 0 };
+    char line[160];
+    prctl(PR_GET_NAME, thread);
+    int length = snprintf(line, sizeof(line), "Alloc guard: %s(%zu) in thread %s from %p\n", function, size,
+                          thread, caller);
+    if (length > 0) {
+        ssize_t written = write(STDERR_FILENO, line, MINIMUM((size_t) length, sizeof(line) - 1));
+        (void) written;
+    }
+}
+
+void *malloc(size_t size) {
+    record("malloc", size, __builtin_return_address(0));
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    record("calloc", count * size, __builtin_return_address(0));
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    record("realloc", size, __builtin_return_address(0));
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    record("memalign", size, __builtin_return_address(0));
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    record("aligned_alloc", size, __builtin_return_address(0));
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    record("posix_memalign", size, __builtin_return_address(0));
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+// Called by the transmit loop after the warm-up. From here on, any allocation is a failure
+void alloc_guard_arm() {
+    if (!atomic_exchange(&armed, true))
+        printf("Alloc guard: Armed. Heap allocations from now on are reported\n");
+}
+
+// For threads that are decoupled from the transmit loop and allocate in a library, e.g. OpenSSL
+void alloc_guard_exempt_thread() {
+    exempt = true;
+}
+
+// Disarms the guard before the shutdown and prints the result. Returns -1 on allocations or without warm-up
+int alloc_guard_finish() {
+    bool was_armed = atomic_exchange(&armed, false);
+    uint64_t count = atomic_load(&allocations);
+    if (!was_armed) {
+        printf("Alloc guard: Not armed. The transmit loop did not warm up with all transports\n");
+        return -1;
+    }
+    printf("Alloc guard: %lu heap allocations in the steady state%s\n", (unsigned long) count,
+           count > ALLOC_GUARD_MAX_REPORTS ? " (only the first ones were printed)" : "");
+    return count > 0 ? -1 : 0;
+}
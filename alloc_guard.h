@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _ALLOC_GUARD_H_
+#define _ALLOC_GUARD_H_
+
+#define ALLOC_GUARD_WARMUP_UPDATES 3 // Transmit loop updates with all transports up before arming
+#define ALLOC_GUARD_MAX_REPORTS 16   // Allocations printed as they happen. The rest are only counted
+
+// Only built with the ALLOC_GUARD CMake option. Otherwise the calls compile to nothing
+#ifdef ALLOC_GUARD
+void alloc_guard_arm(void);
+void alloc_guard_exempt_thread(void);
+int alloc_guard_finish(void);
+#else
+static inline void alloc_guard_arm(void) {}
+static inline void alloc_guard_exempt_thread(void) {}
+static inline int alloc_guard_finish(void) { return 0; }
+#endif
+
+#endif //_ALLOC_GUARD_H_
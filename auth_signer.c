@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+#include "auth_signer.h"
+#include "alloc_guard.h"
+#include "metrics.h"
+#include "trace_ring.h"
+#include "utils.h"
+#include "vclock.h"
+
+/*
+ * Computes the Message Set Signature Auth pages on a worker thread. The transmit loop hands over the
+ * encoded messages of each pack and gets the pages of the newest finished signature back at once, so
+ * signing never delays a pack. If the set changes again while a signature is computed, only the newest
+ * set is signed next.
+ *
+ * The Ed25519 signature covers the encoded messages of the set, in pack order, followed by the Auth
+ * timestamp (seconds since 2019-01-01 UTC) as 4 bytes little endian. It is split over the Auth pages
+ * as the Auth data with Length 64.
+ */
+
+struct signed_set {
+    union ODID_Message_encoded messages[AUTH_SIGNER_MAX_SET];
+    int count;
+    uint64_t submitted_ns;
+};
+
+static EVP_PKEY *key = NULL;
+static void (*published_callback)(void);
+static pthread_t signer_thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t wake; // Posted when a set is submitted or the signer is stopped. Waited for through vclock
+static bool running = false;
+
+static struct signed_set submitted; // The newest set handed over
+static bool pending = false;        // submitted has not been picked up by the signer yet
+static struct signed_set signed_current;
+static ODID_Auth_encoded published_pages[AUTH_SIGNER_PAGES];
+static bool published = false;
+
+static struct {
+    uint64_t signatures;
+    uint64_t failures;
+    uint64_t signing_ns_sum;
+    uint64_t signing_ns_max;
+    uint64_t lag_ns_sum;
+    uint64_t lag_ns_max;
+    uint64_t packs;
+    uint64_t stale_packs; // Packs sent with the signature of an older message set
+} stats;
+
+static bool same_set(const struct signed_set *set, const union ODID_Message_encoded *messages, int count) {
+    return set->count == count && memcmp(set->messages, messages, count * sizeof(*messages)) == 0;
+}
+
+static int sign(const struct signed_set *set, uint32_t timestamp, uint8_t *signature) {
+    uint8_t data[AUTH_SIGNER_MAX_SET * ODID_MESSAGE_SIZE + sizeof(uint32_t)];
+    size_t length = set->count * ODID_MESSAGE_SIZE;
+    memcpy(data, set->messages, length);
+    for (int i = 0; i < 4; i++)
+        data[length++] = (uint8_t) (timestamp >> (8 * i));
+
+    EVP_MD_CTX *context = EVP_MD_CTX_new();
+    size_t signature_length = AUTH_SIGNATURE_SIZE;
+    int result = context && EVP_DigestSignInit(context, NULL, NULL, NULL, key) == 1 &&
+                 EVP_DigestSign(context, signature, &signature_length, data, length) == 1 &&
+                 signature_length == AUTH_SIGNATURE_SIZE ? 0 : -1;
+    EVP_MD_CTX_free(context);
+    return result;
+}
+
+static int encode_pages(const uint8_t *signature, uint32_t timestamp, ODID_Auth_encoded *pages) {
+    size_t offset = 0;
+    for (int page = 0; page < AUTH_SIGNER_PAGES; page++) {
+        ODID_Auth_data auth = { 0 };
+        size_t size = page == 0 ? ODID_AUTH_PAGE_ZERO_DATA_SIZE : ODID_AUTH_PAGE_NONZERO_DATA_SIZE;
+        auth.AuthType = ODID_AUTH_MESSAGE_SET_SIGNATURE;
+        auth.DataPage = page;
+        if (page == 0) {
+            auth.LastPageIndex = AUTH_SIGNER_PAGES - 1;
+            auth.Length = AUTH_SIGNATURE_SIZE;
+            auth.Timestamp = timestamp;
+        }
+        size = MINIMUM(size, AUTH_SIGNATURE_SIZE - offset);
+        memcpy(auth.AuthData, signature + offset, size);
+        offset += size;
+        if (encodeAuthMessage(&pages[page], &auth) != ODID_SUCCESS)
+            return -1;
+    }
+    return 0;
+}
+
+static void *signer_loop(void *arg) {
+    (void) arg;
+    pthread_setname_np(pthread_self(), "signer");
+    alloc_guard_exempt_thread(); // OpenSSL allocates for every signature
+    pthread_mutex_lock(&lock);
+    while (running) {
+        if (!pending) {
+            pthread_mutex_unlock(&lock);
+            vclock_sem_wait(&wake, VCLOCK_FOREVER);
+            pthread_mutex_lock(&lock);
+            continue;
+        }
+        struct signed_set set = submitted;
+        pending = false;
+        pthread_mutex_unlock(&lock);
+
+        uint8_t signature[AUTH_SIGNATURE_SIZE];
+        ODID_Auth_encoded pages[AUTH_SIGNER_PAGES];
+        uint32_t timestamp = (uint32_t) (vclock_realtime_ns() / 1000000000LL - AUTH_TIMESTAMP_EPOCH);
+        uint64_t start_ns = get_time_ns();
+        trace_begin(TRACE_AUTH_SIGN, set.count);
+        int result = sign(&set, timestamp, signature);
+        if (result == 0)
+            result = encode_pages(signature, timestamp, pages);
+        trace_end(TRACE_AUTH_SIGN);
+        uint64_t end_ns = get_time_ns();
+
+        pthread_mutex_lock(&lock);
+        if (result != 0) {
+            stats.failures++;
+            continue;
+        }
+        memcpy(published_pages, pages, sizeof(pages));
+        signed_current = set;
+        published = true;
+        stats.signatures++;
+        stats.signing_ns_sum += end_ns - start_ns;
+        stats.signing_ns_max = MAXIMUM(stats.signing_ns_max, end_ns - start_ns);
+        stats.lag_ns_sum += end_ns - set.submitted_ns;
+        stats.lag_ns_max = MAXIMUM(stats.lag_ns_max, end_ns - set.submitted_ns);
+        bool newest = !pending;
+        pthread_mutex_unlock(&lock);
+
+        metrics_observe_ns(METRICS_AUTH_SIGNING, end_ns - start_ns);
+        metrics_observe_ns(METRICS_AUTH_SIGNATURE_LAG, end_ns - set.submitted_ns);
+        // Let the pack with the matching signature go out now instead of with the next update
+        if (newest && published_callback)
+            published_callback();
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int auth_signer_start(const char *key_file, void (*published)(void)) {
+    FILE *file = fopen(key_file, "r");
+    if (!file) {
+        perror(key_file);
+        return -1;
+    }
+    key = PEM_read_PrivateKey(file, NULL, NULL, NULL);
+    fclose(file);
+    if (!key || EVP_PKEY_id(key) != EVP_PKEY_ED25519) {
+        printf("Error: %s is not an Ed25519 private key in PEM format\n", key_file);
+        EVP_PKEY_free(key);
+        key = NULL;
+        return -1;
+    }
+
+    published_callback = published;
+    sem_init(&wake, 0, 0);
+    running = true;
+    if (vclock_thread_create(&signer_thread, signer_loop, NULL) != 0) {
+        running = false;
+        sem_destroy(&wake);
+        EVP_PKEY_free(key);
+        key = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void auth_signer_stop() {
+    pthread_mutex_lock(&lock);
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    running = false;
+    pthread_mutex_unlock(&lock);
+    vclock_sem_post(&wake);
+    vclock_thread_join(signer_thread, NULL);
+    sem_destroy(&wake);
+    EVP_PKEY_free(key);
+    key = NULL;
+
+    if (stats.signatures > 0) {
+        printf("Auth signing: %lu signatures, %.3f ms average, %.3f ms max. Lag until published: %.3f ms "
+               "average, %.3f ms max\n", (unsigned long) stats.signatures,
+               (double) stats.signing_ns_sum / stats.signatures / 1e6, (double) stats.signing_ns_max / 1e6,
+               (double) stats.lag_ns_sum / stats.signatures / 1e6, (double) stats.lag_ns_max / 1e6);
+    }
+    if (stats.packs > 0) {
+        printf("Auth signing: %lu of %lu packs carried the signature of an older message set (%.0f %%)\n",
+               (unsigned long) stats.stale_packs, (unsigned long) stats.packs,
+               100.0 * stats.stale_packs / stats.packs);
+    }
+    if (stats.failures > 0)
+        printf("Auth signing: %lu signatures failed\n", (unsigned long) stats.failures);
+}
+
+/*
+ * Hands the message set of the next pack to the signer, if it changed, and copies the Auth pages of the
+ * newest signature. Returns the number of pages, 0 until the first signature is ready.
+ */
+int auth_signer_update(const union ODID_Message_encoded *set, int count, ODID_Auth_encoded *pages) {
+    count = MINIMUM(count, AUTH_SIGNER_MAX_SET);
+    pthread_mutex_lock(&lock);
+    if (!same_set(&submitted, set, count)) {
+        memcpy(submitted.messages, set, count * sizeof(*set));
+        submitted.count = count;
+        submitted.submitted_ns = get_time_ns();
+        pending = true;
+        vclock_sem_post(&wake);
+    }
+    int page_count = 0;
+    if (published) {
+        memcpy(pages, published_pages, sizeof(published_pages));
+        page_count = AUTH_SIGNER_PAGES;
+        stats.packs++;
+        if (!same_set(&signed_current, set, count))
+            stats.stale_packs++;
+    }
+    pthread_mutex_unlock(&lock);
+    return page_count;
+}
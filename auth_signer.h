@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _AUTH_SIGNER_H_
+#define _AUTH_SIGNER_H_
+
+#include <opendroneid.h>
+
+#define AUTH_SIGNER_MAX_SET 8        // Messages covered by one signature
+#define AUTH_SIGNATURE_SIZE 64       // Ed25519
+#define AUTH_SIGNER_PAGES (1 + (AUTH_SIGNATURE_SIZE - ODID_AUTH_PAGE_ZERO_DATA_SIZE + \
+                                ODID_AUTH_PAGE_NONZERO_DATA_SIZE - 1) / ODID_AUTH_PAGE_NONZERO_DATA_SIZE)
+#define AUTH_TIMESTAMP_EPOCH 1546300800 // 2019-01-01 00:00:00 UTC
+
+int auth_signer_start(const char *key_file, void (*published)(void));
+void auth_signer_stop(void);
+int auth_signer_update(const union ODID_Message_encoded *set, int count, ODID_Auth_encoded *pages);
+
+#endif //_AUTH_SIGNER_H_
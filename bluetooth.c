@@ -21,12 +21,29 @@
 
 #include "bluetooth.h"
 #include "print_bt_features.h"
+#include "metrics.h"
+#include "trace_ring.h"
+#include "btsnoop.h"
+#include "hci_profile.h"
+#include "vclock.h"
 
 int device_descriptor = 0;
+static uint8_t random_address[6] = { 0 };
+
+#define MOCK_HCI_RTT_US 1000 // Command round trip of the mock controller used in the simulation
+
+// The status of the last command: The HCI status code, or one of the negative values below
+#define COMMAND_STATUS_READ_FAILED -1
+#define COMMAND_STATUS_UNEXPECTED_EVENT -2
+static int last_command_status = 0;
+static bool report_command_errors = true; // Disabled while stressing the controller
 
 static int open_hci_device() {
     struct hci_filter flt; // Host Controller Interface filter
 
+    if (vclock_simulated())
+        return -1; // The commands are answered by mock_controller_event()
+
     int dev_id = hci_devid("hci0");
     if (dev_id < 0)
         dev_id = hci_get_route(NULL);
@@ -48,22 +65,52 @@ static int open_hci_device() {
     return dd;
 }
 
+// In the simulation, every command completes successfully after MOCK_HCI_RTT_US of simulated time
+static ssize_t mock_controller_event(uint16_t opcode, unsigned char *buf) {
+    vclock_sleep_ns(MOCK_HCI_RTT_US * 1000ULL);
+    hci_event_hdr *hdr = (void *) (buf + 1);
+    evt_cmd_complete *cc = (void *) (buf + 1 + HCI_EVENT_HDR_SIZE);
+    buf[0] = HCI_EVENT_PKT;
+    hdr->evt = EVT_CMD_COMPLETE;
+    hdr->plen = EVT_CMD_COMPLETE_SIZE + 1;
+    cc->ncmd = 1;
+    cc->opcode = opcode;
+    buf[1 + HCI_EVENT_HDR_SIZE + EVT_CMD_COMPLETE_SIZE] = 0; // Status: Success
+    return 1 + HCI_EVENT_HDR_SIZE + hdr->plen;
+}
+
 static void send_cmd(int dd, uint8_t ogf, uint16_t ocf, uint8_t *cmd_data, int length) {
-    if (hci_send_cmd(dd, ogf, ocf, length, cmd_data) < 0)
-        exit(EXIT_FAILURE);
+    trace_begin(TRACE_SEND_CMD, ocf);
+    uint64_t start_ns = get_time_ns();
+    btsnoop_command(cmd_opcode_pack(ogf, ocf), cmd_data, length);
 
     unsigned char buf[HCI_MAX_EVENT_SIZE] = { 0 }, *ptr;
     uint16_t opcode = htobs(cmd_opcode_pack(ogf, ocf));
     hci_event_hdr *hdr = (void *) (buf + 1);
     evt_cmd_complete *cc;
+    evt_cmd_status *cs;
     ssize_t len;
-    while ((len = read(dd, buf, sizeof(buf))) < 0) {
-        if (errno == EAGAIN || errno == EINTR)
-            continue;
-        printf("While loop for reading event failed\n");
-        return;
+    if (vclock_simulated()) {
+        len = mock_controller_event(opcode, buf);
+    } else {
+        if (hci_send_cmd(dd, ogf, ocf, length, cmd_data) < 0)
+            exit(EXIT_FAILURE);
+        while ((len = read(dd, buf, sizeof(buf))) < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            printf("While loop for reading event failed\n");
+            trace_end(TRACE_SEND_CMD);
+            last_command_status = COMMAND_STATUS_READ_FAILED;
+            return;
+        }
     }
 
+    uint64_t rtt_ns = get_time_ns() - start_ns;
+    metrics_observe_ns(METRICS_HCI_RTT, rtt_ns);
+    hci_profile_record(cmd_opcode_pack(ogf, ocf), rtt_ns);
+    trace_end(TRACE_SEND_CMD);
+    btsnoop_event(buf, (int) len);
+
     hdr = (void *) (buf + 1);
     ptr = buf + (1 + HCI_EVENT_HDR_SIZE);
     len -= (1 + HCI_EVENT_HDR_SIZE);
@@ -72,15 +119,21 @@ static void send_cmd(int dd, uint8_t ogf, uint16_t ocf, uint8_t *cmd_data, int l
         case EVT_CMD_COMPLETE:
             cc = (void *) ptr;
 
-            if (cc->opcode != opcode)
-                printf("Received event with invalid opcode 0x%X. Expected 0x%X\n", cc->opcode, opcode);
+            last_command_status = 0;
+            if (cc->opcode != opcode) {
+                last_command_status = COMMAND_STATUS_UNEXPECTED_EVENT;
+                if (report_command_errors)
+                    printf("Received event with invalid opcode 0x%X. Expected 0x%X\n", cc->opcode, opcode);
+            }
 
             ptr += EVT_CMD_COMPLETE_SIZE;
             len -= EVT_CMD_COMPLETE_SIZE;
 
             uint8_t rparam[10] = { 0 };
-            memcpy(rparam, ptr, len);
-            if (rparam[0] && ocf != 0x3C)
+            memcpy(rparam, ptr, MIN(len, (ssize_t) sizeof(rparam)));
+            if (rparam[0] && last_command_status == 0)
+                last_command_status = rparam[0];
+            if (rparam[0] && ocf != 0x3C && report_command_errors)
                 printf("Command 0x%X returned error 0x%X\n", ocf, rparam[0]);
             if (ocf == OCF_LE_READ_LOCAL_SUPPORTED_FEATURES) {
                 printf("Supported Low Energy Bluetooth features:\n");
@@ -91,8 +144,23 @@ static void send_cmd(int dd, uint8_t ogf, uint16_t ocf, uint8_t *cmd_data, int l
             fflush(stdout);
             return;
 
+        case EVT_CMD_STATUS:
+            // Sent instead of Command Complete by commands that finish later with an event of their own
+            cs = (void *) ptr;
+            last_command_status = cs->status;
+            if (cs->opcode != opcode) {
+                last_command_status = COMMAND_STATUS_UNEXPECTED_EVENT;
+                if (report_command_errors)
+                    printf("Received status event with invalid opcode 0x%X. Expected 0x%X\n", cs->opcode, opcode);
+            } else if (cs->status && report_command_errors) {
+                printf("Command 0x%X returned status 0x%X\n", ocf, cs->status);
+            }
+            return;
+
         default:
-            printf("Received unknown event: 0x%X\n", hdr->evt);
+            last_command_status = COMMAND_STATUS_UNEXPECTED_EVENT;
+            if (report_command_errors)
+                printf("Received unknown event: 0x%X\n", hdr->evt);
             return;
     }
 }
@@ -302,6 +370,22 @@ static void hci_le_set_extended_advertising_data_pack(int dd, uint8_t set,
     send_cmd(dd, ogf, ocf, buf, sizeof(buf));
 }
 
+// Sets arbitrary advertising data of up to BT_EXT_MAX_ADV_DATA_LENGTH bytes. Used for profiling the controller
+static void hci_le_set_extended_advertising_data_raw(int dd, uint8_t set, const uint8_t *data, uint8_t length) {
+    uint8_t ogf = OGF_LE_CTL; // Opcode Group Field. LE Controller Commands
+    uint16_t ocf = 0x37;      // Opcode Command Field: LE Set Extended Advertising Data
+    uint8_t buf[4 + BT_EXT_MAX_ADV_DATA_LENGTH] =
+                    { 0x00,   // Advertising_Handle: Used to identify an advertising set
+                      0x03,   // Operation: 3 = Complete extended advertising data
+                      0x01,   // Fragment_Preference: 1 = The Controller should not fragment or should minimize fragmentation of Host advertising data
+                      0x00 }; // Advertising_Data_Length: The number of octets in the Advertising Data parameter
+    length = MIN(length, BT_EXT_MAX_ADV_DATA_LENGTH);
+    buf[0] = set;
+    buf[3] = length;
+    memcpy(&buf[4], data, length);
+    send_cmd(dd, ogf, ocf, buf, 4 + length);
+}
+
 static void hci_le_set_extended_advertising_disable(int dd) {
     uint8_t ogf = OGF_LE_CTL; // Opcode Group Field. LE Controller Commands
     uint16_t ocf = 0x39;      // Opcode Command Field: LE Set Extended Advertising Enable
@@ -332,6 +416,20 @@ static void hci_le_set_extended_advertising_enable(int dd, struct config_data *c
     send_cmd(dd, ogf, ocf, buf, sizeof(buf));
 }
 
+// Enables or disables a single advertising set, leaving any other sets as they are
+static void hci_le_set_extended_advertising_set_enable(int dd, uint8_t set, bool enable) {
+    uint8_t ogf = OGF_LE_CTL; // Opcode Group Field. LE Controller Commands
+    uint16_t ocf = 0x39;      // Opcode Command Field: LE Set Extended Advertising Enable
+    uint8_t buf[] = { 0x00,   // Enable: 0 = Advertising is disabled, 1 = Advertising is enabled
+                      0x01,   // Number_of_Sets: Number of advertising sets to enable or disable
+                      0x00,   // Advertising_Handle[i]:
+                      0x00, 0x00,   // Duration[i]: 0 = No advertising duration. Advertising to continue until the Host disables it
+                      0x00 };       // Max_Extended_Advertising_Events[i]: 0 = No maximum number of advertising events
+    buf[0] = enable ? 0x01 : 0x00;
+    buf[2] = set;
+    send_cmd(dd, ogf, ocf, buf, sizeof(buf));
+}
+
 static void hci_le_remove_advertising_set(int dd, uint8_t set) {
     uint8_t ogf = OGF_LE_CTL; // Opcode Group Field. LE Controller Commands
     uint16_t ocf = 0x3C;      // Opcode Command Field: LE Remove Advertising Set
@@ -348,7 +446,7 @@ static void stop_transmit(struct config_data *config) {
 }
 
 void init_bluetooth(struct config_data *config) {
-    uint8_t mac[6] = { 0 };
+    uint8_t *mac = random_address;
     generate_random_mac_address(mac);
 
     device_descriptor = open_hci_device();
@@ -359,19 +457,19 @@ void init_bluetooth(struct config_data *config) {
 
     if (config->use_btl) {
         hci_reset(device_descriptor);
-        hci_le_set_advertising_parameters(device_descriptor, 100);
+        hci_le_set_advertising_parameters(device_descriptor, config->interval_btl_ms);
         hci_le_set_random_address(device_descriptor, mac);
     }
 
     if (config->use_bt4) {
         hci_reset(device_descriptor);
-        hci_le_set_extended_advertising_parameters(device_descriptor, config->handle_bt4, 300, false);
+        hci_le_set_extended_advertising_parameters(device_descriptor, config->handle_bt4, config->interval_bt4_ms, false);
         hci_le_set_advertising_set_random_address(device_descriptor, config->handle_bt4, mac);
     }
 
     if (config->use_bt5) {
         hci_reset(device_descriptor);
-        hci_le_set_extended_advertising_parameters(device_descriptor, config->handle_bt5, 950, true);
+        hci_le_set_extended_advertising_parameters(device_descriptor, config->handle_bt5, config->interval_bt5_ms, true);
         hci_le_set_advertising_set_random_address(device_descriptor, config->handle_bt5, mac);
     }
 
@@ -385,6 +483,39 @@ void init_bluetooth(struct config_data *config) {
         hci_le_set_extended_advertising_enable(device_descriptor, config);
 }
 
+// Applies changed advertising intervals. Only the affected advertising set is disabled while its parameters
+// are updated. Its advertising data is kept by the controller and the other sets continue advertising.
+void update_bluetooth_intervals(const struct config_data *old, struct config_data *config) {
+    if (config->use_btl && old->interval_btl_ms != config->interval_btl_ms) {
+        hci_le_set_advertising_disable(device_descriptor);
+        hci_le_set_advertising_parameters(device_descriptor, config->interval_btl_ms);
+        hci_le_set_advertising_enable(device_descriptor);
+    }
+
+    if (config->use_bt4 && old->interval_bt4_ms != config->interval_bt4_ms) {
+        hci_le_set_extended_advertising_set_enable(device_descriptor, config->handle_bt4, false);
+        hci_le_set_extended_advertising_parameters(device_descriptor, config->handle_bt4, config->interval_bt4_ms, false);
+        hci_le_set_extended_advertising_set_enable(device_descriptor, config->handle_bt4, true);
+    }
+
+    if (config->use_bt5 && old->interval_bt5_ms != config->interval_bt5_ms) {
+        hci_le_set_extended_advertising_set_enable(device_descriptor, config->handle_bt5, false);
+        hci_le_set_extended_advertising_parameters(device_descriptor, config->handle_bt5, config->interval_bt5_ms, true);
+        hci_le_set_extended_advertising_set_enable(device_descriptor, config->handle_bt5, true);
+    }
+}
+
+// Takes over advertising sets left running by a previous process. The controller is not reset and the
+// advertising parameters, address and data are left as they are until the next data update.
+void adopt_bluetooth(const uint8_t *mac) {
+    device_descriptor = open_hci_device();
+    memcpy(random_address, mac, sizeof(random_address));
+}
+
+void get_bluetooth_address(uint8_t *mac) {
+    memcpy(mac, random_address, sizeof(random_address));
+}
+
 void send_bluetooth_message(const union ODID_Message_encoded *encoded, uint8_t msg_counter, struct config_data *config) {
     if (config->use_btl)
         hci_le_set_advertising_data(device_descriptor, encoded, msg_counter);
@@ -404,6 +535,241 @@ void send_bluetooth_message_pack(const struct ODID_MessagePack_encoded *pack_enc
 void close_bluetooth(struct config_data *config) {
     stop_transmit(config);
     hci_close_dev(device_descriptor);
+    hci_profile_report();
+}
+
+// Closes the HCI socket without stopping advertising, for handing over to a new process
+void detach_bluetooth() {
+    hci_close_dev(device_descriptor);
+    hci_profile_report();
+}
+
+// Fills data with a service data AD structure of the given total length
+static void fill_profile_data(uint8_t *data, uint8_t length, uint8_t counter) {
+    memset(data, counter, length);
+    data[0] = length - 1; // The length of the following data field
+    data[1] = 0x16;       // 16 = GAP AD Type = "Service Data - 16-bit UUID"
+    data[2] = 0xFA;       // 0xFFFA = ASTM International, ASTM Remote ID
+    data[3] = 0xFF;
+}
+
+/*
+ * Runs a fixed command workload and prints the round-trip time percentiles per command, for comparing
+ * controllers. The workload resets the controller, then repeatedly sets advertising parameters,
+ * 31 byte legacy and 251 byte extended advertising data and enables and disables an advertising set.
+ */
+void profile_bluetooth_controller(int iterations) {
+    const uint8_t set = 0;
+    uint8_t data[BT_EXT_MAX_ADV_DATA_LENGTH];
+
+    printf("Profiling the Bluetooth controller with %d iterations per command\n", iterations);
+    generate_random_mac_address(random_address);
+    device_descriptor = open_hci_device();
+
+    for (int i = 0; i < iterations; i++)
+        hci_reset(device_descriptor);
+    hci_le_read_local_supported_features(device_descriptor);
+
+    for (int i = 0; i < iterations; i++)
+        hci_le_set_extended_advertising_parameters(device_descriptor, set, BT4_DEFAULT_INTERVAL_MS, false);
+    hci_le_set_advertising_set_random_address(device_descriptor, set, random_address);
+    for (int i = 0; i < iterations; i++) {
+        fill_profile_data(data, BT_LEGACY_MAX_ADV_DATA_LENGTH, i);
+        hci_le_set_extended_advertising_data_raw(device_descriptor, set, data, BT_LEGACY_MAX_ADV_DATA_LENGTH);
+    }
+    for (int i = 0; i < iterations; i++) {
+        hci_le_set_extended_advertising_set_enable(device_descriptor, set, true);
+        hci_le_set_extended_advertising_set_enable(device_descriptor, set, false);
+    }
+
+    // Long Range advertising with extended advertising PDUs, which can carry the maximum data length
+    hci_le_set_extended_advertising_parameters(device_descriptor, set, BT5_DEFAULT_INTERVAL_MS, true);
+    for (int i = 0; i < iterations; i++) {
+        fill_profile_data(data, BT_EXT_MAX_ADV_DATA_LENGTH, i);
+        hci_le_set_extended_advertising_data_raw(device_descriptor, set, data, BT_EXT_MAX_ADV_DATA_LENGTH);
+    }
+    for (int i = 0; i < iterations; i++) {
+        hci_le_set_extended_advertising_set_enable(device_descriptor, set, true);
+        hci_le_set_extended_advertising_set_enable(device_descriptor, set, false);
+    }
+
+    hci_le_remove_advertising_set(device_descriptor, set);
+    hci_reset(device_descriptor);
+    hci_close_dev(device_descriptor);
+    hci_profile_report();
+}
+
+enum stress_mode { STRESS_LEGACY, STRESS_BT4_EXTENDED, STRESS_BT5_CODED, STRESS_MODE_AMOUNT };
+static const char *const stress_mode_names[STRESS_MODE_AMOUNT] = {
+        "Legacy advertising (LE Set Advertising Data)",
+        "BT4 over Extended Advertising (LE Set Extended Advertising Data, legacy PDUs)",
+        "BT5 Long Range (LE Set Extended Advertising Data, Coded PHY, message pack)",
+};
+
+// Target update rates per second. 0 = as fast as the controller returns Command Complete
+static const int stress_rates[] = { 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 0 };
+
+struct stress_step {
+    uint32_t *latencies_ns;
+    size_t count;
+    size_t capacity;
+    uint32_t errors[256];
+    uint32_t read_failures;
+    uint32_t unexpected_events;
+};
+
+static void stress_setup(enum stress_mode mode) {
+    const uint8_t set = 0;
+    hci_reset(device_descriptor);
+    switch (mode) {
+        case STRESS_LEGACY:
+            hci_le_set_advertising_parameters(device_descriptor, BT_LEGACY_DEFAULT_INTERVAL_MS);
+            hci_le_set_random_address(device_descriptor, random_address);
+            hci_le_set_advertising_enable(device_descriptor);
+            break;
+        case STRESS_BT4_EXTENDED:
+        case STRESS_BT5_CODED:
+            hci_le_set_extended_advertising_parameters(device_descriptor, set,
+                                                       mode == STRESS_BT5_CODED ? BT5_DEFAULT_INTERVAL_MS : BT4_DEFAULT_INTERVAL_MS,
+                                                       mode == STRESS_BT5_CODED);
+            hci_le_set_advertising_set_random_address(device_descriptor, set, random_address);
+            hci_le_set_extended_advertising_set_enable(device_descriptor, set, true);
+            break;
+        default:
+            break;
+    }
+}
+
+static void stress_update(enum stress_mode mode, uint32_t counter) {
+    union ODID_Message_encoded encoded;
+    struct ODID_MessagePack_encoded pack_enc;
+    memset(&encoded, counter, sizeof(encoded));
+    switch (mode) {
+        case STRESS_LEGACY:
+            hci_le_set_advertising_data(device_descriptor, &encoded, counter);
+            break;
+        case STRESS_BT4_EXTENDED:
+            hci_le_set_extended_advertising_data(device_descriptor, 0, &encoded, counter);
+            break;
+        case STRESS_BT5_CODED:
+            memset(&pack_enc, counter, sizeof(pack_enc));
+            pack_enc.SingleMessageSize = ODID_MESSAGE_SIZE;
+            pack_enc.MsgPackSize = ODID_PACK_MAX_MESSAGES;
+            hci_le_set_extended_advertising_data_pack(device_descriptor, 0, &pack_enc, counter);
+            break;
+        default:
+            break;
+    }
+}
+
+static double stress_run_step(enum stress_mode mode, int rate, int seconds, struct stress_step *step) {
+    uint64_t period_ns = rate > 0 ? 1000000000ULL / rate : 0;
+    uint64_t start_ns = get_time_ns(), end_ns = start_ns + (uint64_t) seconds * 1000000000ULL;
+    uint64_t next_ns = start_ns, now_ns = start_ns;
+    uint32_t counter = 0;
+
+    while (now_ns < end_ns) {
+        if (period_ns) {
+            // When the controller falls behind, the schedule is not caught up with bursts
+            if (next_ns + period_ns < now_ns)
+                next_ns = now_ns;
+            vclock_sleep_until(next_ns);
+            next_ns += period_ns;
+        }
+
+        uint64_t sent_ns = get_time_ns();
+        stress_update(mode, counter++);
+        now_ns = get_time_ns();
+
+        if (step->count == step->capacity) {
+            step->capacity = step->capacity ? step->capacity * 2 : 1024;
+            step->latencies_ns = realloc(step->latencies_ns, step->capacity * sizeof(uint32_t));
+            if (!step->latencies_ns) {
+                printf("Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        step->latencies_ns[step->count++] = (uint32_t) MIN(now_ns - sent_ns, UINT32_MAX);
+        if (last_command_status == COMMAND_STATUS_READ_FAILED)
+            step->read_failures++;
+        else if (last_command_status == COMMAND_STATUS_UNEXPECTED_EVENT)
+            step->unexpected_events++;
+        else if (last_command_status > 0)
+            step->errors[last_command_status & 0xFF]++;
+    }
+    return (double) step->count / ((double) (now_ns - start_ns) / 1e9);
+}
+
+static int compare_latency(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void stress_print_step(int rate, double achieved, struct stress_step *step) {
+    char target[16], errors[128] = "";
+    size_t length = 0;
+
+    qsort(step->latencies_ns, step->count, sizeof(uint32_t), compare_latency);
+    uint32_t p50 = step->latencies_ns[(step->count - 1) / 2];
+    uint32_t p99 = step->latencies_ns[(size_t) ((step->count - 1) * 0.99)];
+    uint32_t max = step->latencies_ns[step->count - 1];
+
+    for (int i = 0; i < 256 && length < sizeof(errors); i++) {
+        if (step->errors[i])
+            length += snprintf(errors + length, sizeof(errors) - length, "%s0x%02X x%u", length ? ", " : "", i, step->errors[i]);
+    }
+    if (step->read_failures && length < sizeof(errors))
+        length += snprintf(errors + length, sizeof(errors) - length, "%sread failed x%u", length ? ", " : "", step->read_failures);
+    if (step->unexpected_events && length < sizeof(errors))
+        snprintf(errors + length, sizeof(errors) - length, "%sunexpected event x%u", length ? ", " : "", step->unexpected_events);
+
+    if (rate > 0)
+        snprintf(target, sizeof(target), "%d", rate);
+    else
+        snprintf(target, sizeof(target), "max");
+    printf("%8s %10.1f %8.0f %8.0f %8.0f  %s\n", target, achieved, p50 / 1e3, p99 / 1e3, max / 1e3,
+           errors[0] ? errors : "-");
+}
+
+/*
+ * Finds how many advertising data updates per second the controller sustains in each advertising mode.
+ * The update rate is ramped up until the achieved rate falls clearly below the target, followed by a final
+ * step that sends the next update as soon as the previous one has completed. Only one command is
+ * outstanding at a time, like in the normal transmission. Runs against real or vhci virtual controllers.
+ */
+void stress_bluetooth_controller(int step_seconds) {
+    generate_random_mac_address(random_address);
+    device_descriptor = open_hci_device();
+    report_command_errors = false;
+
+    printf("Stressing the Bluetooth controller for %d s per rate step\n", step_seconds);
+    for (int mode = 0; mode < STRESS_MODE_AMOUNT; mode++) {
+        stress_setup(mode);
+        if (last_command_status != 0) {
+            printf("\n%s: Not supported by the controller (status %d)\n", stress_mode_names[mode], last_command_status);
+            continue;
+        }
+
+        printf("\n%s\n", stress_mode_names[mode]);
+        printf("%8s %10s %8s %8s %8s  %s\n", "Target/s", "Achieved/s", "P50 us", "P99 us", "Max us", "Errors");
+        double ceiling = 0;
+        for (size_t i = 0; i < sizeof(stress_rates) / sizeof(stress_rates[0]); i++) {
+            struct stress_step step = { 0 };
+            double achieved = stress_run_step(mode, stress_rates[i], step_seconds, &step);
+            stress_print_step(stress_rates[i], achieved, &step);
+            free(step.latencies_ns);
+            ceiling = MAX(ceiling, achieved);
+
+            // Skip the remaining fixed rates once the controller cannot keep up
+            if (stress_rates[i] > 0 && achieved < 0.9 * stress_rates[i])
+                i = sizeof(stress_rates) / sizeof(stress_rates[0]) - 2;
+        }
+        printf("Sustained ceiling: %.0f updates/s\n", ceiling);
+    }
+
+    report_command_errors = true;
+    hci_reset(device_descriptor);
+    hci_close_dev(device_descriptor);
 }
 
 // The below function was an early experiment in trying to use the higher SW layers of Bluez.
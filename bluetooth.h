@@ -14,10 +14,23 @@
 
 #include "utils.h"
 
+#define BT_LEGACY_DEFAULT_INTERVAL_MS 100
+#define BT4_DEFAULT_INTERVAL_MS 300
+#define BT5_DEFAULT_INTERVAL_MS 950
+#define BT_LEGACY_MAX_ADV_DATA_LENGTH 31 // Legacy advertising PDUs
+#define BT_EXT_MAX_ADV_DATA_LENGTH 251   // Extended advertising data in a single HCI command
+#define BT_STRESS_DEFAULT_STEP_S 3
+
 void init_bluetooth(struct config_data *config);
 void send_bluetooth_message(const union ODID_Message_encoded *encoded, uint8_t msg_counter, struct config_data *config);
 void send_bluetooth_message_extended_api(const union ODID_Message_encoded *encoded, uint8_t msg_counter, struct config_data *config);
 void send_bluetooth_message_pack(const struct ODID_MessagePack_encoded *pack_enc, uint8_t msg_counter, struct config_data *config);
+void update_bluetooth_intervals(const struct config_data *old, struct config_data *config);
+void adopt_bluetooth(const uint8_t *mac);
+void get_bluetooth_address(uint8_t *mac);
 void close_bluetooth(struct config_data *config);
+void detach_bluetooth();
+void profile_bluetooth_controller(int iterations);
+void stress_bluetooth_controller(int step_seconds);
 
 #endif //_BLUETOOTH_H_
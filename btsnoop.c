@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <endian.h>
+#include <pthread.h>
+
+#include "btsnoop.h"
+
+/*
+ * Mirrors the HCI commands and events of the transmitter into a btsnoop file, as written by btmon -w,
+ * for analysis in Wireshark, btmon -r or btsnoop_summary.
+ * The HCI path only copies each record into a memory buffer. A writer thread moves the buffer to the
+ * file, so file system latency never delays the controller communication. If the buffer is full, the
+ * record is dropped and counted in the drops field of the next record.
+ */
+
+static int capture_fd = -1;
+static pthread_t writer_thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending = PTHREAD_COND_INITIALIZER;
+static uint8_t buffer[BTSNOOP_BUFFER_SIZE];
+static size_t buffered = 0;
+static uint32_t drops = 0;
+static bool stopping = false;
+
+static void *writer_loop(void *arg) {
+    static uint8_t chunk[BTSNOOP_BUFFER_SIZE];
+    (void) arg;
+
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (buffered == 0 && !stopping)
+            pthread_cond_wait(&pending, &lock);
+        if (buffered == 0)
+            break;
+        size_t length = buffered;
+        memcpy(chunk, buffer, length);
+        buffered = 0;
+        pthread_mutex_unlock(&lock);
+
+        for (size_t written = 0; written < length; ) {
+            ssize_t ret = write(capture_fd, chunk + written, length - written);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0) {
+                perror("btsnoop write failed");
+                break;
+            }
+            written += ret;
+        }
+
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int btsnoop_open(const char *path) {
+    capture_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (capture_fd < 0) {
+        printf("Error: Unable to open the HCI capture file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct btsnoop_header header = { 0 };
+    memcpy(header.magic, BTSNOOP_MAGIC, sizeof(BTSNOOP_MAGIC));
+    header.version = htobe32(BTSNOOP_VERSION);
+    header.datalink = htobe32(BTSNOOP_DATALINK_H4);
+    if (write(capture_fd, &header, sizeof(header)) != sizeof(header) ||
+        pthread_create(&writer_thread, NULL, writer_loop, NULL) != 0) {
+        printf("Error: Unable to start the HCI capture to %s\n", path);
+        close(capture_fd);
+        capture_fd = -1;
+        return -1;
+    }
+    printf("Capturing HCI traffic to %s\n", path);
+    return 0;
+}
+
+static void append_record(uint32_t flags, const uint8_t *prefix, size_t prefix_length,
+                          const uint8_t *data, size_t length) {
+    if (capture_fd < 0)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t timestamp_us = (uint64_t) now.tv_sec * 1000000ULL + now.tv_nsec / 1000 + BTSNOOP_EPOCH_DELTA_US;
+
+    struct btsnoop_record record;
+    record.original_length = htobe32(prefix_length + length);
+    record.included_length = record.original_length;
+    record.flags = htobe32(flags);
+    record.timestamp_us = htobe64(timestamp_us);
+
+    pthread_mutex_lock(&lock);
+    if (buffered + sizeof(record) + prefix_length + length > sizeof(buffer)) {
+        drops++;
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    record.drops = htobe32(drops);
+    memcpy(buffer + buffered, &record, sizeof(record));
+    buffered += sizeof(record);
+    memcpy(buffer + buffered, prefix, prefix_length);
+    buffered += prefix_length;
+    if (length > 0)
+        memcpy(buffer + buffered, data, length);
+    buffered += length;
+    pthread_cond_signal(&pending);
+    pthread_mutex_unlock(&lock);
+}
+
+// Called right before the command is written to the HCI socket
+void btsnoop_command(uint16_t opcode, const uint8_t *params, uint8_t length) {
+    uint8_t h4_header[4] = { 0x01, opcode & 0xFF, opcode >> 8, length }; // HCI_COMMAND_PKT
+    append_record(BTSNOOP_FLAG_COMMAND_EVENT, h4_header, sizeof(h4_header), params, length);
+}
+
+// Called right after an event has been read from the HCI socket, including the packet indicator
+void btsnoop_event(const uint8_t *h4_packet, int length) {
+    if (length <= 0)
+        return;
+    append_record(BTSNOOP_FLAG_COMMAND_EVENT | BTSNOOP_FLAG_RECEIVED, h4_packet, length, NULL, 0);
+}
+
+void btsnoop_close() {
+    if (capture_fd < 0)
+        return;
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_signal(&pending);
+    pthread_mutex_unlock(&lock);
+    pthread_join(writer_thread, NULL);
+    if (drops > 0)
+        printf("HCI capture: %u records dropped\n", drops);
+    close(capture_fd);
+    capture_fd = -1;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _BTSNOOP_H_
+#define _BTSNOOP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BTSNOOP_MAGIC "btsnoop"
+#define BTSNOOP_VERSION 1
+#define BTSNOOP_DATALINK_H4 1002 // HCI UART (H4). Every packet starts with the packet indicator
+#define BTSNOOP_EPOCH_DELTA_US 0x00E03AB44A676000ULL // Microseconds from 0 AD to 1970
+
+#define BTSNOOP_FLAG_RECEIVED 0x01 // Controller to host
+#define BTSNOOP_FLAG_COMMAND_EVENT 0x02
+
+#define BTSNOOP_BUFFER_SIZE (256 * 1024)
+
+// All fields are big endian in the file
+struct btsnoop_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t datalink;
+} __attribute__((packed));
+
+struct btsnoop_record {
+    uint32_t original_length;
+    uint32_t included_length;
+    uint32_t flags;
+    uint32_t drops;
+    uint64_t timestamp_us;
+} __attribute__((packed));
+
+int btsnoop_open(const char *path);
+void btsnoop_command(uint16_t opcode, const uint8_t *params, uint8_t length);
+void btsnoop_event(const uint8_t *h4_packet, int length);
+void btsnoop_close(void);
+
+#endif //_BTSNOOP_H_
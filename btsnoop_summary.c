@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+/*
+ * Reports the round-trip time of every HCI command opcode in a btsnoop capture, from the command to
+ * its Command Complete or Command Status event. Reads captures of transmit (option t) and btmon -w.
+ *
+ * Usage: btsnoop_summary <capture file>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include "btsnoop.h"
+#include "hci_profile.h"
+
+#define HCI_COMMAND_PKT 0x01
+#define HCI_EVENT_PKT 0x04
+#define EVT_CMD_COMPLETE 0x0E
+#define EVT_CMD_STATUS 0x0F
+#define OPCODE_AMOUNT 65536
+
+struct opcode_stats {
+    uint64_t pending_us; // Timestamp of the outstanding command. 0 = none
+    uint32_t *rtt_us;
+    size_t count;
+    size_t capacity;
+    size_t unanswered;
+};
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const uint32_t *sorted, size_t count, double p) {
+    size_t index = (size_t) (p / 100.0 * (double) (count - 1) + 0.5);
+    return sorted[index];
+}
+
+static void add_rtt(struct opcode_stats *stats, uint64_t timestamp_us) {
+    if (stats->pending_us == 0)
+        return;
+    if (stats->count == stats->capacity) {
+        stats->capacity = stats->capacity ? stats->capacity * 2 : 64;
+        stats->rtt_us = realloc(stats->rtt_us, stats->capacity * sizeof(uint32_t));
+        if (!stats->rtt_us) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    stats->rtt_us[stats->count++] = (uint32_t) (timestamp_us - stats->pending_us);
+    stats->pending_us = 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <btsnoop file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    struct btsnoop_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, BTSNOOP_MAGIC, sizeof(BTSNOOP_MAGIC)) != 0 ||
+        be32toh(header.datalink) != BTSNOOP_DATALINK_H4) {
+        fprintf(stderr, "%s is not a btsnoop capture with H4 datalink\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    struct opcode_stats *stats = calloc(OPCODE_AMOUNT, sizeof(struct opcode_stats));
+    if (!stats)
+        return EXIT_FAILURE;
+
+    struct btsnoop_record record;
+    uint8_t packet[1024];
+    uint32_t records = 0, drops = 0;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        uint32_t length = be32toh(record.included_length);
+        uint64_t timestamp_us = be64toh(record.timestamp_us);
+        drops = be32toh(record.drops);
+        if (length > sizeof(packet) || fread(packet, 1, length, file) != length)
+            break;
+        records++;
+
+        if (packet[0] == HCI_COMMAND_PKT && length >= 3) {
+            struct opcode_stats *command = &stats[packet[1] | packet[2] << 8];
+            if (command->pending_us)
+                command->unanswered++;
+            command->pending_us = timestamp_us;
+        } else if (packet[0] == HCI_EVENT_PKT && packet[1] == EVT_CMD_COMPLETE && length >= 6) {
+            add_rtt(&stats[packet[4] | packet[5] << 8], timestamp_us);
+        } else if (packet[0] == HCI_EVENT_PKT && packet[1] == EVT_CMD_STATUS && length >= 7) {
+            add_rtt(&stats[packet[5] | packet[6] << 8], timestamp_us);
+        }
+    }
+    fclose(file);
+
+    printf("%u records, %u dropped during capture\n\n", records, drops);
+    printf("Opcode  %-40s %7s %9s %9s %9s %9s %9s\n", "Command", "Count", "Min us", "P50 us", "P90 us", "P99 us",
+           "Max us");
+    for (int opcode = 0; opcode < OPCODE_AMOUNT; opcode++) {
+        struct opcode_stats *s = &stats[opcode];
+        if (s->count == 0 && s->unanswered == 0 && s->pending_us == 0)
+            continue;
+        if (s->count == 0) {
+            printf("0x%04X  %-40s %7d  (no response)\n", opcode, hci_opcode_name(opcode), 0);
+            continue;
+        }
+        qsort(s->rtt_us, s->count, sizeof(uint32_t), compare_u32);
+        printf("0x%04X  %-40s %7zu %9u %9u %9u %9u %9u\n", opcode, hci_opcode_name(opcode), s->count, s->rtt_us[0],
+               percentile(s->rtt_us, s->count, 50), percentile(s->rtt_us, s->count, 90),
+               percentile(s->rtt_us, s->count, 99), s->rtt_us[s->count - 1]);
+        if (s->unanswered > 0)
+            printf("        %zu commands without a response\n", s->unanswered);
+        free(s->rtt_us);
+    }
+    free(stats);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "compliance.h"
+#include "utils.h"
+#include "vclock.h"
+
+/*
+ * Tracks for every transport and message type when the data was last handed to the transport. The
+ * Location message must be refreshed at least every second and the static messages at least every three
+ * seconds. A checker thread flags a gap as soon as it exceeds the limit, so a stalled transmit loop is
+ * reported while it is stalled and not only when it recovers.
+ * Rates and maximum gaps are kept in per-second buckets over a sliding window and exported with the
+ * other metrics. Warnings are printed by the checker thread, never from the transmit path.
+ */
+
+static const char *const message_names[COMPLIANCE_MESSAGE_TYPES] = {
+        "Basic ID", "Location", "Auth", "Self ID", "System", "Operator ID"
+};
+
+struct window_bucket {
+    uint64_t second;
+    uint32_t count;
+    uint64_t max_gap_ns;
+};
+
+struct pair_state {
+    bool active; // Set by the first message. Transports that are not used or not ready are not checked
+    bool violating;
+    uint64_t last_ns;
+    uint64_t violations;
+    uint64_t late_gap_ns; // A gap that ended before the checker saw it. Reported by the checker
+    uint64_t max_gap_ns;
+    uint64_t count;
+    uint64_t first_ns;
+    struct window_bucket buckets[COMPLIANCE_WINDOW_S];
+};
+
+static struct pair_state pairs[TRANSPORT_AMOUNT][COMPLIANCE_MESSAGE_TYPES];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t checker_thread;
+static sem_t checker_wake; // Posted to stop the checker
+static _Atomic bool checker_running = false;
+
+static uint64_t max_gap_ns(int message_type) {
+    int limit_ms = message_type == ODID_MESSAGETYPE_LOCATION ? COMPLIANCE_DYNAMIC_MAX_GAP_MS
+                                                             : COMPLIANCE_STATIC_MAX_GAP_MS;
+    return (uint64_t) limit_ms * 1000000ULL;
+}
+
+static void record(enum transport transport, int message_type, uint64_t now_ns) {
+    struct pair_state *pair = &pairs[transport][message_type];
+    uint64_t second = now_ns / 1000000000ULL;
+    struct window_bucket *bucket = &pair->buckets[second % COMPLIANCE_WINDOW_S];
+    if (bucket->second != second) {
+        bucket->second = second;
+        bucket->count = 0;
+        bucket->max_gap_ns = 0;
+    }
+    bucket->count++;
+
+    if (pair->active) {
+        uint64_t gap = now_ns - pair->last_ns;
+        bucket->max_gap_ns = MAXIMUM(bucket->max_gap_ns, gap);
+        pair->max_gap_ns = MAXIMUM(pair->max_gap_ns, gap);
+        if (gap > max_gap_ns(message_type) && !pair->violating) {
+            pair->violations++;
+            pair->late_gap_ns = gap;
+        }
+    } else {
+        pair->active = true;
+        pair->first_ns = now_ns;
+    }
+    pair->violating = false;
+    pair->last_ns = now_ns;
+    pair->count++;
+}
+
+void compliance_message(enum transport transport, uint8_t message_type) {
+    if (message_type >= COMPLIANCE_MESSAGE_TYPES)
+        return;
+    uint64_t now_ns = get_time_ns();
+    pthread_mutex_lock(&lock);
+    record(transport, message_type, now_ns);
+    pthread_mutex_unlock(&lock);
+}
+
+// Only the message types in the pack are recorded. A signed pack, e.g., has no Self ID
+void compliance_pack(enum transport transport, const struct ODID_MessagePack_encoded *pack_enc) {
+    uint32_t types = 0;
+    for (int i = 0; i < MINIMUM(pack_enc->MsgPackSize, ODID_PACK_MAX_MESSAGES); i++) {
+        int message_type = pack_enc->Messages[i].rawData[0] >> 4;
+        if (message_type < COMPLIANCE_MESSAGE_TYPES)
+            types |= 1U << message_type;
+    }
+    uint64_t now_ns = get_time_ns();
+    pthread_mutex_lock(&lock);
+    for (int m = 0; m < COMPLIANCE_MESSAGE_TYPES; m++) {
+        if (types & (1U << m))
+            record(transport, m, now_ns);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// Must be called with the lock held
+static void window_stats(const struct pair_state *pair, uint64_t now_ns, double *rate_hz, uint64_t *max_gap) {
+    uint64_t second = now_ns / 1000000000ULL;
+    uint32_t count = 0;
+    *max_gap = now_ns - pair->last_ns; // The gap that is still open
+    for (int i = 0; i < COMPLIANCE_WINDOW_S; i++) {
+        const struct window_bucket *bucket = &pair->buckets[i];
+        if (bucket->second + COMPLIANCE_WINDOW_S > second) {
+            count += bucket->count;
+            *max_gap = MAXIMUM(*max_gap, bucket->max_gap_ns);
+        }
+    }
+    // Until the window has been filled, the rate is relative to the time since the first message
+    double window_s = MINIMUM((double) COMPLIANCE_WINDOW_S, (double) (now_ns - pair->first_ns) / 1e9 + 1);
+    *rate_hz = count / window_s;
+}
+
+static void check(uint64_t now_ns) {
+    char report[1024];
+    size_t length = 0;
+
+    pthread_mutex_lock(&lock);
+    for (int t = 0; t < TRANSPORT_AMOUNT; t++) {
+        for (int m = 0; m < COMPLIANCE_MESSAGE_TYPES; m++) {
+            struct pair_state *pair = &pairs[t][m];
+            if (!pair->active)
+                continue;
+            uint64_t gap = pair->late_gap_ns;
+            if (!gap && !pair->violating && now_ns - pair->last_ns > max_gap_ns(m)) {
+                pair->violating = true;
+                pair->violations++;
+                gap = now_ns - pair->last_ns;
+            }
+            pair->late_gap_ns = 0;
+            if (gap && length < sizeof(report))
+                length += snprintf(report + length, sizeof(report) - length, "%s%s %s %.1f s",
+                                   length ? ", " : "", transport_names[t], message_names[m], (double) gap / 1e9);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (length > 0)
+        printf("Compliance: Update rate violated (%s). Limits: Location %d ms, others %d ms\n", report,
+               COMPLIANCE_DYNAMIC_MAX_GAP_MS, COMPLIANCE_STATIC_MAX_GAP_MS);
+}
+
+static void *checker_loop(void *arg) {
+    (void) arg;
+    uint64_t next_ns = get_time_ns();
+
+    while (checker_running) {
+        next_ns += COMPLIANCE_CHECK_INTERVAL_MS * 1000000ULL;
+        if (vclock_sem_wait(&checker_wake, next_ns) == 0)
+            break;
+        check(get_time_ns());
+    }
+    return NULL;
+}
+
+int compliance_start() {
+    sem_init(&checker_wake, 0, 0);
+    checker_running = true;
+    if (vclock_thread_create(&checker_thread, checker_loop, NULL) != 0) {
+        checker_running = false;
+        sem_destroy(&checker_wake);
+        return -1;
+    }
+    return 0;
+}
+
+void compliance_stop() {
+    if (!checker_running)
+        return;
+    uint64_t now_ns = get_time_ns();
+    checker_running = false;
+    vclock_sem_post(&checker_wake);
+    vclock_thread_join(checker_thread, NULL);
+    sem_destroy(&checker_wake);
+
+    pthread_mutex_lock(&lock);
+    for (int t = 0; t < TRANSPORT_AMOUNT; t++) {
+        bool used = false;
+        for (int m = 0; m < COMPLIANCE_MESSAGE_TYPES; m++)
+            used |= pairs[t][m].active;
+        for (int m = 0; m < COMPLIANCE_MESSAGE_TYPES; m++) {
+            struct pair_state *pair = &pairs[t][m];
+            if (!pair->active) {
+                if (used)
+                    printf("Compliance: %s %s: not sent\n", transport_names[t], message_names[m]);
+                continue;
+            }
+            double seconds = (double) (now_ns - pair->first_ns) / 1e9;
+            uint64_t max_gap = MAXIMUM(pair->max_gap_ns, now_ns - pair->last_ns);
+            printf("Compliance: %s %s: %.2f Hz average, max gap %.2f s, %lu violations\n", transport_names[t],
+                   message_names[m], seconds > 0 ? pair->count / seconds : 0, (double) max_gap / 1e9,
+                   (unsigned long) pair->violations);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+#define APPEND(...) do { \
+        if (length < size) \
+            length += snprintf(buf + length, size - length, __VA_ARGS__); \
+    } while (0)
+
+size_t compliance_format_metrics(char *buf, size_t size) {
+    static const char *const kinds[] = { "violations_total", "rate_hz", "max_gap_seconds" };
+    static const char *const help[] = {
+            "Update gaps longer than the required maximum, by transport and message type",
+            "Updates per second over the sliding window",
+            "Longest update gap within the sliding window, including the currently open gap",
+    };
+    static const char *const types[] = { "counter", "gauge", "gauge" };
+    uint64_t now_ns = get_time_ns();
+    size_t length = 0;
+
+    pthread_mutex_lock(&lock);
+    for (int k = 0; k < 3; k++) {
+        APPEND("# HELP odid_compliance_%s %s\n", kinds[k], help[k]);
+        APPEND("# TYPE odid_compliance_%s %s\n", kinds[k], types[k]);
+        for (int t = 0; t < TRANSPORT_AMOUNT; t++) {
+            for (int m = 0; m < COMPLIANCE_MESSAGE_TYPES; m++) {
+                struct pair_state *pair = &pairs[t][m];
+                if (!pair->active)
+                    continue;
+                double rate_hz;
+                uint64_t max_gap;
+                window_stats(pair, now_ns, &rate_hz, &max_gap);
+                APPEND("odid_compliance_%s{transport=\"%s\",message_type=\"%d\"} ", kinds[k], transport_labels[t], m);
+                if (k == 0)
+                    APPEND("%lu\n", (unsigned long) pair->violations);
+                else if (k == 1)
+                    APPEND("%.3f\n", rate_hz);
+                else
+                    APPEND("%.3f\n", (double) max_gap / 1e9);
+            }
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return MINIMUM(length, size - 1);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _COMPLIANCE_H_
+#define _COMPLIANCE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <opendroneid.h>
+#include "metrics.h"
+
+#define COMPLIANCE_MESSAGE_TYPES 6      // Basic ID, Location, Auth, Self ID, System and Operator ID
+#define COMPLIANCE_DYNAMIC_MAX_GAP_MS 1000 // Location/Vector at least once per second
+#define COMPLIANCE_STATIC_MAX_GAP_MS 3000  // The other message types at least every 3 seconds
+#define COMPLIANCE_WINDOW_S 10          // Sliding window for the rates and maximum gaps
+#define COMPLIANCE_CHECK_INTERVAL_MS 100
+
+void compliance_message(enum transport transport, uint8_t message_type);
+void compliance_pack(enum transport transport, const struct ODID_MessagePack_encoded *pack_enc);
+size_t compliance_format_metrics(char *buf, size_t size);
+
+int compliance_start(void);
+void compliance_stop(void);
+
+#endif //_COMPLIANCE_H_
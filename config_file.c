@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <sys/inotify.h>
+
+#include "config_file.h"
+
+/*
+ * The configuration file holds one key = value pair per line. Lines starting with # are comments.
+ * The keys below either set a field in struct config_data or in the static parts of the UAS data.
+ * E.g.:
+ *     basic_id = 112624150A90E3AE1EC0
+ *     self_id = Survey flight
+ *     bt5_interval_ms = 500
+ */
+
+enum config_type { TYPE_INT, TYPE_UINT8, TYPE_UINT16, TYPE_FLOAT, TYPE_DOUBLE, TYPE_STRING };
+enum config_target { TARGET_CONFIG, TARGET_UAS };
+
+struct config_key {
+    const char *name;
+    enum config_target target;
+    enum config_type type;
+    size_t offset;
+    size_t size;
+    double min; // Numbers outside [min, max] are rejected. Not used for strings
+    double max;
+};
+
+#define CONFIG_KEY(name, member, type, min, max) \
+    { name, TARGET_CONFIG, type, offsetof(struct config_data, member), sizeof(((struct config_data *) 0)->member), \
+      min, max }
+#define UAS_KEY(name, member, type, min, max) \
+    { name, TARGET_UAS, type, offsetof(struct ODID_UAS_Data, member), sizeof(((struct ODID_UAS_Data *) 0)->member), \
+      min, max }
+
+// Enumerations are set with their numeric value as defined in opendroneid.h. Their range is the width of
+// the field in the encoded message. Advertising intervals are limited to what legacy advertising supports
+static const struct config_key config_keys[] = {
+        CONFIG_KEY("bt_legacy_interval_ms", interval_btl_ms,    TYPE_INT, 20, 10240),
+        CONFIG_KEY("bt4_interval_ms",       interval_bt4_ms,    TYPE_INT, 20, 10240),
+        CONFIG_KEY("bt5_interval_ms",       interval_bt5_ms,    TYPE_INT, 20, 10240),
+        CONFIG_KEY("bt4_handle",            handle_bt4,         TYPE_UINT8, 0, 0xEF),
+        CONFIG_KEY("bt5_handle",            handle_bt5,         TYPE_UINT8, 0, 0xEF),
+        CONFIG_KEY("nan_interval_ms",       nan_interval_ms,    TYPE_INT, 10, 10000),
+        CONFIG_KEY("pack_refresh_ms",       pack_refresh_ms,    TYPE_INT, 1, PACK_REFRESH_MAX_MS),
+        CONFIG_KEY("push_interval_ms",      push_interval_ms,   TYPE_INT, 1, 1000),
+        CONFIG_KEY("extrapolate_max_ms",    extrapolate_max_ms, TYPE_INT, 0, 10000),
+        CONFIG_KEY("rt_transmit_priority",  rt_priority[REALTIME_TRANSMIT], TYPE_INT, 1, 99),
+        CONFIG_KEY("rt_hci_priority",       rt_priority[REALTIME_HCI],      TYPE_INT, 1, 99),
+        CONFIG_KEY("rt_gps_priority",       rt_priority[REALTIME_GPS],      TYPE_INT, 1, 99),
+        CONFIG_KEY("rt_transmit_cpu",       rt_cpu[REALTIME_TRANSMIT],      TYPE_INT, -1, CPU_SETSIZE - 1),
+        CONFIG_KEY("rt_hci_cpu",            rt_cpu[REALTIME_HCI],           TYPE_INT, -1, CPU_SETSIZE - 1),
+        CONFIG_KEY("rt_gps_cpu",            rt_cpu[REALTIME_GPS],           TYPE_INT, -1, CPU_SETSIZE - 1),
+        CONFIG_KEY("rt_deadline_us",        rt_deadline_us,     TYPE_INT, 1, 1000000),
+
+        UAS_KEY("ua_type",                  BasicID[0].UAType,                TYPE_INT, 0, 15),
+        UAS_KEY("basic_id_type",            BasicID[0].IDType,                TYPE_INT, 0, 15),
+        UAS_KEY("basic_id",                 BasicID[0].UASID,                 TYPE_STRING, 0, 0),
+        UAS_KEY("basic_id_2_type",          BasicID[1].IDType,                TYPE_INT, 0, 15),
+        UAS_KEY("basic_id_2",               BasicID[1].UASID,                 TYPE_STRING, 0, 0),
+        UAS_KEY("self_id_type",             SelfID.DescType,                  TYPE_INT, 0, 255),
+        UAS_KEY("self_id",                  SelfID.Desc,                      TYPE_STRING, 0, 0),
+        UAS_KEY("operator_location_type",   System.OperatorLocationType,      TYPE_INT, 0, 3),
+        UAS_KEY("classification_type",      System.ClassificationType,        TYPE_INT, 0, 7),
+        UAS_KEY("operator_latitude",        System.OperatorLatitude,          TYPE_DOUBLE, -90, 90),
+        UAS_KEY("operator_longitude",       System.OperatorLongitude,         TYPE_DOUBLE, -180, 180),
+        UAS_KEY("operator_altitude_geo",    System.OperatorAltitudeGeo,       TYPE_FLOAT, -1000, 31767.5),
+        UAS_KEY("area_count",               System.AreaCount,                 TYPE_UINT16, 1, 65000),
+        UAS_KEY("area_radius",              System.AreaRadius,                TYPE_UINT16, 0, 2550),
+        UAS_KEY("area_ceiling",             System.AreaCeiling,               TYPE_FLOAT, -1000, 31767.5),
+        UAS_KEY("area_floor",               System.AreaFloor,                 TYPE_FLOAT, -1000, 31767.5),
+        UAS_KEY("category_eu",              System.CategoryEU,                TYPE_INT, 0, 15),
+        UAS_KEY("class_eu",                 System.ClassEU,                   TYPE_INT, 0, 15),
+        UAS_KEY("operator_id_type",         OperatorID.OperatorIdType,        TYPE_INT, 0, 255),
+        UAS_KEY("operator_id",              OperatorID.OperatorId,            TYPE_STRING, 0, 0),
+        { NULL, TARGET_CONFIG, TYPE_INT, 0, 0, 0, 0 }
+};
+
+static int inotify_fd = -1;
+static char watched_name[NAME_MAX + 1];
+static _Atomic bool reload_requested = false;
+
+// The file is read in one go into this buffer, since a FILE stream would allocate on every reload
+static char file_buffer[CONFIG_FILE_MAX_SIZE + 2];
+
+static char *trim(char *str) {
+    while (*str == ' ' || *str == '\t')
+        str++;
+    char *end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+        end--;
+    *end = '\0';
+    return str;
+}
+
+static int set_value(const struct config_key *key, void *base, const char *value) {
+    char *end;
+    void *field = (char *) base + key->offset;
+
+    if (key->type == TYPE_STRING) {
+        if (strlen(value) >= key->size)
+            return -1;
+        memset(field, 0, key->size);
+        memcpy(field, value, strlen(value));
+        return 0;
+    }
+
+    errno = 0;
+    double number = strtod(value, &end);
+    if (errno != 0 || end == value || *end != '\0')
+        return -1;
+    // Also rejects NaN. The ranges lie within the field types, so the conversions below are defined
+    if (!(number >= key->min && number <= key->max))
+        return -1;
+
+    switch (key->type) {
+        case TYPE_INT:
+            *(int *) field = (int) number;
+            break;
+        case TYPE_UINT8:
+            *(uint8_t *) field = (uint8_t) number;
+            break;
+        case TYPE_UINT16:
+            *(uint16_t *) field = (uint16_t) number;
+            break;
+        case TYPE_FLOAT:
+            *(float *) field = (float) number;
+            break;
+        case TYPE_DOUBLE:
+            *(double *) field = number;
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+// Reads the file into file_buffer, null terminated. Returns -1 on errors or when it exceeds CONFIG_FILE_MAX_SIZE
+static int read_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        printf("Error: Unable to open the configuration file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    size_t size = 0;
+    ssize_t length;
+    while ((length = read(fd, file_buffer + size, sizeof(file_buffer) - 1 - size)) > 0)
+        size += length;
+    close(fd);
+    if (length < 0) {
+        printf("Error: Unable to read the configuration file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (size > CONFIG_FILE_MAX_SIZE) {
+        printf("Error: The configuration file %s is larger than %d bytes\n", path, CONFIG_FILE_MAX_SIZE);
+        return -1;
+    }
+    file_buffer[size] = '\0';
+    return 0;
+}
+
+// Parses the whole file before returning. On errors, -1 is returned and the caller should discard the
+// partially updated config and uasData.
+int config_file_load(const char *path, struct config_data *config, struct ODID_UAS_Data *uasData) {
+    if (read_file(path) != 0)
+        return -1;
+
+    int line_number = 0, ret = 0;
+    for (char *line = file_buffer, *next; *line; line = next) {
+        next = strchrnul(line, '\n');
+        if (*next)
+            *next++ = '\0';
+        line_number++;
+        char *str = trim(line);
+        if (*str == '#' || *str == '\0')
+            continue;
+
+        char *separator = strchr(str, '=');
+        if (!separator) {
+            printf("Error: %s:%d: Expected key = value\n", path, line_number);
+            ret = -1;
+            continue;
+        }
+        *separator = '\0';
+        char *name = trim(str);
+        char *value = trim(separator + 1);
+
+        int i;
+        for (i = 0; config_keys[i].name; i++) {
+            if (strcmp(config_keys[i].name, name) == 0)
+                break;
+        }
+        if (!config_keys[i].name) {
+            printf("Warning: %s:%d: Unknown key %s\n", path, line_number, name);
+            continue;
+        }
+
+        void *base = config_keys[i].target == TARGET_CONFIG ? (void *) config : (void *) uasData;
+        if (set_value(&config_keys[i], base, value) != 0) {
+            if (config_keys[i].type == TYPE_STRING)
+                printf("Error: %s:%d: Invalid value for %s: %s\n", path, line_number, name, value);
+            else
+                printf("Error: %s:%d: Invalid value for %s: %s (allowed %g to %g)\n", path, line_number, name, value,
+                       config_keys[i].min, config_keys[i].max);
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/*
+ * Watches the directory of the configuration file, since editors often replace the file with a new one
+ * instead of writing to it. The descriptor is non-blocking and polled by config_file_changed().
+ */
+int config_file_watch(const char *path) {
+    char directory[PATH_MAX], name[PATH_MAX];
+    strncpy(directory, path, sizeof(directory) - 1);
+    directory[sizeof(directory) - 1] = '\0';
+    strncpy(name, path, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    strncpy(watched_name, basename(name), sizeof(watched_name) - 1);
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0)
+        return -1;
+    if (inotify_add_watch(inotify_fd, dirname(directory), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Called from the SIGHUP handler
+void config_file_request_reload() {
+    reload_requested = true;
+}
+
+// Returns true once after the file has been written or replaced, or a reload has been requested
+bool config_file_changed() {
+    bool changed = atomic_exchange(&reload_requested, false);
+    if (inotify_fd < 0)
+        return changed;
+
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len; ) {
+            struct inotify_event *event = (struct inotify_event *) ptr;
+            if (event->len > 0 && strcmp(event->name, watched_name) == 0)
+                changed = true;
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+void config_file_close() {
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+    inotify_fd = -1;
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _CONFIG_FILE_H_
+#define _CONFIG_FILE_H_
+
+#include <stdbool.h>
+#include "utils.h"
+
+#define CONFIG_FILE_MAX_SIZE 16384
+
+int config_file_load(const char *path, struct config_data *config, struct ODID_UAS_Data *uasData);
+int config_file_watch(const char *path);
+void config_file_request_reload(void);
+bool config_file_changed(void);
+void config_file_close(void);
+
+#endif //_CONFIG_FILE_H_
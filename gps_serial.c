@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <termios.h>
+
+#include "gps_serial.h"
+
+#define KNOTS_TO_MPS 0.514444
+#define KMH_TO_MPS (1 / 3.6)
+
+#define UBX_SYNC_CHAR_1 0xB5
+#define UBX_SYNC_CHAR_2 0x62
+#define UBX_CLASS_NAV 0x01
+#define UBX_ID_NAV_PVT 0x07
+#define UBX_NAV_PVT_LENGTH 92
+
+/*
+ * Both parsers are incremental: bytes are fed one at a time as they arrive from the serial port,
+ * so a sentence or frame split across several reads is handled without any extra buffering.
+ * Each NAV-PVT completes a fix. The NMEA sentences of one epoch (GGA, RMC, VTG and GST) are collected
+ * into one fix, which is completed after the last sentence of the epoch. Which sentence that is depends
+ * on the receiver, so it is learned from the epochs before: the first epoch with a fix is completed
+ * when the time of day changes, the later ones as soon as their last sentence has been parsed.
+ */
+
+static const struct {
+    int baudrate;
+    speed_t speed;
+} baudrates[] = {
+        { 4800, B4800 }, { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+        { 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 }, { 921600, B921600 },
+};
+
+static void clear_fix(struct gps_fix_t *fix) {
+    memset(fix, 0, sizeof(*fix));
+    fix->latitude = fix->longitude = NAN;
+    fix->altitude = fix->altHAE = fix->altMSL = NAN;
+    fix->track = fix->speed = fix->climb = NAN;
+    fix->ept = fix->epx = fix->epy = fix->epv = fix->eps = fix->epd = fix->epc = fix->eph = NAN;
+    fix->sep = NAN;
+    fix->mode = MODE_NO_FIX;
+}
+
+static bool field_empty(const char *field) {
+    return !field || field[0] == '\0';
+}
+
+static double parse_double(const char *field) {
+    return field_empty(field) ? NAN : strtod(field, NULL);
+}
+
+// NMEA coordinates are (d)ddmm.mmmm followed by a hemisphere field
+static double parse_coordinate(const char *field, const char *hemisphere) {
+    if (field_empty(field) || field_empty(hemisphere))
+        return NAN;
+    double value = strtod(field, NULL);
+    double degrees = floor(value / 100);
+    double result = degrees + (value - degrees * 100) / 60;
+    if (hemisphere[0] == 'S' || hemisphere[0] == 'W')
+        result = -result;
+    return result;
+}
+
+// Combines the hhmmss.ss time of day with the last known date
+static void parse_time(struct gps_serial *serial, const char *field) {
+    if (field_empty(field) || strlen(field) < 6)
+        return;
+
+    struct tm tm;
+    if (serial->date_valid) {
+        tm = serial->date;
+    } else {
+        time_t now = time(NULL);
+        gmtime_r(&now, &tm);
+    }
+    tm.tm_hour = (field[0] - '0') * 10 + (field[1] - '0');
+    tm.tm_min = (field[2] - '0') * 10 + (field[3] - '0');
+    tm.tm_sec = (field[4] - '0') * 10 + (field[5] - '0');
+
+    double fraction = field[6] == '.' ? strtod(&field[6], NULL) : 0;
+    serial->fix.time.tv_sec = timegm(&tm);
+    serial->fix.time.tv_nsec = (long) (fraction * 1e9);
+}
+
+static void handle_gga(struct gps_serial *serial, char **fields, int count) {
+    if (count < 12)
+        return;
+    parse_time(serial, fields[1]);
+    if (field_empty(fields[6]) || fields[6][0] == '0') {
+        serial->fix.mode = MODE_NO_FIX;
+        return;
+    }
+
+    serial->fix.latitude = parse_coordinate(fields[2], fields[3]);
+    serial->fix.longitude = parse_coordinate(fields[4], fields[5]);
+    serial->fix.altMSL = parse_double(fields[9]);
+    serial->fix.sep = parse_double(fields[11]);
+    serial->fix.altHAE = serial->fix.altMSL + (isfinite(serial->fix.sep) ? serial->fix.sep : 0);
+    serial->fix.mode = isfinite(serial->fix.altMSL) ? MODE_3D : MODE_2D;
+}
+
+static void handle_rmc(struct gps_serial *serial, char **fields, int count) {
+    if (count < 10)
+        return;
+    if (strlen(fields[9]) == 6) {
+        memset(&serial->date, 0, sizeof(serial->date));
+        serial->date.tm_mday = (fields[9][0] - '0') * 10 + (fields[9][1] - '0');
+        serial->date.tm_mon = (fields[9][2] - '0') * 10 + (fields[9][3] - '0') - 1;
+        int year = (fields[9][4] - '0') * 10 + (fields[9][5] - '0');
+        serial->date.tm_year = year < 80 ? 100 + year : year;
+        serial->date_valid = true;
+    }
+    parse_time(serial, fields[1]);
+    if (fields[2][0] != 'A') {
+        serial->fix.mode = MODE_NO_FIX;
+        return;
+    }
+
+    serial->fix.latitude = parse_coordinate(fields[3], fields[4]);
+    serial->fix.longitude = parse_coordinate(fields[5], fields[6]);
+    if (!field_empty(fields[7]))
+        serial->fix.speed = strtod(fields[7], NULL) * KNOTS_TO_MPS;
+    if (!field_empty(fields[8]))
+        serial->fix.track = strtod(fields[8], NULL);
+    if (serial->fix.mode < MODE_2D)
+        serial->fix.mode = MODE_2D;
+}
+
+static void handle_vtg(struct gps_serial *serial, char **fields, int count) {
+    if (count < 8)
+        return;
+    if (!field_empty(fields[1]))
+        serial->fix.track = strtod(fields[1], NULL);
+    if (!field_empty(fields[7]))
+        serial->fix.speed = strtod(fields[7], NULL) * KMH_TO_MPS;
+    else if (!field_empty(fields[5]))
+        serial->fix.speed = strtod(fields[5], NULL) * KNOTS_TO_MPS;
+}
+
+static void handle_gst(struct gps_serial *serial, char **fields, int count) {
+    if (count < 9)
+        return;
+    serial->fix.epy = parse_double(fields[6]);
+    serial->fix.epx = parse_double(fields[7]);
+    serial->fix.epv = parse_double(fields[8]);
+    if (isfinite(serial->fix.epx) && isfinite(serial->fix.epy))
+        serial->fix.eph = sqrt(serial->fix.epx * serial->fix.epx + serial->fix.epy * serial->fix.epy);
+}
+
+static int complete_fix(struct gps_serial *serial) {
+    serial->epoch_done = true;
+    if (serial->fix.mode < MODE_2D)
+        return 0;
+    serial->complete = serial->fix;
+    return 1;
+}
+
+// Called when the time of day changes. Completes the previous epoch if its last sentence was not known yet
+static int end_epoch(struct gps_serial *serial, double time) {
+    int fixes = 0;
+    if (serial->epoch_last[0] && serial->fix.mode >= MODE_2D) {
+        // The receiver may change its output, so the last sentence is learned from every epoch with a fix
+        if (!serial->epoch_done)
+            fixes = complete_fix(serial);
+        strcpy(serial->epoch_ender, serial->epoch_last);
+    }
+    clear_fix(&serial->fix);
+    serial->epoch_time = time;
+    serial->epoch_done = false;
+    serial->epoch_last[0] = '\0';
+    return fixes;
+}
+
+static int handle_nmea(struct gps_serial *serial) {
+    char *sentence = serial->nmea;
+    char *star = strchr(sentence, '*');
+    if (sentence[0] != '$' || !star || strlen(star) < 3)
+        return 0;
+
+    uint8_t checksum = 0;
+    for (char *p = sentence + 1; p < star; p++)
+        checksum ^= (uint8_t) *p;
+    if (checksum != (uint8_t) strtol(star + 1, NULL, 16))
+        return 0;
+    *star = '\0';
+
+    // Split the sentence into fields in place
+    char *fields[NMEA_MAX_FIELDS];
+    int count = 0;
+    char *p = sentence + 1;
+    fields[count++] = p;
+    while ((p = strchr(p, ',')) && count < NMEA_MAX_FIELDS) {
+        *p++ = '\0';
+        fields[count++] = p;
+    }
+
+    // Skip the two character talker ID (GP, GN, GL, GA, ...)
+    if (strlen(fields[0]) != 5)
+        return 0;
+    const char *type = fields[0] + 2;
+    bool timed = strcmp(type, "GGA") == 0 || strcmp(type, "RMC") == 0 || strcmp(type, "GST") == 0;
+    if (!timed && strcmp(type, "VTG") != 0)
+        return 0;
+
+    // All sentences of an epoch carry the same time of day, except VTG which has none
+    int fixes = 0;
+    if (timed && count > 1 && !field_empty(fields[1])) {
+        double time = strtod(fields[1], NULL);
+        if (time != serial->epoch_time)
+            fixes = end_epoch(serial, time);
+    }
+    if (strcmp(type, "GGA") == 0)
+        handle_gga(serial, fields, count);
+    else if (strcmp(type, "RMC") == 0)
+        handle_rmc(serial, fields, count);
+    else if (strcmp(type, "VTG") == 0)
+        handle_vtg(serial, fields, count);
+    else
+        handle_gst(serial, fields, count);
+
+    strcpy(serial->epoch_last, type);
+    if (!serial->epoch_done && strcmp(type, serial->epoch_ender) == 0)
+        fixes += complete_fix(serial);
+    return fixes;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static int32_t get_i32(const uint8_t *p) {
+    return (int32_t) get_u32(p);
+}
+
+static int handle_nav_pvt(struct gps_serial *serial, const uint8_t *payload) {
+    uint8_t valid = payload[11];
+    if ((valid & 0x03) == 0x03) { // validDate and validTime
+        struct tm tm = { 0 };
+        tm.tm_year = (payload[4] | payload[5] << 8) - 1900;
+        tm.tm_mon = payload[6] - 1;
+        tm.tm_mday = payload[7];
+        tm.tm_hour = payload[8];
+        tm.tm_min = payload[9];
+        tm.tm_sec = payload[10];
+        int32_t nano = get_i32(&payload[16]);
+        serial->fix.time.tv_sec = timegm(&tm);
+        if (nano < 0) {
+            serial->fix.time.tv_sec--;
+            nano += 1000000000;
+        }
+        serial->fix.time.tv_nsec = nano;
+    }
+
+    uint8_t fix_type = payload[20];
+    bool fix_ok = payload[21] & 0x01;
+    if (!fix_ok || fix_type < 2 || fix_type > 4) {
+        serial->fix.mode = MODE_NO_FIX;
+        return 0;
+    }
+
+    serial->fix.mode = fix_type == 2 ? MODE_2D : MODE_3D;
+    serial->fix.longitude = get_i32(&payload[24]) * 1e-7;
+    serial->fix.latitude = get_i32(&payload[28]) * 1e-7;
+    serial->fix.altHAE = get_i32(&payload[32]) / 1000.0;
+    serial->fix.altMSL = get_i32(&payload[36]) / 1000.0;
+    serial->fix.eph = get_u32(&payload[40]) / 1000.0;
+    serial->fix.epv = get_u32(&payload[44]) / 1000.0;
+    serial->fix.climb = -get_i32(&payload[56]) / 1000.0;
+    serial->fix.speed = get_i32(&payload[60]) / 1000.0;
+    serial->fix.track = get_i32(&payload[64]) * 1e-5;
+    serial->fix.eps = get_u32(&payload[68]) / 1000.0;
+    serial->complete = serial->fix;
+    return 1;
+}
+
+static int handle_ubx(struct gps_serial *serial) {
+    size_t length = serial->ubx_length - 8;
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = 2; i < 6 + length; i++) {
+        ck_a += serial->ubx[i];
+        ck_b += ck_a;
+    }
+    if (ck_a != serial->ubx[6 + length] || ck_b != serial->ubx[7 + length])
+        return 0;
+
+    if (serial->ubx[2] == UBX_CLASS_NAV && serial->ubx[3] == UBX_ID_NAV_PVT && length == UBX_NAV_PVT_LENGTH)
+        return handle_nav_pvt(serial, &serial->ubx[6]);
+    return 0;
+}
+
+static int feed_byte(struct gps_serial *serial, uint8_t c) {
+    if (serial->ubx_length == 1 && c != UBX_SYNC_CHAR_2)
+        serial->ubx_length = 0;
+
+    if (serial->ubx_length > 0) {
+        serial->ubx[serial->ubx_length++] = c;
+        if (serial->ubx_length == 6) {
+            size_t payload = serial->ubx[4] | serial->ubx[5] << 8;
+            if (payload > UBX_MAX_PAYLOAD) {
+                serial->ubx_length = 0;
+                return 0;
+            }
+            serial->ubx_expected = 6 + payload + 2;
+        }
+        if (serial->ubx_length > 6 && serial->ubx_length == serial->ubx_expected) {
+            int fixes = handle_ubx(serial);
+            serial->ubx_length = 0;
+            return fixes;
+        }
+        return 0;
+    }
+
+    if (c == UBX_SYNC_CHAR_1) {
+        serial->ubx[0] = c;
+        serial->ubx_length = 1;
+        serial->in_nmea = false;
+        return 0;
+    }
+
+    if (c == '$') {
+        serial->in_nmea = true;
+        serial->nmea_length = 0;
+    }
+    if (!serial->in_nmea)
+        return 0;
+
+    if (c == '\r' || c == '\n') {
+        serial->in_nmea = false;
+        serial->nmea[serial->nmea_length] = '\0';
+        return handle_nmea(serial);
+    }
+    if (serial->nmea_length >= NMEA_MAX_LENGTH) {
+        serial->in_nmea = false;
+        return 0;
+    }
+    serial->nmea[serial->nmea_length++] = (char) c;
+    return 0;
+}
+
+// Feeds raw receiver data to the parsers. Returns the number of completed fixes, where gpsdata->fix holds the latest
+int gps_serial_feed(struct gps_serial *serial, const uint8_t *data, size_t length, struct gps_data_t *gpsdata) {
+    int fixes = 0;
+    for (size_t i = 0; i < length; i++) {
+        int completed = feed_byte(serial, data[i]);
+        if (completed > 0) {
+            gpsdata->fix = serial->complete;
+            fixes += completed;
+        }
+    }
+    return fixes;
+}
+
+int gps_serial_open(struct gps_serial *serial, const char *device, int baudrate) {
+    memset(serial, 0, sizeof(*serial));
+    clear_fix(&serial->fix);
+    clear_fix(&serial->complete);
+    serial->epoch_time = NAN;
+
+    serial->fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (serial->fd < 0)
+        return -1;
+
+    // Anything that is not a tty, e.g. a FIFO with a recorded stream, is read as is
+    struct termios tio;
+    if (tcgetattr(serial->fd, &tio) == 0) {
+        speed_t speed = B9600;
+        for (size_t i = 0; i < sizeof(baudrates) / sizeof(baudrates[0]); i++) {
+            if (baudrates[i].baudrate == baudrate)
+                speed = baudrates[i].speed;
+        }
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        tio.c_cflag |= CLOCAL | CREAD;
+        if (tcsetattr(serial->fd, TCSANOW, &tio) != 0)
+            printf("Warning: Failed to configure %s: %s\n", device, strerror(errno));
+        tcflush(serial->fd, TCIFLUSH);
+    }
+    return 0;
+}
+
+// Reads everything available on the serial port. Returns the number of completed fixes or -1 on errors
+int gps_serial_read(struct gps_serial *serial, struct gps_data_t *gpsdata) {
+    uint8_t buf[512];
+    int fixes = 0;
+
+    while (true) {
+        ssize_t len = read(serial->fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        if (len == 0)
+            return fixes > 0 ? fixes : -1;
+        fixes += gps_serial_feed(serial, buf, len, gpsdata);
+    }
+    return fixes;
+}
+
+void gps_serial_close(struct gps_serial *serial) {
+    if (serial->fd >= 0)
+        close(serial->fd);
+    serial->fd = -1;
+}
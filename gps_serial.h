@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _GPS_SERIAL_H_
+#define _GPS_SERIAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include "gpsd/gpsd-dev/include/libgps.h"
+
+#define GPS_SERIAL_DEFAULT_BAUDRATE 9600
+#define NMEA_MAX_LENGTH 120 // NMEA 0183 allows 82 characters. Leave room for vendor extensions
+#define NMEA_MAX_FIELDS 24
+#define UBX_MAX_PAYLOAD 512
+
+// Direct position source reading NMEA 0183 and u-blox UBX from a serial port, without gpsd
+struct gps_serial {
+    int fd;
+
+    char nmea[NMEA_MAX_LENGTH + 1];
+    size_t nmea_length;
+    bool in_nmea;
+
+    uint8_t ubx[6 + UBX_MAX_PAYLOAD + 2]; // Sync chars, class, id, length, payload, checksum
+    size_t ubx_length;
+    size_t ubx_expected;
+
+    struct gps_fix_t fix;      // Accumulated from the sentences of the current epoch
+    struct gps_fix_t complete; // The last completed fix
+    double epoch_time;         // hhmmss.ss of the current epoch as a number, NAN before the first one
+    bool epoch_done;           // The fix of the current epoch has been completed
+    char epoch_last[4];        // Type of the last parsed sentence of the current epoch
+    char epoch_ender[4];       // Type of the sentence that ended the last epochs. Empty until learned
+    struct tm date;            // Last date seen in RMC
+    bool date_valid;
+};
+
+int gps_serial_open(struct gps_serial *serial, const char *device, int baudrate);
+int gps_serial_read(struct gps_serial *serial, struct gps_data_t *gpsdata);
+int gps_serial_feed(struct gps_serial *serial, const uint8_t *data, size_t length, struct gps_data_t *gpsdata);
+void gps_serial_close(struct gps_serial *serial);
+
+#endif //_GPS_SERIAL_H_
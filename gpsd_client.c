@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "gpsd_client.h"
+
+/*
+ * gpsd sends one JSON object per line. Instead of letting libgps unpack every report class into
+ * struct gps_data_t, the lines are scanned in place and only TPV (time-position-velocity) reports
+ * are parsed. The scanner does not allocate any memory and only understands the flat objects gpsd
+ * produces for TPV. Nested objects and arrays in other fields are skipped.
+ */
+
+struct tpv_field {
+    const char *name;
+    size_t offset; // Offset of a double in struct gps_fix_t
+};
+
+static const struct tpv_field tpv_fields[] = {
+        { "lat",    offsetof(struct gps_fix_t, latitude) },
+        { "lon",    offsetof(struct gps_fix_t, longitude) },
+        { "alt",    offsetof(struct gps_fix_t, altitude) },
+        { "altHAE", offsetof(struct gps_fix_t, altHAE) },
+        { "altMSL", offsetof(struct gps_fix_t, altMSL) },
+        { "track",  offsetof(struct gps_fix_t, track) },
+        { "speed",  offsetof(struct gps_fix_t, speed) },
+        { "climb",  offsetof(struct gps_fix_t, climb) },
+        { "ept",    offsetof(struct gps_fix_t, ept) },
+        { "epx",    offsetof(struct gps_fix_t, epx) },
+        { "epy",    offsetof(struct gps_fix_t, epy) },
+        { "epv",    offsetof(struct gps_fix_t, epv) },
+        { "eps",    offsetof(struct gps_fix_t, eps) },
+        { "epd",    offsetof(struct gps_fix_t, epd) },
+        { "epc",    offsetof(struct gps_fix_t, epc) },
+        { "eph",    offsetof(struct gps_fix_t, eph) },
+        { "sep",    offsetof(struct gps_fix_t, sep) },
+        { NULL, 0 }
+};
+
+static const char *skip_whitespace(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+// p must point at the opening quote. Returns the position after the closing quote
+static const char *scan_string(const char *p, const char *end, const char **str, size_t *length) {
+    const char *start = ++p;
+    while (p < end && *p != '"') {
+        if (*p == '\\')
+            p++;
+        p++;
+    }
+    if (p >= end)
+        return NULL;
+    *str = start;
+    *length = p - start;
+    return p + 1;
+}
+
+static const char *skip_value(const char *p, const char *end) {
+    const char *str;
+    size_t length;
+    int depth = 0;
+
+    while (p < end) {
+        if (*p == '"') {
+            p = scan_string(p, end, &str, &length);
+            if (!p)
+                return NULL;
+            if (depth == 0)
+                return p;
+            continue;
+        }
+        if (*p == '{' || *p == '[') {
+            depth++;
+        } else if (*p == '}' || *p == ']') {
+            if (depth == 0)
+                return p;
+            if (--depth == 0)
+                return p + 1;
+        } else if (*p == ',' && depth == 0) {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static int parse_digits(const char *p, int count) {
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        if (p[i] < '0' || p[i] > '9')
+            return -1;
+        value = value * 10 + (p[i] - '0');
+    }
+    return value;
+}
+
+// Parses the ISO 8601 UTC time used by gpsd, e.g. 2021-05-18T12:34:56.789Z
+int gpsd_parse_time(const char *str, size_t length, struct timespec *ts) {
+    if (length < 20 || str[4] != '-' || str[7] != '-' || str[10] != 'T' || str[13] != ':' || str[16] != ':')
+        return -1;
+
+    struct tm tm = { 0 };
+    tm.tm_year = parse_digits(&str[0], 4) - 1900;
+    tm.tm_mon = parse_digits(&str[5], 2) - 1;
+    tm.tm_mday = parse_digits(&str[8], 2);
+    tm.tm_hour = parse_digits(&str[11], 2);
+    tm.tm_min = parse_digits(&str[14], 2);
+    tm.tm_sec = parse_digits(&str[17], 2);
+    if (tm.tm_year < 0 || tm.tm_mon < 0 || tm.tm_mday < 0 || tm.tm_hour < 0 || tm.tm_min < 0 || tm.tm_sec < 0)
+        return -1;
+
+    long nsec = 0;
+    size_t i = 19;
+    if (str[i] == '.') {
+        long scale = 100000000L;
+        for (i++; i < length && str[i] >= '0' && str[i] <= '9'; i++) {
+            nsec += (str[i] - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    ts->tv_sec = timegm(&tm);
+    ts->tv_nsec = nsec;
+    return 0;
+}
+
+static bool key_equals(const char *key, size_t length, const char *name) {
+    return strlen(name) == length && memcmp(key, name, length) == 0;
+}
+
+// Returns 1 if json is a TPV report and fix has been updated, 0 for other reports and -1 on parse errors.
+// json must be terminated by a character that is not part of a number, e.g. '\0' or '\n'.
+int gpsd_parse_tpv(const char *json, size_t length, struct gps_fix_t *fix) {
+    const char *p = json, *end = json + length;
+    const char *key, *str;
+    size_t key_length, str_length;
+    bool is_tpv = false;
+
+    struct gps_fix_t tpv;
+    memset(&tpv, 0, sizeof(tpv));
+    for (int i = 0; tpv_fields[i].name; i++)
+        *(double *) ((char *) &tpv + tpv_fields[i].offset) = NAN;
+    tpv.mode = MODE_NOT_SEEN;
+
+    p = skip_whitespace(p, end);
+    if (p >= end || *p != '{')
+        return -1;
+    p++;
+
+    while (true) {
+        p = skip_whitespace(p, end);
+        if (p >= end)
+            return -1;
+        if (*p == '}')
+            break;
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        if (*p != '"')
+            return -1;
+        p = scan_string(p, end, &key, &key_length);
+        if (!p)
+            return -1;
+        p = skip_whitespace(p, end);
+        if (p >= end || *p != ':')
+            return -1;
+        p = skip_whitespace(p + 1, end);
+        if (p >= end)
+            return -1;
+
+        if (key_equals(key, key_length, "class")) {
+            if (*p != '"' || !(p = scan_string(p, end, &str, &str_length)))
+                return -1;
+            // gpsd always sends the class first, so anything but TPV is rejected without further parsing
+            if (!key_equals(str, str_length, "TPV"))
+                return 0;
+            is_tpv = true;
+            continue;
+        }
+
+        if (key_equals(key, key_length, "time") && *p == '"') {
+            if (!(p = scan_string(p, end, &str, &str_length)))
+                return -1;
+            gpsd_parse_time(str, str_length, &tpv.time);
+            continue;
+        }
+
+        if (key_equals(key, key_length, "mode")) {
+            char *next;
+            tpv.mode = (int) strtol(p, &next, 10);
+            p = next;
+            continue;
+        }
+
+        int field;
+        for (field = 0; tpv_fields[field].name; field++) {
+            if (key_equals(key, key_length, tpv_fields[field].name))
+                break;
+        }
+        if (tpv_fields[field].name && (*p == '-' || (*p >= '0' && *p <= '9'))) {
+            char *next;
+            *(double *) ((char *) &tpv + tpv_fields[field].offset) = strtod(p, &next);
+            p = next;
+            continue;
+        }
+
+        p = skip_value(p, end);
+        if (!p)
+            return -1;
+    }
+
+    if (!is_tpv)
+        return 0;
+    *fix = tpv;
+    return 1;
+}
+
+int gpsd_client_open(struct gpsd_client *client, const char *host, const char *port, const char *device) {
+    struct addrinfo hints = { 0 }, *result, *ai;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    client->fd = -1;
+    client->length = 0;
+    if (getaddrinfo(host, port, &hints, &result) != 0)
+        return -1;
+
+    for (ai = result; ai; ai = ai->ai_next) {
+        client->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (client->fd < 0)
+            continue;
+        if (connect(client->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(client->fd);
+        client->fd = -1;
+    }
+    freeaddrinfo(result);
+    if (client->fd < 0)
+        return -1;
+
+    char watch[256];
+    if (device)
+        snprintf(watch, sizeof(watch), "?WATCH={\"enable\":true,\"json\":true,\"device\":\"%s\"};\n", device);
+    else
+        snprintf(watch, sizeof(watch), "?WATCH={\"enable\":true,\"json\":true};\n");
+    if (write(client->fd, watch, strlen(watch)) != (ssize_t) strlen(watch)) {
+        gpsd_client_close(client);
+        return -1;
+    }
+
+    // From here on the socket is only read when epoll reports it as readable
+    fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+// Reads everything available on the socket. Returns the number of TPV reports parsed, where gpsdata->fix
+// holds the latest one, or -1 when the connection failed or was closed by gpsd.
+int gpsd_client_read(struct gpsd_client *client, struct gps_data_t *gpsdata) {
+    int fixes = 0;
+
+    while (true) {
+        ssize_t len = read(client->fd, client->buffer + client->length, sizeof(client->buffer) - 1 - client->length);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        if (len == 0)
+            return -1;
+        client->length += len;
+
+        char *start = client->buffer, *newline;
+        while ((newline = memchr(start, '\n', client->buffer + client->length - start))) {
+            *newline = '\0';
+            if (gpsd_parse_tpv(start, newline - start, &gpsdata->fix) > 0)
+                fixes++;
+            start = newline + 1;
+        }
+
+        size_t remaining = client->buffer + client->length - start;
+        if (remaining == sizeof(client->buffer) - 1)
+            remaining = 0; // A line longer than the buffer. Drop it
+        memmove(client->buffer, start, remaining);
+        client->length = remaining;
+    }
+    return fixes;
+}
+
+void gpsd_client_close(struct gpsd_client *client) {
+    if (client->fd >= 0)
+        close(client->fd);
+    client->fd = -1;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _GPSD_CLIENT_H_
+#define _GPSD_CLIENT_H_
+
+#include <stddef.h>
+#include "gpsd/gpsd-dev/include/libgps.h"
+
+#define GPSD_CLIENT_BUFFER_SIZE 4096
+
+// Non-blocking gpsd JSON stream client. Only TPV reports are parsed, everything else is skipped
+struct gpsd_client {
+    int fd;
+    char buffer[GPSD_CLIENT_BUFFER_SIZE];
+    size_t length;
+};
+
+int gpsd_client_open(struct gpsd_client *client, const char *host, const char *port, const char *device);
+int gpsd_client_read(struct gpsd_client *client, struct gps_data_t *gpsdata);
+void gpsd_client_close(struct gpsd_client *client);
+int gpsd_parse_tpv(const char *json, size_t length, struct gps_fix_t *fix);
+int gpsd_parse_time(const char *str, size_t length, struct timespec *ts);
+
+#endif //_GPSD_CLIENT_H_
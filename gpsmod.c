@@ -1,26 +1,92 @@
 
 #include "gpsmod.h"
+#include "metrics.h"
+#include "trace_ring.h"
+#include "vclock.h"
+#include <stdio.h>
 #include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-int init_gps(struct fixsource_t* source, struct gps_data_t* gpsdata) {
-    unsigned int flags = WATCH_ENABLE;
+#define EARTH_RADIUS_M 6378137.0 // WGS84 semi-major axis
+#define DEG_TO_RAD (M_PI / 180.0)
 
+// Set by the GPS thread for every new fix and read when the Location message is encoded
+static _Atomic uint64_t fix_received_ns = 0;
+static _Atomic int64_t fix_time_ns = 0;
+static uint64_t last_encoded_fix_ns = 0;
+
+// Running estimates, updated as exponentially weighted moving averages with weight 1/GPS_EWMA_DIVISOR.
+// clock_offset_ns is CLOCK_REALTIME at the time a fix is read minus the GPS fix time. It includes the
+// receiver output delay. pipeline_latency_ns is the fix time to Location encode latency.
+static _Atomic int64_t clock_offset_ns = 0;
+static _Atomic int64_t pipeline_latency_ns = 0;
+static _Atomic bool clock_offset_valid = false;
+static _Atomic bool pipeline_latency_valid = false;
+
+static struct {
+    int samples;
+    uint64_t received_sum_ns;
+    uint64_t received_max_ns;
+    int64_t fix_time_sum_ns;
+    int fix_time_samples;
+} latency = { 0 };
+
+// Corrections applied by gps_predict_location(), reported with the latency. Only used by the transmit thread
+static struct {
+    int samples;
+    double horizontal_sum_m;
+    double horizontal_max_m;
+    double dt_sum_s;
+} extrapolation = { 0 };
+
+// The last fix as written to the Location message, used as the basis for extrapolation
+static pthread_mutex_t kinematics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    bool valid;
+    double latitude;
+    double longitude;
+    float altitude_geo;
+    float altitude_baro;
+    float height;
+    double speed;
+    double track;
+    double climb;
+    int64_t fix_time_ns;   // CLOCK_REALTIME, 0 if the source did not provide a fix time
+    uint64_t received_ns;  // CLOCK_MONOTONIC
+} kinematics = { 0 };
+
+static int64_t realtime_ns() {
+    return vclock_realtime_ns();
+}
+
+static int64_t ewma_update(_Atomic int64_t *average, _Atomic bool *valid, int64_t sample) {
+    int64_t value = sample;
+    if (*valid)
+        value = atomic_load(average) + (sample - atomic_load(average)) / GPS_EWMA_DIVISOR;
+    atomic_store(average, value);
+    *valid = true;
+    return value;
+}
+
+// The Location timestamp is the time in tenths of seconds since the start of the current hour
+static float timestamp_since_hour(int64_t time_ns) {
+    int64_t since_hour_ns = time_ns % (3600 * 1000000000LL);
+    return (float) ((since_hour_ns / 100000000LL) / 10.0);
+}
+
+int init_gps(struct fixsource_t* source, struct gpsd_client* client) {
     gpsd_source_spec(NULL, source);
 
-    if (0 != gps_open(source->server, source->port, gpsdata)) {
+    if (0 != gpsd_client_open(client, source->server, source->port, source->device)) {
         return 1;
     }
 
-    if (NULL != source->device) {
-        flags |= WATCH_DEVICE;
-    }
-    
-    gps_stream(gpsdata, flags, source->device);
-
     return 0;
 }
 
 void process_gps_data(struct gps_data_t* gpsdata, struct ODID_UAS_Data *uasData) {
+    trace_begin(TRACE_PROCESS_GPS_DATA, 0);
     if(gpsdata->fix.mode >= MODE_2D) {
         uasData->Location.Latitude = gpsdata->fix.latitude;
         uasData->Location.Longitude = gpsdata->fix.longitude;
@@ -55,8 +121,8 @@ void process_gps_data(struct gps_data_t* gpsdata, struct ODID_UAS_Data *uasData)
             uasData->Location.HorizAccuracy = createEnumHorizontalAccuracy(gpsdata->fix.eph);
         }
 
-        if(isfinite(gpsdata->fix.epy)) {
-            uasData->Location.VertAccuracy = createEnumVerticalAccuracy(gpsdata->fix.epy);
+        if(isfinite(gpsdata->fix.epv)) {
+            uasData->Location.VertAccuracy = createEnumVerticalAccuracy(gpsdata->fix.epv);
         }
 
         if(isfinite(gpsdata->fix.eps)) {
@@ -64,4 +130,138 @@ void process_gps_data(struct gps_data_t* gpsdata, struct ODID_UAS_Data *uasData)
         }
 
     }
-}
\ No newline at end of file
+
+    if(gpsdata->fix.mode >= MODE_2D && gpsdata->fix.time.tv_sec > 0) {
+        uasData->Location.TimeStamp = timestamp_since_hour(
+                (int64_t) gpsdata->fix.time.tv_sec * 1000000000LL + gpsdata->fix.time.tv_nsec);
+
+        // The position is already this old when it is handed to the radio
+        float accuracy = 0.1f;
+        if (pipeline_latency_valid)
+            accuracy = MAXIMUM(accuracy, (float) atomic_load(&pipeline_latency_ns) / 1e9f);
+        uasData->Location.TSAccuracy = createEnumTimestampAccuracy(accuracy);
+    }
+    trace_end(TRACE_PROCESS_GPS_DATA);
+}
+
+// Called by the GPS thread after process_gps_data() with the time the data containing the fix was read
+void gps_fix_received(struct gps_data_t* gpsdata, struct ODID_UAS_Data *uasData, uint64_t received_ns) {
+    int64_t fix_ns = 0;
+    if (gpsdata->fix.time.tv_sec > 0)
+        fix_ns = (int64_t) gpsdata->fix.time.tv_sec * 1000000000LL + gpsdata->fix.time.tv_nsec;
+    atomic_store(&fix_time_ns, fix_ns);
+    atomic_store(&fix_received_ns, received_ns);
+    if (fix_ns > 0)
+        ewma_update(&clock_offset_ns, &clock_offset_valid, realtime_ns() - fix_ns);
+
+    if (gpsdata->fix.mode < MODE_2D)
+        return;
+    pthread_mutex_lock(&kinematics_mutex);
+    kinematics.valid = true;
+    kinematics.latitude = uasData->Location.Latitude;
+    kinematics.longitude = uasData->Location.Longitude;
+    kinematics.altitude_geo = uasData->Location.AltitudeGeo;
+    kinematics.altitude_baro = uasData->Location.AltitudeBaro;
+    kinematics.height = uasData->Location.Height;
+    kinematics.speed = gpsdata->fix.speed;
+    kinematics.track = gpsdata->fix.track;
+    kinematics.climb = gpsdata->fix.mode >= MODE_3D ? gpsdata->fix.climb : NAN;
+    kinematics.fix_time_ns = fix_ns;
+    kinematics.received_ns = received_ns;
+    pthread_mutex_unlock(&kinematics_mutex);
+}
+
+/*
+ * Projects the last fix forward to the current time using its horizontal speed, track and climb rate,
+ * so that the Location handed to the radio reflects where the aircraft is now rather than where it was
+ * when the fix was taken. The fix age is measured from the fix time when available, otherwise from when
+ * the fix was read. Extrapolation is limited to max_age_ms. The result is written to location, which
+ * must be a copy owned by the caller, since the GPS thread keeps writing the Location of uasData.
+ */
+void gps_predict_location(ODID_Location_data *location, int max_age_ms) {
+    pthread_mutex_lock(&kinematics_mutex);
+    if (!kinematics.valid || !isfinite(kinematics.speed) || !isfinite(kinematics.track)) {
+        pthread_mutex_unlock(&kinematics_mutex);
+        return;
+    }
+
+    int64_t age_ns = (int64_t) (get_time_ns() - kinematics.received_ns);
+    if (kinematics.fix_time_ns > 0) {
+        int64_t fix_age_ns = realtime_ns() - kinematics.fix_time_ns;
+        if (fix_age_ns >= 0 && fix_age_ns < 10 * 1000000000LL) // Ignore the fix time if the clocks disagree
+            age_ns = fix_age_ns;
+    }
+    double dt = MINIMUM((double) age_ns / 1e9, max_age_ms / 1000.0);
+
+    double north = kinematics.speed * cos(kinematics.track * DEG_TO_RAD) * dt;
+    double east = kinematics.speed * sin(kinematics.track * DEG_TO_RAD) * dt;
+    double up = isfinite(kinematics.climb) ? kinematics.climb * dt : 0;
+
+    location->Latitude = kinematics.latitude + north / EARTH_RADIUS_M / DEG_TO_RAD;
+    location->Longitude = kinematics.longitude +
+            east / (EARTH_RADIUS_M * cos(kinematics.latitude * DEG_TO_RAD)) / DEG_TO_RAD;
+    location->AltitudeGeo = kinematics.altitude_geo + (float) up;
+    location->AltitudeBaro = kinematics.altitude_baro + (float) up;
+    location->Height = kinematics.height + (float) up;
+    if (kinematics.fix_time_ns > 0)
+        location->TimeStamp = timestamp_since_hour(kinematics.fix_time_ns + (int64_t) (dt * 1e9));
+    pthread_mutex_unlock(&kinematics_mutex);
+
+    double horizontal_m = sqrt(north * north + east * east);
+    extrapolation.samples++;
+    extrapolation.horizontal_sum_m += horizontal_m;
+    extrapolation.horizontal_max_m = MAXIMUM(extrapolation.horizontal_max_m, horizontal_m);
+    extrapolation.dt_sum_s += dt;
+}
+
+// CLOCK_MONOTONIC time the newest fix was read. 0 until the first fix
+uint64_t gps_fix_received_ns() {
+    return atomic_load(&fix_received_ns);
+}
+
+// CLOCK_REALTIME minus GPS time, as seen when fixes are read. 0 until the first fix with a time
+int64_t gps_clock_offset_ns() {
+    return atomic_load(&clock_offset_ns);
+}
+
+/*
+ * Called after the Location message has been encoded. The first encode of each fix is measured from the
+ * time the data was read from gpsd or the serial port, and from the fix time itself. The latter includes
+ * the receiver output delay and, for gpsd, the daemon hop. It requires the system clock to be synchronized.
+ */
+void gps_location_encoded(const char *source) {
+    uint64_t received_ns = atomic_load(&fix_received_ns);
+    if (received_ns == 0 || received_ns == last_encoded_fix_ns)
+        return;
+    last_encoded_fix_ns = received_ns;
+
+    uint64_t now_ns = get_time_ns();
+    metrics_observe_ns(METRICS_FIX_AGE, now_ns - received_ns);
+    latency.received_sum_ns += now_ns - received_ns;
+    latency.received_max_ns = MAXIMUM(latency.received_max_ns, now_ns - received_ns);
+    latency.samples++;
+
+    int64_t fix_ns = atomic_load(&fix_time_ns);
+    if (fix_ns > 0) {
+        int64_t fix_latency_ns = realtime_ns() - fix_ns;
+        latency.fix_time_sum_ns += fix_latency_ns;
+        latency.fix_time_samples++;
+        ewma_update(&pipeline_latency_ns, &pipeline_latency_valid, fix_latency_ns);
+    }
+
+    if (latency.samples >= GPS_LATENCY_REPORT_SAMPLES) {
+        printf("GPS (%s): fix-to-encode latency avg %.1f ms, max %.1f ms", source,
+               (double) latency.received_sum_ns / latency.samples / 1e6, (double) latency.received_max_ns / 1e6);
+        if (latency.fix_time_samples > 0)
+            printf(", from fix time avg %.1f ms", (double) latency.fix_time_sum_ns / latency.fix_time_samples / 1e6);
+        if (clock_offset_valid)
+            printf(", clock offset to GPS time %.1f ms", (double) atomic_load(&clock_offset_ns) / 1e6);
+        if (extrapolation.samples > 0)
+            printf(", extrapolated by avg %.0f ms: avg %.2f m, max %.2f m horizontal",
+                   extrapolation.dt_sum_s / extrapolation.samples * 1e3,
+                   extrapolation.horizontal_sum_m / extrapolation.samples, extrapolation.horizontal_max_m);
+        printf("\n");
+        memset(&latency, 0, sizeof(latency));
+        memset(&extrapolation, 0, sizeof(extrapolation));
+    }
+}
@@ -5,13 +5,23 @@
 #include <stdlib.h>
 
 #include "gpsd/gpsd-dev/include/libgps.h"
+#include "gpsd_client.h"
+#include "gps_serial.h"
 #include "bluetooth.h"
 
 #define MAX_GPS_WAIT_RETRIES 60 // 60 tries at 0.5 seconds a try is a 30 second timeout
 #define MAX_GPS_READ_RETRIES 5
 #define GPS_WAIT_TIME_MICROSECS 500000 // 1/2 second
+#define GPS_CPU_REPORT_FIXES 100 // Print the GPS thread CPU time per fix after this many fixes
+#define GPS_LATENCY_REPORT_SAMPLES 10 // Print the fix-to-encode latency after this many encoded fixes
+#define GPS_EWMA_DIVISOR 8 // Weight 1/8 for new samples in the clock offset and latency estimates
 
-int init_gps(struct fixsource_t* source, struct gps_data_t* gpsdata);
+int init_gps(struct fixsource_t* source, struct gpsd_client* client);
 void process_gps_data(struct gps_data_t* gpsdata, struct ODID_UAS_Data *uasData);
+void gps_fix_received(struct gps_data_t* gpsdata, struct ODID_UAS_Data *uasData, uint64_t received_ns);
+void gps_predict_location(ODID_Location_data *location, int max_age_ms);
+void gps_location_encoded(const char *source);
+int64_t gps_clock_offset_ns(void);
+uint64_t gps_fix_received_ns(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "handover.h"
+#include "vclock.h"
+
+/*
+ * On SIGUSR1, the running process writes its state and exits without disabling advertising or
+ * resetting the controller. A new process started with the adopt option reads the state, skips the
+ * controller reset and continues updating the existing advertising sets and hostapd Beacon data with
+ * the same handles, random address and message counters. The state file is binary and only valid
+ * between processes of the same build.
+ */
+
+int64_t handover_realtime_ns() {
+    return vclock_realtime_ns();
+}
+
+// Written to a temporary file and renamed, so the successor never reads a partial state
+int handover_save(const char *path, const struct handover_state *state) {
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        printf("Error: Unable to write the handover state %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+    if (write(fd, state, sizeof(*state)) != sizeof(*state) || fsync(fd) != 0) {
+        printf("Error: Unable to write the handover state %s: %s\n", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    close(fd);
+
+    if (rename(tmp_path, path) != 0) {
+        printf("Error: Unable to write the handover state %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// The state file is removed after reading, so it is adopted only once
+int handover_load(const char *path, struct handover_state *state) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("No handover state found in %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    ssize_t len = read(fd, state, sizeof(*state));
+    close(fd);
+    unlink(path);
+
+    if (len != sizeof(*state) || state->magic != HANDOVER_MAGIC || state->version != HANDOVER_VERSION) {
+        printf("Ignoring invalid handover state in %s\n", path);
+        return -1;
+    }
+    return 0;
+}
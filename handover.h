@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _HANDOVER_H_
+#define _HANDOVER_H_
+
+#include <stdint.h>
+#include "utils.h"
+
+#define HANDOVER_STATE_FILE "/var/run/odid_transmit.state"
+#define HANDOVER_MAGIC 0x4F444944 // "ODID"
+#define HANDOVER_VERSION 1
+
+// Written by a process handing over to its successor, which adopts the radios as they are
+struct handover_state {
+    uint32_t magic;
+    uint32_t version;
+
+    uint8_t use_btl;
+    uint8_t use_bt4;
+    uint8_t use_bt5;
+    uint8_t use_packs;
+    uint8_t handle_bt4;
+    uint8_t handle_bt5;
+    uint8_t mac[6]; // The random address programmed in the advertising sets
+
+    uint8_t msg_counters[ODID_MSG_COUNTER_AMOUNT];
+
+    uint8_t pack_valid; // Shadow of the message pack currently programmed in the transports
+    struct ODID_MessagePack_encoded pack_enc;
+
+    int64_t last_update_ns; // CLOCK_REALTIME of the last data update sent to the transports
+    int64_t written_ns;     // CLOCK_REALTIME when the state was written
+};
+
+int handover_save(const char *path, const struct handover_state *state);
+int handover_load(const char *path, struct handover_state *state);
+int64_t handover_realtime_ns(void);
+
+#endif //_HANDOVER_H_
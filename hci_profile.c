@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hci_profile.h"
+
+/*
+ * Round-trip times of the HCI commands, from writing the command to reading its Command Complete or
+ * Command Status event, per opcode. Controllers differ a lot here, e.g. in how long they take to
+ * accept new extended advertising data. All HCI commands are sent from one thread at a time, so the
+ * statistics are not locked.
+ */
+
+struct opcode_profile {
+    uint16_t opcode;
+    uint64_t count;
+    uint32_t *samples_ns;
+    uint32_t sample_count;
+};
+
+static struct opcode_profile profiles[HCI_PROFILE_MAX_OPCODES];
+static int profile_count = 0;
+static uint64_t random_state = 0x2545F4914F6CDD1DULL;
+
+static const struct {
+    uint16_t opcode;
+    const char *name;
+} opcode_names[] = {
+        { 0x0C03, "Reset" },
+        { 0x2003, "LE Read Local Supported Features" },
+        { 0x2005, "LE Set Random Address" },
+        { 0x2006, "LE Set Advertising Parameters" },
+        { 0x2008, "LE Set Advertising Data" },
+        { 0x200A, "LE Set Advertising Enable" },
+        { 0x2035, "LE Set Advertising Set Random Address" },
+        { 0x2036, "LE Set Extended Advertising Parameters" },
+        { 0x2037, "LE Set Extended Advertising Data" },
+        { 0x2039, "LE Set Extended Advertising Enable" },
+        { 0x203C, "LE Remove Advertising Set" },
+};
+
+const char *hci_opcode_name(uint16_t opcode) {
+    for (size_t i = 0; i < sizeof(opcode_names) / sizeof(opcode_names[0]); i++) {
+        if (opcode_names[i].opcode == opcode)
+            return opcode_names[i].name;
+    }
+    return "";
+}
+
+static uint64_t next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+void hci_profile_record(uint16_t opcode, uint64_t rtt_ns) {
+    struct opcode_profile *profile = NULL;
+    for (int i = 0; i < profile_count; i++) {
+        if (profiles[i].opcode == opcode) {
+            profile = &profiles[i];
+            break;
+        }
+    }
+    if (!profile) {
+        if (profile_count == HCI_PROFILE_MAX_OPCODES)
+            return;
+        profile = &profiles[profile_count];
+        profile->samples_ns = malloc(HCI_PROFILE_MAX_SAMPLES * sizeof(uint32_t));
+        if (!profile->samples_ns)
+            return;
+        profile->opcode = opcode;
+        profile_count++;
+    }
+
+    uint32_t sample = rtt_ns > UINT32_MAX ? UINT32_MAX : (uint32_t) rtt_ns;
+    profile->count++;
+    if (profile->sample_count < HCI_PROFILE_MAX_SAMPLES) {
+        profile->samples_ns[profile->sample_count++] = sample;
+    } else {
+        // Reservoir sampling: every command so far has the same chance of being in the sample
+        uint64_t index = next_random() % profile->count;
+        if (index < HCI_PROFILE_MAX_SAMPLES)
+            profile->samples_ns[index] = sample;
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint32_t *sorted, uint32_t count, double p) {
+    uint32_t index = (uint32_t) (p / 100.0 * (count - 1) + 0.5);
+    return sorted[index] / 1e3;
+}
+
+void hci_profile_report() {
+    if (profile_count == 0)
+        return;
+    printf("\nHCI command round-trip times (us):\n");
+    printf("OGF  OCF    %-40s %7s %8s %8s %8s %8s %8s\n", "Command", "Count", "Min", "P50", "P90", "P99", "Max");
+    for (int i = 0; i < profile_count; i++) {
+        struct opcode_profile *profile = &profiles[i];
+        qsort(profile->samples_ns, profile->sample_count, sizeof(uint32_t), compare_u32);
+        uint32_t n = profile->sample_count;
+        printf("0x%02X 0x%03X  %-40s %7lu %8.0f %8.0f %8.0f %8.0f %8.0f\n", profile->opcode >> 10,
+               profile->opcode & 0x3FF, hci_opcode_name(profile->opcode), (unsigned long) profile->count,
+               percentile_us(profile->samples_ns, n, 0), percentile_us(profile->samples_ns, n, 50),
+               percentile_us(profile->samples_ns, n, 90), percentile_us(profile->samples_ns, n, 99),
+               percentile_us(profile->samples_ns, n, 100));
+    }
+}
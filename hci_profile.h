@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _HCI_PROFILE_H_
+#define _HCI_PROFILE_H_
+
+#include <stdint.h>
+
+#define HCI_PROFILE_MAX_OPCODES 32
+#define HCI_PROFILE_MAX_SAMPLES 4096 // Per opcode. Longer runs keep a uniform random sample
+#define HCI_PROFILE_DEFAULT_ITERATIONS 200
+
+const char *hci_opcode_name(uint16_t opcode);
+void hci_profile_record(uint16_t opcode, uint64_t rtt_ns);
+void hci_profile_report(void);
+
+#endif //_HCI_PROFILE_H_
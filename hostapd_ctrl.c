@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#include "hostapd_ctrl.h"
+#include "trace_ring.h"
+#include "utils.h"
+#include "vclock.h"
+
+/*
+ * Client for the hostapd control interface. Only the commands needed for the beacon updates are used
+ * (SET, UPDATE_BEACON and PING), so instead of linking the hostapd_cli sources, the requests are sent
+ * directly over the unix datagram sockets in HOSTAPD_CTRL_DIR, the same way wpa_ctrl does it. The
+ * connections are never attached to the hostapd events.
+ */
+
+extern sem_t semaphore;
+
+static struct hostapd_ctrl main_ctrl = { .fd = -1 }; // Kept up by the ping loop
+static char ctrl_ifname[HOSTAPD_CTRL_IFNAME_SIZE];
+static int quit_fd = -1;
+static int return_value = 0;
+static atomic_int client_counter = 0;
+
+int hostapd_ctrl_open(struct hostapd_ctrl *ctrl, const char *ifname) {
+    if (vclock_simulated()) {
+        ctrl->fd = -1;
+        snprintf(ctrl->name, sizeof(ctrl->name), "%s", ifname);
+        return 0;
+    }
+
+    struct sockaddr_un dest = { .sun_family = AF_UNIX };
+    if (snprintf(dest.sun_path, sizeof(dest.sun_path), "%s/%s", HOSTAPD_CTRL_DIR, ifname) >=
+        (int) sizeof(dest.sun_path))
+        return -1;
+
+    ctrl->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (ctrl->fd < 0)
+        return -1;
+
+    // hostapd sends the replies to the address of the client socket
+    memset(&ctrl->local, 0, sizeof(ctrl->local));
+    ctrl->local.sun_family = AF_UNIX;
+    snprintf(ctrl->local.sun_path, sizeof(ctrl->local.sun_path), "%s/wpa_ctrl_%d-%d",
+             HOSTAPD_CTRL_CLIENT_DIR, (int) getpid(), atomic_fetch_add(&client_counter, 1) + 1);
+    int result = bind(ctrl->fd, (struct sockaddr *) &ctrl->local, sizeof(ctrl->local));
+    if (result < 0 && errno == EADDRINUSE) {
+        // Left behind by an earlier process with the same pid
+        unlink(ctrl->local.sun_path);
+        result = bind(ctrl->fd, (struct sockaddr *) &ctrl->local, sizeof(ctrl->local));
+    }
+    if (result < 0) {
+        close(ctrl->fd);
+        ctrl->fd = -1;
+        return -1;
+    }
+    if (connect(ctrl->fd, (struct sockaddr *) &dest, sizeof(dest)) < 0) {
+        hostapd_ctrl_close(ctrl);
+        return -1;
+    }
+    snprintf(ctrl->name, sizeof(ctrl->name), "%s", ifname);
+    return 0;
+}
+
+void hostapd_ctrl_close(struct hostapd_ctrl *ctrl) {
+    if (ctrl->fd < 0)
+        return;
+    unlink(ctrl->local.sun_path);
+    close(ctrl->fd);
+    ctrl->fd = -1;
+}
+
+/*
+ * Re-opens a connection after hostapd was restarted. Returns 0 once the connection is open again. The
+ * name is kept, so a failed attempt can be repeated with the next request.
+ */
+int hostapd_ctrl_reconnect(struct hostapd_ctrl *ctrl) {
+    char name[HOSTAPD_CTRL_IFNAME_SIZE];
+    snprintf(name, sizeof(name), "%s", ctrl->name);
+    if (ctrl->fd >= 0) {
+        printf("Connection to hostapd interface '%s' lost - trying to reconnect\n", name);
+        hostapd_ctrl_close(ctrl);
+    }
+    if (hostapd_ctrl_open(ctrl, name) != 0)
+        return -1;
+    printf("Connection to hostapd interface '%s' re-established\n", name);
+    return 0;
+}
+
+static int receive_reply(struct hostapd_ctrl *ctrl, char *reply, int reply_size) {
+    struct pollfd pfd = { .fd = ctrl->fd, .events = POLLIN };
+    uint64_t deadline_ns = get_time_ns() + HOSTAPD_CTRL_TIMEOUT_MS * 1000000ULL;
+    while (true) {
+        uint64_t now_ns = get_time_ns();
+        if (now_ns >= deadline_ns)
+            return -2;
+        int ready = poll(&pfd, 1, (int) ((deadline_ns - now_ns + 999999) / 1000000));
+        if (ready < 0 && errno != EINTR)
+            return -1;
+        if (ready <= 0)
+            continue;
+
+        ssize_t length = recv(ctrl->fd, reply, reply_size - 1, 0);
+        if (length < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (length < 0)
+            return -1;
+        // Unsolicited event messages start with the priority, like "<3>"
+        if (length > 0 && reply[0] == '<')
+            continue;
+        reply[length] = '\0';
+        return (int) length;
+    }
+}
+
+/*
+ * The mock hostapd of the simulation acknowledges every command at once. The beacon workers do not take
+ * part in the simulated time, so their requests must not wait for it.
+ */
+static int mock_reply(const char *cmd, char *reply, int reply_size) {
+    return snprintf(reply, reply_size, "%s\n", strcmp(cmd, "PING") == 0 ? "PONG" : "OK");
+}
+
+/*
+ * Sends a command and waits up to HOSTAPD_CTRL_TIMEOUT_MS for the reply, which is null terminated.
+ * Returns the length of the reply, -2 on timeout or -1 on error. Each connection must only be used by
+ * one thread at a time.
+ */
+int hostapd_ctrl_request(struct hostapd_ctrl *ctrl, const char *cmd, char *reply, int reply_size) {
+    if (vclock_simulated())
+        return mock_reply(cmd, reply, reply_size);
+    if (ctrl->fd < 0)
+        return -1;
+
+    // Drop a late reply to an earlier request that timed out
+    while (recv(ctrl->fd, reply, reply_size, MSG_DONTWAIT) > 0)
+        ;
+
+    trace_begin(TRACE_HOSTAPD_REQUEST, 0);
+    int result = -1;
+    if (send(ctrl->fd, cmd, strlen(cmd), 0) >= 0)
+        result = receive_reply(ctrl, reply, reply_size);
+    trace_end(TRACE_HOSTAPD_REQUEST);
+    return result;
+}
+
+/*
+ * Sends a command that hostapd acknowledges with "OK". Returns 0 if it did, 1 if hostapd replied
+ * otherwise, or the error of hostapd_ctrl_request()
+ */
+int hostapd_ctrl_command(struct hostapd_ctrl *ctrl, const char *cmd) {
+    char reply[256];
+    int length = hostapd_ctrl_request(ctrl, cmd, reply, sizeof(reply));
+    if (length < 0)
+        return length;
+    return length >= 2 && memcmp(reply, "OK", 2) == 0 ? 0 : 1;
+}
+
+/*
+ * Opens a dedicated control connection for each hostapd interface that is used for beacon updates.
+ * When all is set, every control socket found in HOSTAPD_CTRL_DIR is opened (one per radio/BSS),
+ * otherwise only the interface selected by hostapd_ctrl_init(). Returns the number of opened connections.
+ */
+int hostapd_ctrl_open_beacon_ifaces(struct hostapd_ctrl *ifaces, int max, bool all) {
+    if (!all || vclock_simulated()) {
+        if (!ctrl_ifname[0] || max < 1 || hostapd_ctrl_open(&ifaces[0], ctrl_ifname) != 0)
+            return 0;
+        return 1;
+    }
+
+    DIR *dir = opendir(HOSTAPD_CTRL_DIR);
+    if (!dir)
+        return 0;
+
+    int count = 0;
+    struct dirent *dent;
+    while ((dent = readdir(dir)) && count < max) {
+        char path[sizeof(HOSTAPD_CTRL_DIR) + NAME_MAX + 1];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", HOSTAPD_CTRL_DIR, dent->d_name);
+        if (stat(path, &st) < 0 || !S_ISSOCK(st.st_mode))
+            continue;
+        if (hostapd_ctrl_open(&ifaces[count], dent->d_name) != 0) {
+            printf("Could not connect to interface '%s'\n", dent->d_name);
+            continue;
+        }
+        printf("Beacon interface '%s' added\n", dent->d_name);
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Selects the first entry in the control interface directory, as hostapd_cli does
+static bool select_iface(void) {
+    DIR *dir = opendir(HOSTAPD_CTRL_DIR);
+    if (!dir)
+        return false;
+
+    struct dirent *dent;
+    while ((dent = readdir(dir))) {
+        if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+            continue;
+        if (snprintf(ctrl_ifname, sizeof(ctrl_ifname), "%s", dent->d_name) >= (int) sizeof(ctrl_ifname)) {
+            ctrl_ifname[0] = '\0'; // Not an interface name
+            continue;
+        }
+        printf("Selected interface '%s'\n", dent->d_name);
+        break;
+    }
+    closedir(dir);
+    return ctrl_ifname[0] != '\0';
+}
+
+/*
+ * Returns an inotify descriptor reporting new entries in the control interface directory, or -1 if
+ * inotify is not available. The parent directory is watched as well, since hostapd creates the control
+ * interface directory.
+ */
+static int ctrl_iface_watch(void) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    char parent[] = HOSTAPD_CTRL_DIR;
+    *strrchr(parent, '/') = '\0';
+    if (inotify_add_watch(fd, parent, IN_CREATE | IN_MOVED_TO) < 0) {
+        close(fd);
+        return -1;
+    }
+    inotify_add_watch(fd, HOSTAPD_CTRL_DIR, IN_CREATE | IN_MOVED_TO);
+    return fd;
+}
+
+/*
+ * Waits until an entry is created in the control interface directory. hostapd may create the socket
+ * before it accepts commands, so the wait is limited to one second.
+ */
+static void ctrl_iface_wait(int fd) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    if (fd < 0) {
+        sleep(1);
+        return;
+    }
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, 1000) > 0) {
+        while (read(fd, buf, sizeof(buf)) > 0)
+            ;
+    }
+    // The directory may just have been created
+    inotify_add_watch(fd, HOSTAPD_CTRL_DIR, IN_CREATE | IN_MOVED_TO);
+}
+
+static void ping(void) {
+    char reply[16];
+    if (main_ctrl.fd < 0 || hostapd_ctrl_request(&main_ctrl, "PING", reply, sizeof(reply)) < 4 ||
+        memcmp(reply, "PONG", 4) != 0)
+        hostapd_ctrl_reconnect(&main_ctrl);
+}
+
+/*
+ * Thread function. Connects to the first hostapd interface, posts the semaphore once connected and then
+ * pings hostapd every HOSTAPD_CTRL_PING_INTERVAL_MS until hostapd_ctrl_quit() is called.
+ */
+void *hostapd_ctrl_init(void *arg) {
+    (void) arg;
+    pthread_setname_np(pthread_self(), "hostapd");
+    trace_register_thread(); // The first ping happens after the alloc guard is armed
+    return_value = -1;
+    uint64_t start_ns = get_time_ns();
+
+    quit_fd = eventfd(0, EFD_CLOEXEC);
+    if (quit_fd < 0) {
+        perror("eventfd");
+        pthread_exit(&return_value);
+    }
+
+    if (vclock_simulated())
+        snprintf(ctrl_ifname, sizeof(ctrl_ifname), "%s", HOSTAPD_CTRL_MOCK_IFNAME);
+    int watch_fd = ctrl_iface_watch();
+    bool warning_displayed = false;
+    while ((!ctrl_ifname[0] && !select_iface()) || hostapd_ctrl_open(&main_ctrl, ctrl_ifname) != 0) {
+        if (!warning_displayed) {
+            printf("Could not connect to hostapd - re-trying\n");
+            warning_displayed = true;
+        }
+        ctrl_iface_wait(watch_fd);
+    }
+    if (watch_fd >= 0)
+        close(watch_fd);
+    printf("Connected to hostapd interface '%s' after %.1f ms\n", ctrl_ifname,
+           (double) (get_time_ns() - start_ns) / 1e6);
+
+    // Indicate that connection has been established
+    vclock_sem_post(&semaphore);
+    // The simulation sends no pings, so the rest of this thread does not take part in the simulated time
+    vclock_thread_leave();
+
+    struct pollfd pfd = { .fd = quit_fd, .events = POLLIN };
+    while (true) {
+        int ready = poll(&pfd, 1, HOSTAPD_CTRL_PING_INTERVAL_MS);
+        if (ready > 0)
+            break;
+        if (ready == 0 && !vclock_simulated())
+            ping();
+    }
+
+    hostapd_ctrl_close(&main_ctrl);
+    close(quit_fd);
+    quit_fd = -1;
+    return_value = 0;
+    pthread_exit(&return_value);
+}
+
+// Stops the ping loop of hostapd_ctrl_init(). The thread can then be joined
+void hostapd_ctrl_quit(void) {
+    uint64_t wake = 1;
+    if (quit_fd >= 0 && write(quit_fd, &wake, sizeof(wake)) < 0)
+        perror("quit");
+}
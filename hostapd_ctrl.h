@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _HOSTAPD_CTRL_H_
+#define _HOSTAPD_CTRL_H_
+
+#include <stdbool.h>
+#include <sys/un.h>
+
+#ifndef HOSTAPD_CTRL_DIR // The tests use a directory of their own
+#define HOSTAPD_CTRL_DIR "/var/run/hostapd"
+#endif
+#define HOSTAPD_CTRL_CLIENT_DIR "/tmp"
+#define HOSTAPD_CTRL_MAX_INTERFACES 8
+#define HOSTAPD_CTRL_IFNAME_SIZE 64
+#define HOSTAPD_CTRL_TIMEOUT_MS 10000     // The same as hostapd_cli
+#define HOSTAPD_CTRL_PING_INTERVAL_MS 5000
+#define HOSTAPD_CTRL_MOCK_IFNAME "sim0"  // The interface of the mock hostapd used in the simulation
+
+// A connection to the control socket of one hostapd interface (radio or BSS)
+struct hostapd_ctrl {
+    char name[HOSTAPD_CTRL_IFNAME_SIZE];
+    int fd;
+    struct sockaddr_un local;
+};
+
+void *hostapd_ctrl_init(void *arg);
+void hostapd_ctrl_quit(void);
+
+int hostapd_ctrl_open(struct hostapd_ctrl *ctrl, const char *ifname);
+void hostapd_ctrl_close(struct hostapd_ctrl *ctrl);
+int hostapd_ctrl_reconnect(struct hostapd_ctrl *ctrl);
+int hostapd_ctrl_request(struct hostapd_ctrl *ctrl, const char *cmd, char *reply, int reply_size);
+int hostapd_ctrl_command(struct hostapd_ctrl *ctrl, const char *cmd);
+int hostapd_ctrl_open_beacon_ifaces(struct hostapd_ctrl *ifaces, int max, bool all);
+
+#endif //_HOSTAPD_CTRL_H_
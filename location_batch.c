@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "location_batch.h"
+#include "location_fixed.h"
+#include "utils.h"
+
+/*
+ * Encodes the Location messages of many UAS at once, e.g. for fleet simulation. The input is a structure
+ * of arrays, so the scaling of each field runs as a plain loop over a chunk of UAS that the compiler
+ * vectorizes (this file is built with -O3). Only the final packing into the 25 byte messages is done
+ * per message. The results are the same as encode_location_fixed() and thereby encodeLocationMessage().
+ *
+ * The chunks are spread over a pool of worker threads. The calling thread works on chunks too.
+ * Only one batch may be encoded at a time.
+ */
+
+struct batch_job {
+    ODID_Location_encoded *out;
+    uint8_t *ok;
+    const struct location_batch *in;
+    size_t chunks;
+};
+
+static pthread_t workers[LOCATION_BATCH_MAX_THREADS];
+static int worker_count = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+static struct batch_job job;
+static uint64_t job_generation = 0;
+static uint64_t start_generation = 0; // The last job before the workers were started
+static int busy_workers = 0;
+static bool stopping = false;
+static _Atomic size_t next_chunk;
+static _Atomic size_t encoded_total;
+
+static size_t encode_chunk(ODID_Location_encoded *out, uint8_t *ok, const struct location_batch *in,
+                           size_t first, size_t count) {
+    uint8_t valid[LOCATION_BATCH_CHUNK], flags[LOCATION_BATCH_CHUNK], direction[LOCATION_BATCH_CHUNK];
+    uint8_t speed_horizontal[LOCATION_BATCH_CHUNK];
+    int8_t speed_vertical[LOCATION_BATCH_CHUNK];
+    uint16_t altitude_baro[LOCATION_BATCH_CHUNK], altitude_geo[LOCATION_BATCH_CHUNK], height[LOCATION_BATCH_CHUNK];
+
+    const uint8_t *status = in->status + first, *height_type = in->height_type + first;
+    const uint16_t *direction_cdeg = in->direction_cdeg + first;
+    const uint16_t *speed_h = in->speed_horizontal_cm_s + first;
+    const int16_t *speed_v = in->speed_vertical_cm_s + first;
+    const int32_t *latitude = in->latitude_e7 + first, *longitude = in->longitude_e7 + first;
+    const int32_t *baro = in->altitude_baro_dm + first, *geo = in->altitude_geo_dm + first;
+    const int32_t *above = in->height_dm + first;
+    const uint16_t *timestamp = in->timestamp_ds + first;
+
+    // Range checks without branches. Offsetting by the minimum turns each range into one unsigned compare
+    for (size_t i = 0; i < count; i++) {
+        valid[i] = (status[i] <= 15) & (height_type[i] <= 1) &
+                   ((direction_cdeg[i] <= DIRECTION_MAX_CDEG) | (direction_cdeg[i] == DIRECTION_UNKNOWN_CDEG)) &
+                   ((speed_h[i] <= SPEED_H_MAX_CM_S) | (speed_h[i] == SPEED_H_UNKNOWN_CM_S)) &
+                   (((uint16_t) (speed_v[i] + SPEED_V_MAX_CM_S) <= 2 * SPEED_V_MAX_CM_S) |
+                    (speed_v[i] == SPEED_V_UNKNOWN_CM_S)) &
+                   ((timestamp[i] <= TIMESTAMP_MAX_DS) | (timestamp[i] == INV_TIMESTAMP));
+    }
+    for (size_t i = 0; i < count; i++) {
+        valid[i] &= ((uint32_t) latitude[i] + LATITUDE_MAX_E7 <= 2U * LATITUDE_MAX_E7) &
+                    ((uint32_t) longitude[i] + LONGITUDE_MAX_E7 <= 2U * LONGITUDE_MAX_E7);
+    }
+    for (size_t i = 0; i < count; i++) {
+        valid[i] &= ((uint32_t) (baro[i] - ALTITUDE_MIN_DM) <= ALTITUDE_MAX_DM - ALTITUDE_MIN_DM) &
+                    ((uint32_t) (geo[i] - ALTITUDE_MIN_DM) <= ALTITUDE_MAX_DM - ALTITUDE_MIN_DM) &
+                    ((uint32_t) (above[i] - ALTITUDE_MIN_DM) <= ALTITUDE_MAX_DM - ALTITUDE_MIN_DM);
+    }
+    for (size_t i = 0; i < count; i++) {
+        valid[i] &= (in->horiz_accuracy[first + i] <= 15) & (in->vert_accuracy[first + i] <= 15) &
+                    (in->baro_accuracy[first + i] <= 15) & (in->speed_accuracy[first + i] <= 15) &
+                    (in->ts_accuracy[first + i] <= 15);
+    }
+
+    // Direction and horizontal speed, both with their bit in the second byte
+    for (size_t i = 0; i < count; i++) {
+        uint32_t degrees = (direction_cdeg[i] + 50U) / 100U;
+        uint32_t east_west = degrees >= 180;
+        direction[i] = (uint8_t) (degrees - 180 * east_west);
+
+        uint32_t speed = speed_h[i];
+        uint32_t multiplier = speed > SPEED_H_MULT_0_MAX_CM_S;
+        speed_horizontal[i] = (uint8_t) (multiplier ? (speed - SPEED_H_MULT_0_MAX_CM_S) / 75U : speed / 25U);
+        flags[i] = (uint8_t) ((status[i] & 0x0F) << 4 | (height_type[i] & 1) << 2 | east_west << 1 | multiplier);
+    }
+    // Truncated towards zero like the float conversion of the reference
+    for (size_t i = 0; i < count; i++) {
+        int32_t speed = speed_v[i];
+        uint32_t magnitude = (uint32_t) (speed < 0 ? -speed : speed) / 50U;
+        speed_vertical[i] = (int8_t) (speed < 0 ? -(int32_t) magnitude : (int32_t) magnitude);
+    }
+    for (size_t i = 0; i < count; i++) {
+        altitude_baro[i] = (uint16_t) ((uint32_t) (baro[i] - ALTITUDE_MIN_DM) / 5U);
+        altitude_geo[i] = (uint16_t) ((uint32_t) (geo[i] - ALTITUDE_MIN_DM) / 5U);
+        height[i] = (uint16_t) ((uint32_t) (above[i] - ALTITUDE_MIN_DM) / 5U);
+    }
+
+    size_t encoded = 0;
+    for (size_t i = 0; i < count; i++) {
+        ODID_Location_encoded *message = &out[first + i];
+        if (ok)
+            ok[first + i] = valid[i];
+        if (!valid[i]) {
+            memset(message, 0, sizeof(*message));
+            continue;
+        }
+        uint8_t *bytes = (uint8_t *) message;
+        message->ProtoVersion = ODID_PROTOCOL_VERSION;
+        message->MessageType = ODID_MESSAGETYPE_LOCATION;
+        bytes[1] = flags[i]; // Status, Reserved, HeightType, EWDirection and SpeedMult
+        message->Direction = direction[i];
+        message->SpeedHorizontal = speed_horizontal[i];
+        message->SpeedVertical = speed_vertical[i];
+        message->Latitude = latitude[i];
+        message->Longitude = longitude[i];
+        message->AltitudeBaro = altitude_baro[i];
+        message->AltitudeGeo = altitude_geo[i];
+        message->Height = height[i];
+        message->HorizAccuracy = in->horiz_accuracy[first + i];
+        message->VertAccuracy = in->vert_accuracy[first + i];
+        message->BaroAccuracy = in->baro_accuracy[first + i];
+        message->SpeedAccuracy = in->speed_accuracy[first + i];
+        message->TimeStamp = timestamp[i];
+        message->TSAccuracy = in->ts_accuracy[first + i];
+        message->Reserved2 = 0;
+        message->Reserved3 = 0;
+        encoded++;
+    }
+    return encoded;
+}
+
+static void run_chunks(const struct batch_job *work) {
+    size_t encoded = 0;
+    for (;;) {
+        size_t chunk = atomic_fetch_add(&next_chunk, 1);
+        if (chunk >= work->chunks)
+            break;
+        size_t first = chunk * LOCATION_BATCH_CHUNK;
+        encoded += encode_chunk(work->out, work->ok, work->in, first,
+                                MINIMUM(LOCATION_BATCH_CHUNK, work->in->count - first));
+    }
+    atomic_fetch_add(&encoded_total, encoded);
+}
+
+static void *worker_loop(void *arg) {
+    (void) arg;
+    uint64_t seen_generation = start_generation;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (!stopping && job_generation == seen_generation)
+            pthread_cond_wait(&job_ready, &lock);
+        if (stopping)
+            break;
+        seen_generation = job_generation;
+        struct batch_job work = job;
+        pthread_mutex_unlock(&lock);
+
+        run_chunks(&work);
+
+        pthread_mutex_lock(&lock);
+        if (--busy_workers == 0)
+            pthread_cond_signal(&job_done);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+// Encodes on the calling thread plus threads - 1 workers
+int location_batch_start(int threads) {
+    location_batch_stop();
+    stopping = false;
+    start_generation = job_generation;
+    threads = MINIMUM(MAXIMUM(threads, 1), LOCATION_BATCH_MAX_THREADS);
+    for (int i = 0; i < threads - 1; i++) {
+        if (pthread_create(&workers[i], NULL, worker_loop, NULL) != 0) {
+            location_batch_stop();
+            return -1;
+        }
+        worker_count++;
+    }
+    return 0;
+}
+
+void location_batch_stop() {
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&job_ready);
+    pthread_mutex_unlock(&lock);
+    for (int i = 0; i < worker_count; i++)
+        pthread_join(workers[i], NULL);
+    worker_count = 0;
+}
+
+// Returns the number of messages encoded. ok[i] (optional) is cleared for the UAS with invalid data
+size_t encode_location_batch(ODID_Location_encoded *out, uint8_t *ok, const struct location_batch *in) {
+    pthread_mutex_lock(&lock);
+    job.out = out;
+    job.ok = ok;
+    job.in = in;
+    job.chunks = (in->count + LOCATION_BATCH_CHUNK - 1) / LOCATION_BATCH_CHUNK;
+    struct batch_job work = job;
+    atomic_store(&next_chunk, 0);
+    atomic_store(&encoded_total, 0);
+    busy_workers = worker_count;
+    job_generation++;
+    pthread_cond_broadcast(&job_ready);
+    pthread_mutex_unlock(&lock);
+
+    run_chunks(&work);
+
+    pthread_mutex_lock(&lock);
+    while (busy_workers > 0)
+        pthread_cond_wait(&job_done, &lock);
+    pthread_mutex_unlock(&lock);
+    return atomic_load(&encoded_total);
+}
+
+/*
+ * Benchmark with a random fleet. Every message is first compared with encodeLocationMessage(), then the
+ * throughput is measured on one thread and on all CPU cores.
+ */
+
+#define BENCH_MIN_DURATION_NS 1000000000ULL
+#define BENCH_MAX_REPORTED 5
+#define BENCH_INVALID_EVERY 97 // Every so many UAS get an out of range value
+
+struct fleet {
+    struct location_batch batch;
+    uint8_t *status, *height_type, *horiz_accuracy, *vert_accuracy, *baro_accuracy, *speed_accuracy, *ts_accuracy;
+    uint16_t *direction_cdeg, *speed_horizontal_cm_s, *timestamp_ds;
+    int16_t *speed_vertical_cm_s;
+    int32_t *latitude_e7, *longitude_e7, *altitude_baro_dm, *altitude_geo_dm, *height_dm;
+};
+
+static uint64_t random_state = 0x2545F4914F6CDD1DULL;
+
+static uint64_t next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static int64_t random_range(int64_t first, int64_t last) {
+    return first + (int64_t) (next_random() % (uint64_t) (last - first + 1));
+}
+
+static void free_fleet(struct fleet *fleet) {
+    void *arrays[] = {
+            fleet->status, fleet->height_type, fleet->horiz_accuracy, fleet->vert_accuracy, fleet->baro_accuracy,
+            fleet->speed_accuracy, fleet->ts_accuracy, fleet->direction_cdeg, fleet->speed_horizontal_cm_s,
+            fleet->timestamp_ds, fleet->speed_vertical_cm_s, fleet->latitude_e7, fleet->longitude_e7,
+            fleet->altitude_baro_dm, fleet->altitude_geo_dm, fleet->height_dm,
+    };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++)
+        free(arrays[i]);
+}
+
+static int alloc_fleet(struct fleet *fleet, size_t count) {
+    memset(fleet, 0, sizeof(*fleet));
+    fleet->status = malloc(count);
+    fleet->height_type = malloc(count);
+    fleet->horiz_accuracy = malloc(count);
+    fleet->vert_accuracy = malloc(count);
+    fleet->baro_accuracy = malloc(count);
+    fleet->speed_accuracy = malloc(count);
+    fleet->ts_accuracy = malloc(count);
+    fleet->direction_cdeg = malloc(count * sizeof(uint16_t));
+    fleet->speed_horizontal_cm_s = malloc(count * sizeof(uint16_t));
+    fleet->timestamp_ds = malloc(count * sizeof(uint16_t));
+    fleet->speed_vertical_cm_s = malloc(count * sizeof(int16_t));
+    fleet->latitude_e7 = malloc(count * sizeof(int32_t));
+    fleet->longitude_e7 = malloc(count * sizeof(int32_t));
+    fleet->altitude_baro_dm = malloc(count * sizeof(int32_t));
+    fleet->altitude_geo_dm = malloc(count * sizeof(int32_t));
+    fleet->height_dm = malloc(count * sizeof(int32_t));
+    if (!fleet->status || !fleet->height_type || !fleet->horiz_accuracy || !fleet->vert_accuracy ||
+        !fleet->baro_accuracy || !fleet->speed_accuracy || !fleet->ts_accuracy || !fleet->direction_cdeg ||
+        !fleet->speed_horizontal_cm_s || !fleet->timestamp_ds || !fleet->speed_vertical_cm_s ||
+        !fleet->latitude_e7 || !fleet->longitude_e7 || !fleet->altitude_baro_dm || !fleet->altitude_geo_dm ||
+        !fleet->height_dm) {
+        free_fleet(fleet);
+        return -1;
+    }
+
+    struct location_batch *batch = &fleet->batch;
+    batch->count = count;
+    batch->status = fleet->status;
+    batch->height_type = fleet->height_type;
+    batch->direction_cdeg = fleet->direction_cdeg;
+    batch->speed_horizontal_cm_s = fleet->speed_horizontal_cm_s;
+    batch->speed_vertical_cm_s = fleet->speed_vertical_cm_s;
+    batch->latitude_e7 = fleet->latitude_e7;
+    batch->longitude_e7 = fleet->longitude_e7;
+    batch->altitude_baro_dm = fleet->altitude_baro_dm;
+    batch->altitude_geo_dm = fleet->altitude_geo_dm;
+    batch->height_dm = fleet->height_dm;
+    batch->timestamp_ds = fleet->timestamp_ds;
+    batch->horiz_accuracy = fleet->horiz_accuracy;
+    batch->vert_accuracy = fleet->vert_accuracy;
+    batch->baro_accuracy = fleet->baro_accuracy;
+    batch->speed_accuracy = fleet->speed_accuracy;
+    batch->ts_accuracy = fleet->ts_accuracy;
+    return 0;
+}
+
+static void fill_fleet(struct fleet *fleet) {
+    for (size_t i = 0; i < fleet->batch.count; i++) {
+        fleet->status[i] = (uint8_t) random_range(0, 15);
+        fleet->height_type[i] = (uint8_t) random_range(0, 1);
+        fleet->direction_cdeg[i] = (uint16_t) random_range(0, DIRECTION_MAX_CDEG);
+        fleet->speed_horizontal_cm_s[i] = (uint16_t) random_range(0, SPEED_H_MAX_CM_S);
+        fleet->speed_vertical_cm_s[i] = (int16_t) random_range(-SPEED_V_MAX_CM_S, SPEED_V_MAX_CM_S);
+        fleet->latitude_e7[i] = (int32_t) random_range(-LATITUDE_MAX_E7, LATITUDE_MAX_E7);
+        fleet->longitude_e7[i] = (int32_t) random_range(-LONGITUDE_MAX_E7, LONGITUDE_MAX_E7);
+        fleet->altitude_baro_dm[i] = (int32_t) random_range(ALTITUDE_MIN_DM, ALTITUDE_MAX_DM);
+        fleet->altitude_geo_dm[i] = (int32_t) random_range(ALTITUDE_MIN_DM, ALTITUDE_MAX_DM);
+        fleet->height_dm[i] = (int32_t) random_range(ALTITUDE_MIN_DM, ALTITUDE_MAX_DM);
+        fleet->timestamp_ds[i] = (uint16_t) random_range(0, TIMESTAMP_MAX_DS);
+        fleet->horiz_accuracy[i] = location_fixed_horiz_accuracy((uint32_t) random_range(0, 5000));
+        fleet->vert_accuracy[i] = location_fixed_vert_accuracy((uint32_t) random_range(0, 20000));
+        fleet->baro_accuracy[i] = location_fixed_vert_accuracy((uint32_t) random_range(0, 20000));
+        fleet->speed_accuracy[i] = location_fixed_speed_accuracy((uint32_t) random_range(0, 1500));
+        fleet->ts_accuracy[i] = location_fixed_ts_accuracy((uint32_t) random_range(0, 1600));
+
+        if (i % BENCH_INVALID_EVERY != BENCH_INVALID_EVERY - 1)
+            continue;
+        switch (random_range(0, 5)) {
+            case 0: fleet->direction_cdeg[i] = DIRECTION_MAX_CDEG + 1; break;
+            case 1: fleet->speed_vertical_cm_s[i] = -SPEED_V_MAX_CM_S - 1; break;
+            case 2: fleet->latitude_e7[i] = LATITUDE_MAX_E7 + 1; break;
+            case 3: fleet->longitude_e7[i] = -LONGITUDE_MAX_E7 - 1; break;
+            case 4: fleet->height_dm[i] = ALTITUDE_MAX_DM + 1; break;
+            default: fleet->timestamp_ds[i] = TIMESTAMP_MAX_DS + 1; break;
+        }
+    }
+}
+
+static uint64_t verify_fleet(const struct fleet *fleet, const ODID_Location_encoded *out, const uint8_t *ok) {
+    uint64_t mismatches = 0;
+    for (size_t i = 0; i < fleet->batch.count; i++) {
+        struct location_fixed fixed = {
+                .status = fleet->status[i], .height_type = fleet->height_type[i],
+                .direction_cdeg = fleet->direction_cdeg[i], .speed_horizontal_cm_s = fleet->speed_horizontal_cm_s[i],
+                .speed_vertical_cm_s = fleet->speed_vertical_cm_s[i], .latitude_e7 = fleet->latitude_e7[i],
+                .longitude_e7 = fleet->longitude_e7[i], .altitude_baro_dm = fleet->altitude_baro_dm[i],
+                .altitude_geo_dm = fleet->altitude_geo_dm[i], .height_dm = fleet->height_dm[i],
+                .timestamp_ds = fleet->timestamp_ds[i], .horiz_accuracy = fleet->horiz_accuracy[i],
+                .vert_accuracy = fleet->vert_accuracy[i], .baro_accuracy = fleet->baro_accuracy[i],
+                .speed_accuracy = fleet->speed_accuracy[i], .ts_accuracy = fleet->ts_accuracy[i],
+        };
+        ODID_Location_data data;
+        ODID_Location_encoded reference;
+        memset(&reference, 0, sizeof(reference));
+        location_fixed_to_data(&data, &fixed);
+        bool reference_ok = encodeLocationMessage(&reference, &data) == ODID_SUCCESS;
+        if (reference_ok == (ok[i] != 0) && (!reference_ok || memcmp(&reference, &out[i], sizeof(reference)) == 0))
+            continue;
+        if (mismatches++ < BENCH_MAX_REPORTED) {
+            printf("Mismatch at UAS %zu: reference %s, batch %s\n", i, reference_ok ? "encoded" : "rejected",
+                   ok[i] ? "encoded" : "rejected");
+        }
+    }
+    return mismatches;
+}
+
+static double measure(const struct fleet *fleet, ODID_Location_encoded *out, int threads) {
+    if (location_batch_start(threads) != 0)
+        return 0;
+    encode_location_batch(out, NULL, &fleet->batch); // Start the workers and warm up the caches
+    uint64_t batches = 0, start_ns = get_time_ns(), elapsed_ns;
+    do {
+        encode_location_batch(out, NULL, &fleet->batch);
+        batches++;
+        elapsed_ns = get_time_ns() - start_ns;
+    } while (elapsed_ns < BENCH_MIN_DURATION_NS);
+    location_batch_stop();
+    return (double) (batches * fleet->batch.count) / ((double) elapsed_ns / 1e9);
+}
+
+int location_batch_benchmark(int uas_count) {
+    struct fleet fleet;
+    size_t count = (size_t) uas_count;
+    ODID_Location_encoded *out = malloc(count * sizeof(ODID_Location_encoded));
+    uint8_t *ok = malloc(count);
+    if (!out || !ok || alloc_fleet(&fleet, count) != 0) {
+        printf("Error: Unable to allocate the data for %d UAS\n", uas_count);
+        free(out);
+        free(ok);
+        return -1;
+    }
+    location_fixed_init();
+    fill_fleet(&fleet);
+
+    location_batch_start(1);
+    size_t encoded = encode_location_batch(out, ok, &fleet.batch);
+    uint64_t mismatches = verify_fleet(&fleet, out, ok);
+    printf("Batch of %d UAS: %zu encoded, %zu rejected, %lu mismatches with encodeLocationMessage\n", uas_count,
+           encoded, count - encoded, (unsigned long) mismatches);
+
+    int cores = (int) MINIMUM(MAXIMUM(sysconf(_SC_NPROCESSORS_ONLN), 1), LOCATION_BATCH_MAX_THREADS);
+    double single = measure(&fleet, out, 1);
+    printf("1 thread:  %12.0f messages/s\n", single);
+    if (cores > 1) {
+        double all = measure(&fleet, out, cores);
+        printf("%d threads: %12.0f messages/s, %.0f per core (%.0f%% scaling)\n", cores, all, all / cores,
+               100.0 * all / (single * cores));
+    }
+
+    free_fleet(&fleet);
+    free(out);
+    free(ok);
+    return mismatches == 0 ? 0 : -1;
+}
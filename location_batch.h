@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _LOCATION_BATCH_H_
+#define _LOCATION_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <opendroneid.h>
+
+#define LOCATION_BATCH_DEFAULT_UAS 10000
+#define LOCATION_BATCH_MAX_THREADS 16
+#define LOCATION_BATCH_CHUNK 256 // Messages per work item
+
+// One array element per UAS. The units and ranges are the ones of struct location_fixed
+struct location_batch {
+    size_t count;
+    const uint8_t *status;
+    const uint8_t *height_type;
+    const uint16_t *direction_cdeg;
+    const uint16_t *speed_horizontal_cm_s;
+    const int16_t *speed_vertical_cm_s;
+    const int32_t *latitude_e7;
+    const int32_t *longitude_e7;
+    const int32_t *altitude_baro_dm;
+    const int32_t *altitude_geo_dm;
+    const int32_t *height_dm;
+    const uint16_t *timestamp_ds;
+    const uint8_t *horiz_accuracy;
+    const uint8_t *vert_accuracy;
+    const uint8_t *baro_accuracy;
+    const uint8_t *speed_accuracy;
+    const uint8_t *ts_accuracy;
+};
+
+int location_batch_start(int threads);
+void location_batch_stop(void);
+size_t encode_location_batch(ODID_Location_encoded *out, uint8_t *ok, const struct location_batch *in);
+int location_batch_benchmark(int uas_count);
+
+#endif //_LOCATION_BATCH_H_
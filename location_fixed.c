@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <sys/utsname.h>
+
+#include "location_fixed.h"
+#include "utils.h"
+
+/*
+ * Encodes the Location message from integer inputs without any float math. The scaling of the
+ * reference encoder (encodeLocationMessage) reduces to integer divisions, because every boundary where
+ * its float expressions change value (0.25 m/s, 0.5 m, 0.5 degree etc.) is exactly representable and
+ * lies on a whole number of the input units.
+ * The accuracy enums are set once per fix like with ODID_Location_data. The location_fixed_*_accuracy()
+ * functions look them up in tables built by running the reference createEnum*Accuracy() functions over
+ * the input range once in location_fixed_init().
+ *
+ * The output is bit-exact with encodeLocationMessage() given the data from location_fixed_to_data().
+ * location_fixed_benchmark() verifies that against the library this program is linked with.
+ */
+
+#define ACCURACY_MAX_RUNS 24
+#define HORIZ_ACCURACY_MAX_CM 2000000 // The tables hold the last value for larger inputs
+#define VERT_ACCURACY_MAX_CM 20000
+#define SPEED_ACCURACY_MAX_CM_S 2000
+#define TS_ACCURACY_MAX_MS 2000
+
+// Input ranges with the same accuracy enum value. start[0] is always 0
+struct accuracy_table {
+    uint32_t start[ACCURACY_MAX_RUNS];
+    uint8_t value[ACCURACY_MAX_RUNS];
+    int runs;
+};
+
+static struct accuracy_table horiz_table, vert_table, speed_table, ts_table;
+
+static uint8_t reference_horiz_accuracy(uint32_t cm) { return createEnumHorizontalAccuracy((float) cm / 100.0f); }
+static uint8_t reference_vert_accuracy(uint32_t cm) { return createEnumVerticalAccuracy((float) cm / 100.0f); }
+static uint8_t reference_speed_accuracy(uint32_t cm_s) { return createEnumSpeedAccuracy((float) cm_s / 100.0f); }
+static uint8_t reference_ts_accuracy(uint32_t ms) { return createEnumTimestampAccuracy((float) ms / 1000.0f); }
+
+static void build_table(struct accuracy_table *table, uint8_t (*reference)(uint32_t), uint32_t max_input) {
+    table->runs = 0;
+    for (int i = 0; i < ACCURACY_MAX_RUNS; i++)
+        table->start[i] = UINT32_MAX;
+    for (uint32_t input = 0; input <= max_input; input++) {
+        uint8_t value = reference(input);
+        if (table->runs > 0 && table->value[table->runs - 1] == value)
+            continue;
+        if (table->runs == ACCURACY_MAX_RUNS) {
+            printf("Error: More than %d accuracy ranges\n", ACCURACY_MAX_RUNS);
+            exit(EXIT_FAILURE);
+        }
+        table->start[table->runs] = input;
+        table->value[table->runs++] = value;
+    }
+}
+
+// Counts the ranges that start at or below the input, without branches
+static uint8_t accuracy_lookup(const struct accuracy_table *table, uint32_t input) {
+    int run = 0;
+    for (int i = 1; i < ACCURACY_MAX_RUNS; i++)
+        run += table->start[i] <= input;
+    return table->value[run];
+}
+
+uint8_t location_fixed_horiz_accuracy(uint32_t accuracy_cm) { return accuracy_lookup(&horiz_table, accuracy_cm); }
+uint8_t location_fixed_vert_accuracy(uint32_t accuracy_cm) { return accuracy_lookup(&vert_table, accuracy_cm); }
+uint8_t location_fixed_speed_accuracy(uint32_t accuracy_cm_s) { return accuracy_lookup(&speed_table, accuracy_cm_s); }
+uint8_t location_fixed_ts_accuracy(uint32_t accuracy_ms) { return accuracy_lookup(&ts_table, accuracy_ms); }
+
+void location_fixed_init() {
+    build_table(&horiz_table, reference_horiz_accuracy, HORIZ_ACCURACY_MAX_CM);
+    build_table(&vert_table, reference_vert_accuracy, VERT_ACCURACY_MAX_CM);
+    build_table(&speed_table, reference_speed_accuracy, SPEED_ACCURACY_MAX_CM_S);
+    build_table(&ts_table, reference_ts_accuracy, TS_ACCURACY_MAX_MS);
+}
+
+static inline uint16_t encode_altitude(int32_t altitude_dm) {
+    // (altitude + 1000 m) / 0.5 m, truncated
+    return (uint16_t) ((altitude_dm - ALTITUDE_MIN_DM) / 5);
+}
+
+// The same ranges as accepted by encodeLocationMessage()
+static inline bool in_range(const struct location_fixed *in) {
+    return in->status <= 15 && in->height_type <= 1 &&
+           (in->direction_cdeg <= DIRECTION_MAX_CDEG || in->direction_cdeg == DIRECTION_UNKNOWN_CDEG) &&
+           (in->speed_horizontal_cm_s <= SPEED_H_MAX_CM_S || in->speed_horizontal_cm_s == SPEED_H_UNKNOWN_CM_S) &&
+           in->speed_vertical_cm_s >= -SPEED_V_MAX_CM_S &&
+           (in->speed_vertical_cm_s <= SPEED_V_MAX_CM_S || in->speed_vertical_cm_s == SPEED_V_UNKNOWN_CM_S) &&
+           in->latitude_e7 >= -LATITUDE_MAX_E7 && in->latitude_e7 <= LATITUDE_MAX_E7 &&
+           in->longitude_e7 >= -LONGITUDE_MAX_E7 && in->longitude_e7 <= LONGITUDE_MAX_E7 &&
+           in->altitude_baro_dm >= ALTITUDE_MIN_DM && in->altitude_baro_dm <= ALTITUDE_MAX_DM &&
+           in->altitude_geo_dm >= ALTITUDE_MIN_DM && in->altitude_geo_dm <= ALTITUDE_MAX_DM &&
+           in->height_dm >= ALTITUDE_MIN_DM && in->height_dm <= ALTITUDE_MAX_DM &&
+           (in->timestamp_ds <= TIMESTAMP_MAX_DS || in->timestamp_ds == INV_TIMESTAMP) &&
+           in->horiz_accuracy <= 15 && in->vert_accuracy <= 15 && in->baro_accuracy <= 15 &&
+           in->speed_accuracy <= 15 && in->ts_accuracy <= 15;
+}
+
+int encode_location_fixed(ODID_Location_encoded *out, const struct location_fixed *in) {
+    if (!in_range(in))
+        return ODID_FAIL;
+
+    out->ProtoVersion = ODID_PROTOCOL_VERSION;
+    out->MessageType = ODID_MESSAGETYPE_LOCATION;
+    out->Status = in->status;
+    out->Reserved = 0;
+    out->HeightType = in->height_type;
+
+    // Whole degrees, rounded half away from zero. 180 degrees and above are sent with the E/W bit set
+    unsigned int direction = (in->direction_cdeg + 50U) / 100U;
+    out->EWDirection = direction >= 180;
+    out->Direction = (uint8_t) (direction >= 180 ? direction - 180 : direction);
+
+    if (in->speed_horizontal_cm_s <= SPEED_H_MULT_0_MAX_CM_S) {
+        out->SpeedMult = 0;
+        out->SpeedHorizontal = (uint8_t) (in->speed_horizontal_cm_s / 25U);
+    } else {
+        out->SpeedMult = 1;
+        out->SpeedHorizontal = (uint8_t) ((in->speed_horizontal_cm_s - SPEED_H_MULT_0_MAX_CM_S) / 75U);
+    }
+    out->SpeedVertical = (int8_t) (in->speed_vertical_cm_s / 50); // Truncated towards zero
+
+    out->Latitude = in->latitude_e7;
+    out->Longitude = in->longitude_e7;
+    out->AltitudeBaro = encode_altitude(in->altitude_baro_dm);
+    out->AltitudeGeo = encode_altitude(in->altitude_geo_dm);
+    out->Height = encode_altitude(in->height_dm);
+
+    out->HorizAccuracy = in->horiz_accuracy;
+    out->VertAccuracy = in->vert_accuracy;
+    out->BaroAccuracy = in->baro_accuracy;
+    out->SpeedAccuracy = in->speed_accuracy;
+    out->TimeStamp = in->timestamp_ds;
+    out->TSAccuracy = in->ts_accuracy;
+    out->Reserved2 = 0;
+    out->Reserved3 = 0;
+    return ODID_SUCCESS;
+}
+
+/*
+ * The reference truncates latitude * 1e7. For about one in sixteen values, value / 1e7 rounds to the
+ * double just below the exact quotient and would encode as value - 1. Use the neighbouring double
+ * further from zero for those. It is within one ulp of the exact value.
+ */
+static double latlon_to_degrees(int32_t value) {
+    double degrees = value / 1e7;
+    if ((int64_t) (degrees * 1e7) != value)
+        degrees = nextafter(degrees, value > 0 ? INFINITY : -INFINITY);
+    return degrees;
+}
+
+// The floating point data that encodes to the same message with encodeLocationMessage()
+void location_fixed_to_data(ODID_Location_data *out, const struct location_fixed *in) {
+    out->Status = in->status;
+    out->HeightType = in->height_type;
+    out->Direction = (float) in->direction_cdeg / 100.0f;
+    out->SpeedHorizontal = (float) in->speed_horizontal_cm_s / 100.0f;
+    out->SpeedVertical = (float) in->speed_vertical_cm_s / 100.0f;
+    out->Latitude = latlon_to_degrees(in->latitude_e7);
+    out->Longitude = latlon_to_degrees(in->longitude_e7);
+    out->AltitudeBaro = (float) in->altitude_baro_dm / 10.0f;
+    out->AltitudeGeo = (float) in->altitude_geo_dm / 10.0f;
+    out->Height = (float) in->height_dm / 10.0f;
+    out->HorizAccuracy = in->horiz_accuracy;
+    out->VertAccuracy = in->vert_accuracy;
+    out->BaroAccuracy = in->baro_accuracy;
+    out->SpeedAccuracy = in->speed_accuracy;
+    out->TimeStamp = in->timestamp_ds == INV_TIMESTAMP ? INV_TIMESTAMP : (float) in->timestamp_ds / 10.0f;
+    out->TSAccuracy = in->ts_accuracy;
+}
+
+/*
+ * Benchmark and bit-exactness check against encodeLocationMessage() and createEnum*Accuracy(). Every
+ * field and accuracy table is swept over its valid range and a little beyond, then random messages are
+ * compared. The timing runs both encoders over the same set of valid messages.
+ */
+
+#define BENCH_SET_SIZE 1024
+#define BENCH_MAX_REPORTED 5
+
+enum bench_field {
+    FIELD_DIRECTION, FIELD_SPEED_H, FIELD_SPEED_V, FIELD_LATITUDE, FIELD_LONGITUDE, FIELD_ALTITUDE,
+    FIELD_TIMESTAMP, FIELD_ACCURACIES,
+};
+
+static const struct {
+    enum bench_field field;
+    const char *name;
+    int64_t first;
+    int64_t last;
+} sweeps[] = {
+        { FIELD_DIRECTION, "direction", 0, DIRECTION_UNKNOWN_CDEG + 100 },
+        { FIELD_SPEED_H, "horizontal speed", 0, SPEED_H_UNKNOWN_CM_S + 100 },
+        { FIELD_SPEED_V, "vertical speed", -SPEED_V_MAX_CM_S - 100, SPEED_V_UNKNOWN_CM_S + 100 },
+        { FIELD_LATITUDE, "latitude", LATITUDE_MAX_E7 - 1000000, LATITUDE_MAX_E7 + 100 },
+        { FIELD_LONGITUDE, "longitude", -LONGITUDE_MAX_E7 - 100, -LONGITUDE_MAX_E7 + 1000000 },
+        { FIELD_ALTITUDE, "altitudes", ALTITUDE_MIN_DM - 100, ALTITUDE_MAX_DM + 100 },
+        { FIELD_TIMESTAMP, "timestamp", 0, TIMESTAMP_MAX_DS + 100 },
+        { FIELD_TIMESTAMP, "timestamp", INV_TIMESTAMP, INV_TIMESTAMP },
+        { FIELD_ACCURACIES, "accuracies", 0, 16 },
+};
+
+static const struct {
+    const char *name;
+    uint8_t (*fixed)(uint32_t);
+    uint8_t (*reference)(uint32_t);
+    uint32_t max_input;
+} tables[] = {
+        { "horizontal accuracy", location_fixed_horiz_accuracy, reference_horiz_accuracy, HORIZ_ACCURACY_MAX_CM },
+        { "vertical accuracy", location_fixed_vert_accuracy, reference_vert_accuracy, VERT_ACCURACY_MAX_CM },
+        { "speed accuracy", location_fixed_speed_accuracy, reference_speed_accuracy, SPEED_ACCURACY_MAX_CM_S },
+        { "timestamp accuracy", location_fixed_ts_accuracy, reference_ts_accuracy, TS_ACCURACY_MAX_MS },
+};
+
+static uint64_t random_state = 0x2545F4914F6CDD1DULL;
+static ODID_Location_encoded bench_output[BENCH_SET_SIZE];
+
+static uint64_t next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static int64_t random_range(int64_t first, int64_t last) {
+    return first + (int64_t) (next_random() % (uint64_t) (last - first + 1));
+}
+
+static void set_field(struct location_fixed *in, enum bench_field field, int64_t value) {
+    switch (field) {
+        case FIELD_DIRECTION: in->direction_cdeg = (uint16_t) value; break;
+        case FIELD_SPEED_H: in->speed_horizontal_cm_s = (uint16_t) value; break;
+        case FIELD_SPEED_V: in->speed_vertical_cm_s = (int16_t) value; break;
+        case FIELD_LATITUDE: in->latitude_e7 = (int32_t) value; break;
+        case FIELD_LONGITUDE: in->longitude_e7 = (int32_t) value; break;
+        case FIELD_ALTITUDE:
+            in->altitude_baro_dm = in->altitude_geo_dm = in->height_dm = (int32_t) value;
+            break;
+        case FIELD_TIMESTAMP: in->timestamp_ds = (uint16_t) value; break;
+        case FIELD_ACCURACIES:
+            in->horiz_accuracy = in->vert_accuracy = in->baro_accuracy = (uint8_t) value;
+            in->speed_accuracy = in->ts_accuracy = (uint8_t) value;
+            break;
+    }
+}
+
+// Mostly valid values, with a few out of range ones to compare the rejections
+static void random_location(struct location_fixed *in, bool valid_only) {
+    int spill = valid_only ? 0 : 100;
+    in->status = (uint8_t) random_range(0, valid_only ? 15 : 16);
+    in->height_type = (uint8_t) random_range(0, valid_only ? 1 : 2);
+    in->direction_cdeg = (uint16_t) random_range(0, DIRECTION_MAX_CDEG + spill);
+    in->speed_horizontal_cm_s = (uint16_t) random_range(0, SPEED_H_MAX_CM_S + spill);
+    in->speed_vertical_cm_s = (int16_t) random_range(-SPEED_V_MAX_CM_S - spill, SPEED_V_MAX_CM_S + spill);
+    in->latitude_e7 = (int32_t) random_range(-LATITUDE_MAX_E7 - spill, LATITUDE_MAX_E7 + spill);
+    in->longitude_e7 = (int32_t) random_range(-LONGITUDE_MAX_E7 - spill, LONGITUDE_MAX_E7 + spill);
+    in->altitude_baro_dm = (int32_t) random_range(ALTITUDE_MIN_DM - spill, ALTITUDE_MAX_DM + spill);
+    in->altitude_geo_dm = (int32_t) random_range(ALTITUDE_MIN_DM - spill, ALTITUDE_MAX_DM + spill);
+    in->height_dm = (int32_t) random_range(ALTITUDE_MIN_DM - spill, ALTITUDE_MAX_DM + spill);
+    in->timestamp_ds = (uint16_t) random_range(0, TIMESTAMP_MAX_DS + spill);
+    in->horiz_accuracy = location_fixed_horiz_accuracy((uint32_t) random_range(0, 5000));
+    in->vert_accuracy = location_fixed_vert_accuracy((uint32_t) random_range(0, 20000));
+    in->baro_accuracy = location_fixed_vert_accuracy((uint32_t) random_range(0, 20000));
+    in->speed_accuracy = location_fixed_speed_accuracy((uint32_t) random_range(0, 1500));
+    in->ts_accuracy = location_fixed_ts_accuracy((uint32_t) random_range(0, 1600));
+}
+
+static void print_message(const char *label, int status, const ODID_Location_encoded *encoded) {
+    printf("  %-10s %s", label, status == ODID_SUCCESS ? "" : "ODID_FAIL");
+    if (status == ODID_SUCCESS) {
+        for (size_t i = 0; i < sizeof(*encoded); i++)
+            printf("%02X", ((const uint8_t *) encoded)[i]);
+    }
+    printf("\n");
+}
+
+static bool compare(const struct location_fixed *in, const char *source, uint64_t *mismatches) {
+    ODID_Location_data data;
+    ODID_Location_encoded reference, fixed;
+    memset(&reference, 0, sizeof(reference));
+    memset(&fixed, 0, sizeof(fixed));
+    location_fixed_to_data(&data, in);
+    int reference_status = encodeLocationMessage(&reference, &data);
+    int fixed_status = encode_location_fixed(&fixed, in);
+    if (reference_status == fixed_status &&
+        (reference_status != ODID_SUCCESS || memcmp(&reference, &fixed, sizeof(fixed)) == 0))
+        return true;
+
+    if ((*mismatches)++ < BENCH_MAX_REPORTED) {
+        printf("Mismatch (%s): direction %u, speed %u/%d, lat %d, lon %d, alt %d/%d/%d, time %u\n", source,
+               in->direction_cdeg, in->speed_horizontal_cm_s, in->speed_vertical_cm_s, in->latitude_e7,
+               in->longitude_e7, in->altitude_baro_dm, in->altitude_geo_dm, in->height_dm, in->timestamp_ds);
+        print_message("reference", reference_status, &reference);
+        print_message("fixed", fixed_status, &fixed);
+    }
+    return false;
+}
+
+static double time_reference(ODID_Location_data *data, int messages) {
+    uint64_t start_ns = get_time_ns();
+    for (int done = 0; done < messages; done += BENCH_SET_SIZE) {
+        for (int i = 0; i < BENCH_SET_SIZE; i++)
+            encodeLocationMessage(&bench_output[i], &data[i]);
+    }
+    return (double) (get_time_ns() - start_ns) / messages;
+}
+
+static double time_fixed(const struct location_fixed *in, int messages) {
+    uint64_t start_ns = get_time_ns();
+    for (int done = 0; done < messages; done += BENCH_SET_SIZE) {
+        for (int i = 0; i < BENCH_SET_SIZE; i++)
+            encode_location_fixed(&bench_output[i], &in[i]);
+    }
+    return (double) (get_time_ns() - start_ns) / messages;
+}
+
+int location_fixed_benchmark(int messages) {
+    struct utsname machine;
+    if (uname(&machine) != 0)
+        strcpy(machine.machine, "unknown");
+    messages = (messages + BENCH_SET_SIZE - 1) / BENCH_SET_SIZE * BENCH_SET_SIZE;
+    printf("Location encoder benchmark on %s, %d messages\n", machine.machine, messages);
+
+    uint64_t start_ns = get_time_ns();
+    location_fixed_init();
+    printf("Accuracy tables built in %.1f ms\n", (double) (get_time_ns() - start_ns) / 1e6);
+
+    uint64_t compared = 0, mismatches = 0;
+    for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+        for (uint32_t input = 0; input <= tables[t].max_input + 100; input++) {
+            uint8_t reference = tables[t].reference(input), fixed = tables[t].fixed(input);
+            if (reference != fixed && mismatches++ < BENCH_MAX_REPORTED)
+                printf("Mismatch (%s): %u gives %u instead of %u\n", tables[t].name, input, fixed, reference);
+            compared++;
+        }
+    }
+
+    struct location_fixed base;
+    random_location(&base, true);
+    for (size_t s = 0; s < sizeof(sweeps) / sizeof(sweeps[0]); s++) {
+        struct location_fixed in = base;
+        for (int64_t value = sweeps[s].first; value <= sweeps[s].last; value++) {
+            set_field(&in, sweeps[s].field, value);
+            compare(&in, sweeps[s].name, &mismatches);
+            compared++;
+        }
+    }
+    for (int i = 0; i < messages; i++) {
+        struct location_fixed in;
+        random_location(&in, false);
+        compare(&in, "random", &mismatches);
+        compared++;
+    }
+    printf("Bit-exactness: %lu messages and accuracies compared, %lu mismatches\n", (unsigned long) compared,
+           (unsigned long) mismatches);
+
+    struct location_fixed *in = malloc(BENCH_SET_SIZE * sizeof(struct location_fixed));
+    ODID_Location_data *data = malloc(BENCH_SET_SIZE * sizeof(ODID_Location_data));
+    if (!in || !data) {
+        free(in);
+        free(data);
+        return -1;
+    }
+    for (int i = 0; i < BENCH_SET_SIZE; i++) {
+        random_location(&in[i], true);
+        location_fixed_to_data(&data[i], &in[i]);
+    }
+    time_reference(data, BENCH_SET_SIZE); // Warm up the caches
+    time_fixed(in, BENCH_SET_SIZE);
+    double reference_ns = time_reference(data, messages);
+    double fixed_ns = time_fixed(in, messages);
+    printf("encodeLocationMessage: %8.1f ns/message\n", reference_ns);
+    printf("encode_location_fixed: %8.1f ns/message (%.1fx)\n", fixed_ns, reference_ns / fixed_ns);
+    free(in);
+    free(data);
+    return mismatches == 0 ? 0 : -1;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _LOCATION_FIXED_H_
+#define _LOCATION_FIXED_H_
+
+#include <stdint.h>
+#include <opendroneid.h>
+
+#define LOCATION_FIXED_DEFAULT_MESSAGES 1000000
+
+// Valid input ranges, the same as accepted by encodeLocationMessage()
+#define LATITUDE_MAX_E7 900000000
+#define LONGITUDE_MAX_E7 1800000000
+#define ALTITUDE_MIN_DM (-10000)
+#define ALTITUDE_MAX_DM 317675 // 31767.5 m
+#define DIRECTION_MAX_CDEG 36000
+#define DIRECTION_UNKNOWN_CDEG 36100
+#define SPEED_H_MAX_CM_S 25425 // 254.25 m/s
+#define SPEED_H_UNKNOWN_CM_S 25500
+#define SPEED_H_MULT_0_MAX_CM_S 6375 // Highest speed encoded in steps of 0.25 m/s. 0.75 m/s above
+#define SPEED_V_MAX_CM_S 6200
+#define SPEED_V_UNKNOWN_CM_S 6300
+#define TIMESTAMP_MAX_DS (MAX_TIMESTAMP * 10)
+
+// Location data in integer units. The unknown values correspond to the ones of ODID_Location_data
+struct location_fixed {
+    uint8_t status;                 // ODID_status_t
+    uint8_t height_type;            // ODID_Height_reference_t
+    uint16_t direction_cdeg;        // 0.01 degrees, 0 - 36000. 36100 = unknown
+    uint16_t speed_horizontal_cm_s; // 0 - 25425. 25500 = unknown
+    int16_t speed_vertical_cm_s;    // -6200 - 6200. 6300 = unknown
+    int32_t latitude_e7;            // 1e-7 degrees
+    int32_t longitude_e7;
+    int32_t altitude_baro_dm;       // Decimetres, -10000 - 317675. -10000 = unknown
+    int32_t altitude_geo_dm;
+    int32_t height_dm;
+    uint16_t timestamp_ds;          // 0.1 seconds since the full hour, 0 - 36000. 0xFFFF = unknown
+    uint8_t horiz_accuracy;         // ODID_Horizontal_accuracy_t, see location_fixed_horiz_accuracy()
+    uint8_t vert_accuracy;          // ODID_Vertical_accuracy_t
+    uint8_t baro_accuracy;          // ODID_Vertical_accuracy_t
+    uint8_t speed_accuracy;         // ODID_Speed_accuracy_t
+    uint8_t ts_accuracy;            // ODID_Timestamp_accuracy_t
+};
+
+void location_fixed_init(void);
+uint8_t location_fixed_horiz_accuracy(uint32_t accuracy_cm);
+uint8_t location_fixed_vert_accuracy(uint32_t accuracy_cm);
+uint8_t location_fixed_speed_accuracy(uint32_t accuracy_cm_s);
+uint8_t location_fixed_ts_accuracy(uint32_t accuracy_ms);
+int encode_location_fixed(ODID_Location_encoded *out, const struct location_fixed *in);
+void location_fixed_to_data(ODID_Location_data *out, const struct location_fixed *in);
+int location_fixed_benchmark(int messages);
+
+#endif //_LOCATION_FIXED_H_
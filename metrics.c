@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "gpsmod.h"
+#include "compliance.h"
+#include "utils.h"
+
+/*
+ * Each thread that records metrics gets its own slot, which only that thread writes to. An update is
+ * a relaxed load and store, without read-modify-write instructions, locks or shared cache lines.
+ * The metrics server sums all slots when a client connects. If more threads than slots record
+ * metrics, the extra threads share the last slot and use atomic additions.
+ */
+
+const char *const transport_names[TRANSPORT_AMOUNT] = { "Wi-Fi Beacon", "Bluetooth", "Wi-Fi NAN" };
+const char *const transport_labels[TRANSPORT_AMOUNT] = { "beacon", "bluetooth", "nan" };
+
+static const struct {
+    const char *name;
+    const char *help;
+} histogram_info[METRICS_HISTOGRAM_AMOUNT] = {
+        { "odid_hci_command_rtt_seconds", "HCI command round-trip time until Command Complete or Command Status" },
+        { "odid_hostapd_update_skew_seconds", "Time between the first and the last interface finishing a Beacon update" },
+        { "odid_gps_fix_age_seconds", "Age of the GPS fix when the Location message is encoded" },
+        { "odid_gps_fix_to_air_seconds", "Time from reading a GPS fix until the transports have taken its Location" },
+        { "odid_scheduler_lateness_seconds", "Time a timed sleep in the transmit or NAN loop ended late" },
+        { "odid_auth_signing_seconds", "Time to sign a message set and encode the Auth pages" },
+        { "odid_auth_signature_lag_seconds", "Time from a changed message set until its signature is published" },
+};
+
+// SET vendor_elements + UPDATE_BEACON, labelled with the hostapd interface
+#define IFACE_HISTOGRAM_NAME "odid_hostapd_request_seconds"
+#define IFACE_HISTOGRAM_HELP "hostapd Beacon update latency per interface"
+
+// Upper bucket limits in microseconds. The last bucket is +Inf
+static const uint64_t bucket_limits_us[METRICS_HISTOGRAM_BUCKETS] = {
+        50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000
+};
+
+struct metrics_histogram_data {
+    _Atomic uint64_t buckets[METRICS_HISTOGRAM_BUCKETS + 1];
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t count;
+};
+
+struct metrics_slot {
+    _Atomic uint64_t frames[TRANSPORT_AMOUNT][METRICS_MESSAGE_TYPES];
+    _Atomic uint64_t wraps[ODID_MSG_COUNTER_AMOUNT];
+    struct metrics_histogram_data histograms[METRICS_HISTOGRAM_AMOUNT];
+    struct metrics_histogram_data iface_histograms[METRICS_MAX_IFACES];
+} __attribute__((aligned(64)));
+
+static struct metrics_slot slots[METRICS_MAX_THREADS];
+static _Atomic int slots_used = 0;
+static __thread struct metrics_slot *thread_slot = NULL;
+static __thread bool thread_slot_shared = false;
+
+static char iface_names[METRICS_MAX_IFACES][32]; // Set before the interface's first update
+
+static int listen_fd = -1;
+static pthread_t server_thread;
+static char socket_name[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+
+static inline struct metrics_slot *get_slot() {
+    if (!thread_slot) {
+        int index = atomic_fetch_add(&slots_used, 1);
+        if (index >= METRICS_MAX_THREADS - 1) {
+            index = METRICS_MAX_THREADS - 1;
+            thread_slot_shared = true;
+        }
+        thread_slot = &slots[index];
+    }
+    return thread_slot;
+}
+
+static inline void add(_Atomic uint64_t *value, uint64_t amount) {
+    if (thread_slot_shared)
+        atomic_fetch_add_explicit(value, amount, memory_order_relaxed);
+    else
+        atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + amount,
+                              memory_order_relaxed);
+}
+
+void metrics_frame_sent(enum transport transport, uint8_t message_type) {
+    add(&get_slot()->frames[transport][message_type & 0x0F], 1);
+}
+
+void metrics_counter_wrap(int counter) {
+    if (counter >= 0 && counter < ODID_MSG_COUNTER_AMOUNT)
+        add(&get_slot()->wraps[counter], 1);
+}
+
+static void observe(struct metrics_histogram_data *data, uint64_t value_ns) {
+    int bucket = 0;
+    while (bucket < METRICS_HISTOGRAM_BUCKETS && value_ns > bucket_limits_us[bucket] * 1000)
+        bucket++;
+    add(&data->buckets[bucket], 1);
+    add(&data->sum_ns, value_ns);
+    add(&data->count, 1);
+}
+
+void metrics_observe_ns(enum metrics_histogram histogram, uint64_t value_ns) {
+    observe(&get_slot()->histograms[histogram], value_ns);
+}
+
+// Names the latency series of a hostapd interface. Interfaces beyond METRICS_MAX_IFACES are not recorded
+void metrics_set_iface_name(int iface, const char *name) {
+    if (iface >= 0 && iface < METRICS_MAX_IFACES)
+        snprintf(iface_names[iface], sizeof(iface_names[iface]), "%s", name);
+}
+
+void metrics_observe_iface_ns(int iface, uint64_t value_ns) {
+    if (iface >= 0 && iface < METRICS_MAX_IFACES)
+        observe(&get_slot()->iface_histograms[iface], value_ns);
+}
+
+static uint64_t sum_slots(size_t offset) {
+    uint64_t sum = 0;
+    for (int i = 0; i < METRICS_MAX_THREADS; i++)
+        sum += atomic_load_explicit((_Atomic uint64_t *) ((char *) &slots[i] + offset), memory_order_relaxed);
+    return sum;
+}
+
+#define APPEND(...) do { \
+        if (length < size) \
+            length += snprintf(buf + length, size - length, __VA_ARGS__); \
+    } while (0)
+
+// The samples of one histogram, summed over the slots. labels is empty or e.g. iface="wlan0",
+static size_t format_histogram(char *buf, size_t size, const char *name, const char *labels, size_t base) {
+    size_t length = 0;
+    uint64_t cumulative = 0;
+    for (int b = 0; b <= METRICS_HISTOGRAM_BUCKETS; b++) {
+        cumulative += sum_slots(base + offsetof(struct metrics_histogram_data, buckets[b]));
+        if (b < METRICS_HISTOGRAM_BUCKETS)
+            APPEND("%s_bucket{%sle=\"%g\"} %lu\n", name, labels, bucket_limits_us[b] / 1e6,
+                   (unsigned long) cumulative);
+        else
+            APPEND("%s_bucket{%sle=\"+Inf\"} %lu\n", name, labels, (unsigned long) cumulative);
+    }
+    // The sum and count take the labels without the trailing comma
+    int label_length = labels[0] ? (int) strlen(labels) - 1 : 0;
+    APPEND("%s_sum%s%.*s%s %.9f\n", name, label_length ? "{" : "", label_length, labels, label_length ? "}" : "",
+           sum_slots(base + offsetof(struct metrics_histogram_data, sum_ns)) / 1e9);
+    APPEND("%s_count%s%.*s%s %lu\n", name, label_length ? "{" : "", label_length, labels, label_length ? "}" : "",
+           (unsigned long) sum_slots(base + offsetof(struct metrics_histogram_data, count)));
+    return MINIMUM(length, size);
+}
+
+static size_t format_metrics(char *buf, size_t size) {
+    static const char *const counter_labels[ODID_MSG_COUNTER_AMOUNT] = {
+            "basic_id", "location", "auth", "self_id", "system", "operator_id", "packed"
+    };
+    size_t length = 0;
+
+    APPEND("# HELP odid_frames_total Frames handed to each transport, by message type\n");
+    APPEND("# TYPE odid_frames_total counter\n");
+    for (int t = 0; t < TRANSPORT_AMOUNT; t++) {
+        for (int m = 0; m < METRICS_MESSAGE_TYPES; m++) {
+            uint64_t frames = sum_slots(offsetof(struct metrics_slot, frames[t][m]));
+            if (frames > 0)
+                APPEND("odid_frames_total{transport=\"%s\",message_type=\"%d\"} %lu\n",
+                       transport_labels[t], m, (unsigned long) frames);
+        }
+    }
+
+    APPEND("# HELP odid_message_counter_wraps_total Message counter wrap-arounds from 255 to 0\n");
+    APPEND("# TYPE odid_message_counter_wraps_total counter\n");
+    for (int c = 0; c < ODID_MSG_COUNTER_AMOUNT; c++)
+        APPEND("odid_message_counter_wraps_total{counter=\"%s\"} %lu\n", counter_labels[c],
+               (unsigned long) sum_slots(offsetof(struct metrics_slot, wraps[c])));
+
+    for (int h = 0; h < METRICS_HISTOGRAM_AMOUNT; h++) {
+        size_t base = offsetof(struct metrics_slot, histograms[h]);
+        APPEND("# HELP %s %s\n", histogram_info[h].name, histogram_info[h].help);
+        APPEND("# TYPE %s histogram\n", histogram_info[h].name);
+        if (length < size)
+            length += format_histogram(buf + length, size - length, histogram_info[h].name, "", base);
+    }
+
+    APPEND("# HELP %s %s\n", IFACE_HISTOGRAM_NAME, IFACE_HISTOGRAM_HELP);
+    APPEND("# TYPE %s histogram\n", IFACE_HISTOGRAM_NAME);
+    for (int i = 0; i < METRICS_MAX_IFACES; i++) {
+        if (!iface_names[i][0])
+            continue;
+        char labels[sizeof(iface_names[i]) + 16];
+        snprintf(labels, sizeof(labels), "iface=\"%.*s\",", (int) sizeof(iface_names[i]) - 1, iface_names[i]);
+        if (length < size)
+            length += format_histogram(buf + length, size - length, IFACE_HISTOGRAM_NAME, labels,
+                                       offsetof(struct metrics_slot, iface_histograms[i]));
+    }
+
+    APPEND("# HELP odid_gps_clock_offset_seconds System clock minus GPS time when fixes are read\n");
+    APPEND("# TYPE odid_gps_clock_offset_seconds gauge\n");
+    APPEND("odid_gps_clock_offset_seconds %.9f\n", gps_clock_offset_ns() / 1e9);
+
+    if (length < size)
+        length += compliance_format_metrics(buf + length, size - length);
+    return MINIMUM(length, size - 1);
+}
+
+// Serves one scrape per connection. HTTP requests, e.g. from curl --unix-socket, get an HTTP response
+static void serve_client(int fd) {
+    static char response[65536];
+    char request[512];
+    size_t length = 0;
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    ssize_t len = 0;
+    if (poll(&pfd, 1, 100) > 0)
+        len = read(fd, request, sizeof(request) - 1);
+    if (len >= 4 && memcmp(request, "GET ", 4) == 0)
+        length = snprintf(response, sizeof(response),
+                          "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n");
+    length += format_metrics(response + length, sizeof(response) - length);
+
+    for (size_t sent = 0; sent < length; ) {
+        ssize_t written = write(fd, response + sent, length - sent);
+        if (written <= 0)
+            break;
+        sent += written;
+    }
+    close(fd);
+}
+
+static void *metrics_server(void *arg) {
+    (void) arg;
+    while (true) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            break; // The socket was shut down
+        }
+        serve_client(fd);
+    }
+    return NULL;
+}
+
+int metrics_start(const char *socket_path) {
+    struct sockaddr_un addr = { 0 };
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("Error: The metrics socket path is too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    strcpy(socket_name, socket_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("Metrics socket open failed");
+        return -1;
+    }
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0) {
+        perror("Metrics socket bind failed");
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    if (pthread_create(&server_thread, NULL, metrics_server, NULL) != 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    printf("Serving metrics on %s\n", socket_path);
+    return 0;
+}
+
+void metrics_stop() {
+    if (listen_fd < 0)
+        return;
+    shutdown(listen_fd, SHUT_RDWR);
+    pthread_join(server_thread, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_name);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+
+#define METRICS_MAX_THREADS 32
+#define METRICS_MESSAGE_TYPES 16 // The 4-bit message type in the message header
+#define METRICS_HISTOGRAM_BUCKETS 14
+#define METRICS_MAX_IFACES 8 // hostapd interfaces with their own Beacon update latency series
+
+enum transport { TRANSPORT_BEACON, TRANSPORT_BLUETOOTH, TRANSPORT_NAN, TRANSPORT_AMOUNT };
+extern const char *const transport_names[TRANSPORT_AMOUNT];
+extern const char *const transport_labels[TRANSPORT_AMOUNT]; // Metric label values
+
+enum metrics_histogram {
+    METRICS_HCI_RTT,            // HCI command to Command Complete/Status event
+    METRICS_HOSTAPD_SKEW,       // First to last interface finishing the same Beacon update
+    METRICS_FIX_AGE,            // GPS fix arrival to Location encode
+    METRICS_FIX_TO_AIR,         // GPS fix arrival until the transports have taken its Location
+    METRICS_SCHEDULER_LATENESS, // Wake-up time after a timed sleep minus the requested time
+    METRICS_AUTH_SIGNING,       // Computing the Auth pages of one message set signature
+    METRICS_AUTH_SIGNATURE_LAG, // Message set handed to the signer until its signature is published
+    METRICS_HISTOGRAM_AMOUNT
+};
+
+void metrics_frame_sent(enum transport transport, uint8_t message_type);
+void metrics_counter_wrap(int counter);
+void metrics_observe_ns(enum metrics_histogram histogram, uint64_t value_ns);
+void metrics_set_iface_name(int iface, const char *name);
+void metrics_observe_iface_ns(int iface, uint64_t value_ns);
+
+int metrics_start(const char *socket_path);
+void metrics_stop(void);
+
+#endif //_METRICS_H_
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "realtime.h"
+
+/*
+ * The real-time mode keeps the transmit, HCI and GPS threads from being preempted by the rest of the
+ * system. All memory is locked once touched, so a page fault cannot stall the threads, and each of them
+ * pre-faults its stack when it starts. The wake-up latencies are recorded with and without the mode,
+ * so the summary at exit shows whether it helps on a given system.
+ */
+
+static const char *thread_names[REALTIME_THREAD_AMOUNT] = { "transmit", "hci", "gps" };
+
+static bool enabled = false;
+static int priority[REALTIME_THREAD_AMOUNT];
+static int cpu[REALTIME_THREAD_AMOUNT];
+static uint64_t deadline_ns = REALTIME_DEFAULT_DEADLINE_US * 1000ULL;
+
+static struct {
+    _Atomic uint64_t samples;
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t misses;
+} stats[REALTIME_THREAD_AMOUNT];
+
+int realtime_start(struct config_data *config) {
+    deadline_ns = (uint64_t) config->rt_deadline_us * 1000ULL;
+    if (!config->realtime)
+        return 0;
+
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    for (int i = 0; i < REALTIME_THREAD_AMOUNT; i++) {
+        if (config->rt_priority[i] < sched_get_priority_min(SCHED_FIFO) ||
+            config->rt_priority[i] > sched_get_priority_max(SCHED_FIFO)) {
+            printf("Error: Invalid SCHED_FIFO priority %d for the %s thread\n", config->rt_priority[i],
+                   thread_names[i]);
+            return -1;
+        }
+        if (config->rt_cpu[i] >= cpus || config->rt_cpu[i] >= CPU_SETSIZE) {
+            printf("Error: CPU %d for the %s thread does not exist\n", config->rt_cpu[i], thread_names[i]);
+            return -1;
+        }
+        priority[i] = config->rt_priority[i];
+        cpu[i] = config->rt_cpu[i];
+    }
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) != 0) {
+        perror("mlockall");
+        return -1;
+    }
+    enabled = true;
+    printf("Real-time mode: Memory locked. SCHED_FIFO priorities transmit %d, hci %d, gps %d\n",
+           priority[REALTIME_TRANSMIT], priority[REALTIME_HCI], priority[REALTIME_GPS]);
+    return 0;
+}
+
+// Touches the stack pages the thread is going to use, so they are faulted in and locked now
+static void __attribute__((noinline)) prefault_stack() {
+    volatile uint8_t stack[REALTIME_STACK_PREFAULT];
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < sizeof(stack); i += page_size)
+        stack[i] = 0;
+}
+
+// Called by a thread when it starts. Does nothing unless the real-time mode is enabled
+void realtime_thread(enum realtime_thread thread) {
+    if (!enabled)
+        return;
+    prefault_stack();
+
+    struct sched_param param = { .sched_priority = priority[thread] };
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0)
+        printf("Real-time mode: Unable to set SCHED_FIFO for the %s thread: %s\n", thread_names[thread],
+               strerror(error));
+
+    if (cpu[thread] >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu[thread], &set);
+        error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (error != 0)
+            printf("Real-time mode: Unable to pin the %s thread to CPU %d: %s\n", thread_names[thread],
+                   cpu[thread], strerror(error));
+    }
+}
+
+// Records how late a thread woke up or how long it took to handle an event. Longer than the deadline is a miss
+void realtime_latency(enum realtime_thread thread, uint64_t latency_ns) {
+    atomic_fetch_add_explicit(&stats[thread].samples, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats[thread].sum_ns, latency_ns, memory_order_relaxed);
+    uint64_t max_ns = atomic_load_explicit(&stats[thread].max_ns, memory_order_relaxed);
+    while (latency_ns > max_ns &&
+           !atomic_compare_exchange_weak_explicit(&stats[thread].max_ns, &max_ns, latency_ns,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+    if (latency_ns > deadline_ns)
+        atomic_fetch_add_explicit(&stats[thread].misses, 1, memory_order_relaxed);
+}
+
+void realtime_stop() {
+    for (int i = 0; i < REALTIME_THREAD_AMOUNT; i++) {
+        uint64_t samples = atomic_load(&stats[i].samples);
+        if (samples == 0)
+            continue;
+        printf("Scheduling (%s%s): %lu samples, latency avg %.3f ms, max %.3f ms, %lu deadline misses (> %.3f ms)\n",
+               thread_names[i], enabled ? ", SCHED_FIFO" : "", (unsigned long) samples,
+               (double) atomic_load(&stats[i].sum_ns) / samples / 1e6, (double) atomic_load(&stats[i].max_ns) / 1e6,
+               (unsigned long) atomic_load(&stats[i].misses), (double) deadline_ns / 1e6);
+    }
+    if (enabled)
+        munlockall();
+}
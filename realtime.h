@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _REALTIME_H_
+#define _REALTIME_H_
+
+#include <stdint.h>
+#include "utils.h"
+
+#define REALTIME_STACK_PREFAULT (256 * 1024) // Stack bytes touched by each real-time thread at start
+#define REALTIME_DEFAULT_DEADLINE_US 1000
+#define REALTIME_DEFAULT_TRANSMIT_PRIORITY 50
+#define REALTIME_DEFAULT_HCI_PRIORITY 60
+#define REALTIME_DEFAULT_GPS_PRIORITY 55
+
+int realtime_start(struct config_data *config);
+void realtime_thread(enum realtime_thread thread);
+void realtime_latency(enum realtime_thread thread, uint64_t latency_ns);
+void realtime_stop(void);
+
+#endif //_REALTIME_H_
@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "replay.h"
+#include "gpsd_client.h"
+#include "utils.h"
+#include "vclock.h"
+
+/*
+ * The whole log is parsed into memory before the replay starts, so that file I/O and parsing do not
+ * disturb the timing. Supported formats, selected by the file extension:
+ *     .csv = A header line naming the columns, followed by one fix per line. Recognized columns are
+ *            time (ISO 8601 or seconds), lat, lon, alt, speed, track and climb
+ *     .gpx = Track points with lat and lon attributes and optional ele, time, speed and course elements
+ *     Other = gpsd JSON, e.g. recorded with gpspipe -w. Only TPV reports are used
+ * Speed, track and climb are derived from consecutive positions when the log does not contain them.
+ */
+
+#define EARTH_RADIUS_M 6378137.0
+#define DEG_TO_RAD (M_PI / 180.0)
+
+enum csv_column { CSV_IGNORE, CSV_TIME, CSV_LAT, CSV_LON, CSV_ALT, CSV_SPEED, CSV_TRACK, CSV_CLIMB };
+#define CSV_MAX_COLUMNS 32
+
+static char *read_file(const char *path, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *text = size >= 0 ? malloc(size + 1) : NULL;
+    if (!text || fread(text, 1, size, file) != (size_t) size) {
+        free(text);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    text[size] = '\0';
+    *length = size;
+    return text;
+}
+
+static void init_fix(struct gps_fix_t *fix) {
+    memset(fix, 0, sizeof(*fix));
+    fix->latitude = fix->longitude = fix->altitude = fix->altHAE = fix->altMSL = NAN;
+    fix->track = fix->speed = fix->climb = NAN;
+    fix->ept = fix->epx = fix->epy = fix->epv = fix->eps = fix->epd = fix->epc = fix->eph = fix->sep = NAN;
+}
+
+static int64_t fix_time_ns(const struct gps_fix_t *fix) {
+    return (int64_t) fix->time.tv_sec * 1000000000LL + fix->time.tv_nsec;
+}
+
+static int append_fix(struct replay *replay, struct gps_fix_t *fix, size_t *capacity) {
+    if (!isfinite(fix->latitude) || !isfinite(fix->longitude))
+        return 0;
+    if (fix->mode < MODE_2D)
+        fix->mode = isfinite(fix->altitude) || isfinite(fix->altMSL) ? MODE_3D : MODE_2D;
+
+    // Records going back in time cannot be scheduled and are dropped
+    if (replay->count > 0 && fix_time_ns(fix) < fix_time_ns(&replay->fixes[replay->count - 1]))
+        return 0;
+
+    if (replay->count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 256;
+        struct gps_fix_t *fixes = realloc(replay->fixes, new_capacity * sizeof(*fixes));
+        if (!fixes)
+            return -1;
+        replay->fixes = fixes;
+        *capacity = new_capacity;
+    }
+    replay->fixes[replay->count++] = *fix;
+    return 0;
+}
+
+static void parse_time_field(const char *str, size_t length, struct timespec *ts) {
+    if (memchr(str, 'T', length)) {
+        gpsd_parse_time(str, length, ts);
+    } else {
+        double seconds = strtod(str, NULL);
+        ts->tv_sec = (time_t) seconds;
+        ts->tv_nsec = (long) ((seconds - (double) ts->tv_sec) * 1e9);
+    }
+}
+
+static enum csv_column csv_column_type(const char *name, size_t length) {
+    static const struct { const char *name; enum csv_column column; } names[] = {
+            { "time", CSV_TIME }, { "lat", CSV_LAT }, { "latitude", CSV_LAT }, { "lon", CSV_LON },
+            { "longitude", CSV_LON }, { "alt", CSV_ALT }, { "altitude", CSV_ALT }, { "speed", CSV_SPEED },
+            { "track", CSV_TRACK }, { "course", CSV_TRACK }, { "climb", CSV_CLIMB }, { NULL, CSV_IGNORE }
+    };
+    while (length > 0 && (*name == ' ' || *name == '"')) {
+        name++;
+        length--;
+    }
+    while (length > 0 && (name[length - 1] == ' ' || name[length - 1] == '"' || name[length - 1] == '\r'))
+        length--;
+    for (int i = 0; names[i].name; i++) {
+        if (strlen(names[i].name) == length && strncasecmp(name, names[i].name, length) == 0)
+            return names[i].column;
+    }
+    return CSV_IGNORE;
+}
+
+static int parse_csv(struct replay *replay, char *text) {
+    enum csv_column columns[CSV_MAX_COLUMNS] = { CSV_IGNORE };
+    int column_count = 0;
+    size_t capacity = 0;
+    char *line = text, *next;
+
+    for (; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        if (*line == '#' || *line == '\0' || *line == '\r')
+            continue;
+
+        // The first line names the columns
+        if (column_count == 0) {
+            bool has_time = false;
+            for (char *field = line; field && column_count < CSV_MAX_COLUMNS; column_count++) {
+                char *comma = strchr(field, ',');
+                columns[column_count] = csv_column_type(field, comma ? (size_t) (comma - field) : strlen(field));
+                has_time |= columns[column_count] == CSV_TIME;
+                field = comma ? comma + 1 : NULL;
+            }
+            if (!has_time) {
+                printf("Error: The CSV replay log has no time column\n");
+                return -1;
+            }
+            continue;
+        }
+
+        struct gps_fix_t fix;
+        init_fix(&fix);
+        char *field = line;
+        for (int i = 0; field && i < column_count; i++) {
+            char *comma = strchr(field, ',');
+            size_t length = comma ? (size_t) (comma - field) : strlen(field);
+            if (length > 0) {
+                switch (columns[i]) {
+                    case CSV_TIME: parse_time_field(field, length, &fix.time); break;
+                    case CSV_LAT: fix.latitude = strtod(field, NULL); break;
+                    case CSV_LON: fix.longitude = strtod(field, NULL); break;
+                    case CSV_ALT: fix.altitude = strtod(field, NULL); break;
+                    case CSV_SPEED: fix.speed = strtod(field, NULL); break;
+                    case CSV_TRACK: fix.track = strtod(field, NULL); break;
+                    case CSV_CLIMB: fix.climb = strtod(field, NULL); break;
+                    default: break;
+                }
+            }
+            field = comma ? comma + 1 : NULL;
+        }
+        if (append_fix(replay, &fix, &capacity) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Returns the text between <tag> and </tag> within [start, end), or NULL
+static const char *gpx_element(const char *start, const char *end, const char *tag, size_t *length) {
+    char open[32], close[32];
+    snprintf(open, sizeof(open), "<%s>", tag);
+    snprintf(close, sizeof(close), "</%s>", tag);
+
+    // Bounded, so an element missing from one point does not scan the rest of the file
+    const char *value = memmem(start, end - start, open, strlen(open));
+    if (!value)
+        return NULL;
+    value += strlen(open);
+    const char *value_end = memmem(value, end - value, close, strlen(close));
+    if (!value_end)
+        return NULL;
+    *length = value_end - value;
+    return value;
+}
+
+// The value of name="..." within the tag [start, end). The attributes may be separated by any whitespace
+static double gpx_attribute(const char *start, const char *end, const char *name) {
+    size_t name_length = strlen(name);
+    for (const char *p = start; (p = memmem(p, end - p, name, name_length)); p += name_length) {
+        if (p == start || !isspace((unsigned char) p[-1]))
+            continue;
+        const char *value = p + name_length;
+        while (value < end && isspace((unsigned char) *value))
+            value++;
+        if (value >= end || *value++ != '=')
+            continue;
+        while (value < end && isspace((unsigned char) *value))
+            value++;
+        if (value < end && (*value == '"' || *value == '\''))
+            return strtod(value + 1, NULL);
+    }
+    return NAN;
+}
+
+static int parse_gpx(struct replay *replay, const char *text) {
+    size_t capacity = 0, length;
+    const char *point = text, *value;
+
+    while ((point = strstr(point, "<trkpt"))) {
+        const char *tag_end = strchr(point, '>');
+        if (!tag_end)
+            break;
+        const char *end = tag_end[-1] == '/' ? tag_end : strstr(tag_end, "</trkpt>");
+        if (!end)
+            break;
+
+        struct gps_fix_t fix;
+        init_fix(&fix);
+        fix.latitude = gpx_attribute(point, tag_end, "lat");
+        fix.longitude = gpx_attribute(point, tag_end, "lon");
+        if ((value = gpx_element(tag_end, end, "ele", &length)))
+            fix.altitude = strtod(value, NULL);
+        if ((value = gpx_element(tag_end, end, "time", &length)))
+            gpsd_parse_time(value, length, &fix.time);
+        if ((value = gpx_element(tag_end, end, "speed", &length)))
+            fix.speed = strtod(value, NULL);
+        if ((value = gpx_element(tag_end, end, "course", &length)))
+            fix.track = strtod(value, NULL);
+        if (append_fix(replay, &fix, &capacity) != 0)
+            return -1;
+        point = end;
+    }
+    return 0;
+}
+
+static int parse_gpsd_json(struct replay *replay, char *text) {
+    size_t capacity = 0;
+    char *line = text, *next;
+
+    for (; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+
+        struct gps_fix_t fix;
+        if (gpsd_parse_tpv(line, strlen(line), &fix) <= 0 || fix.mode < MODE_2D)
+            continue;
+        if (append_fix(replay, &fix, &capacity) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Fills in speed, track and climb from the previous position where the log does not contain them
+static void derive_motion(struct replay *replay) {
+    for (size_t i = 1; i < replay->count; i++) {
+        struct gps_fix_t *previous = &replay->fixes[i - 1], *fix = &replay->fixes[i];
+        double dt = (double) (fix_time_ns(fix) - fix_time_ns(previous)) / 1e9;
+        if (dt <= 0)
+            continue;
+
+        double north = (fix->latitude - previous->latitude) * DEG_TO_RAD * EARTH_RADIUS_M;
+        double east = (fix->longitude - previous->longitude) * DEG_TO_RAD * EARTH_RADIUS_M *
+                      cos(fix->latitude * DEG_TO_RAD);
+        if (!isfinite(fix->speed))
+            fix->speed = sqrt(north * north + east * east) / dt;
+        if (!isfinite(fix->track)) {
+            fix->track = atan2(east, north) / DEG_TO_RAD;
+            if (fix->track < 0)
+                fix->track += 360;
+        }
+        if (!isfinite(fix->climb) && isfinite(fix->altitude) && isfinite(previous->altitude))
+            fix->climb = (fix->altitude - previous->altitude) / dt;
+    }
+    if (replay->count > 1) {
+        struct gps_fix_t *first = &replay->fixes[0], *second = &replay->fixes[1];
+        if (!isfinite(first->speed))
+            first->speed = second->speed;
+        if (!isfinite(first->track))
+            first->track = second->track;
+        if (!isfinite(first->climb))
+            first->climb = second->climb;
+    }
+}
+
+int replay_open(struct replay *replay, const char *path, double warp) {
+    memset(replay, 0, sizeof(*replay));
+    replay->warp = warp;
+    sem_init(&replay->fix_ready, 0, 0);
+    sem_init(&replay->fix_consumed, 0, 0);
+
+    size_t length;
+    char *text = read_file(path, &length);
+    if (!text) {
+        printf("Error: Unable to read the replay log %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    const char *extension = strrchr(path, '.');
+    int ret;
+    if (extension && strcasecmp(extension, ".csv") == 0)
+        ret = parse_csv(replay, text);
+    else if (extension && strcasecmp(extension, ".gpx") == 0)
+        ret = parse_gpx(replay, text);
+    else
+        ret = parse_gpsd_json(replay, text);
+    free(text);
+
+    if (ret != 0 || replay->count == 0) {
+        printf("Error: No fixes found in the replay log %s\n", path);
+        free(replay->fixes);
+        replay->fixes = NULL;
+        replay->count = 0;
+        return -1;
+    }
+    derive_motion(replay);
+
+    printf("Replaying %zu fixes spanning %.1f s from %s ", replay->count,
+           (double) (fix_time_ns(&replay->fixes[replay->count - 1]) - fix_time_ns(&replay->fixes[0])) / 1e9, path);
+    if (warp > 0)
+        printf("at %gx speed\n", warp);
+    else
+        printf("as fast as possible\n");
+    return 0;
+}
+
+/*
+ * Waits until the next fix is due and copies it to gpsdata. The fix time is replaced by the current time,
+ * so that the Location timestamp and the latency measurements relate to the replay rather than the
+ * recording. Returns 1 for a new fix and 0 when the log has ended.
+ */
+int replay_next(struct replay *replay, struct gps_data_t *gpsdata) {
+    if (replay->next >= replay->count || replay->finished)
+        return 0;
+
+    if (replay->next == 0)
+        replay->start_ns = get_time_ns();
+
+    if (replay->warp > 0) {
+        int64_t offset_ns = fix_time_ns(&replay->fixes[replay->next]) - fix_time_ns(&replay->fixes[0]);
+        vclock_sleep_until(replay->start_ns + (uint64_t) ((double) offset_ns / replay->warp));
+    } else {
+        // The transmit loop asks for the next fix when it has sent the previous one
+        while (vclock_sem_wait(&replay->fix_consumed, VCLOCK_FOREVER) != 0 && errno == EINTR)
+            ;
+        if (replay->finished)
+            return 0;
+    }
+
+    gpsdata->fix = replay->fixes[replay->next++];
+    int64_t now_ns = vclock_realtime_ns();
+    gpsdata->fix.time.tv_sec = (time_t) (now_ns / 1000000000LL);
+    gpsdata->fix.time.tv_nsec = (long) (now_ns % 1000000000LL);
+    return 1;
+}
+
+// Called by the replay thread when the fix returned by replay_next() has been applied to the UAS data
+void replay_fix_ready(struct replay *replay) {
+    if (replay->warp <= 0)
+        vclock_sem_post(&replay->fix_ready);
+}
+
+/*
+ * Called by the transmit loop instead of sleeping when replaying as fast as possible. The log timestamps
+ * are ignored and each transmission waits for the next fix. With a time warp, the transmit loop sleeps as
+ * usual and is woken by each replayed fix. Returns -1 when the replay has ended.
+ */
+int replay_wait_fix(struct replay *replay) {
+    if (replay->finished)
+        return -1;
+
+    vclock_sem_post(&replay->fix_consumed);
+    while (vclock_sem_wait(&replay->fix_ready, VCLOCK_FOREVER) != 0 && errno == EINTR)
+        ;
+    return replay->finished ? -1 : 0;
+}
+
+// Releases both sides of the handshake. Called when the replay has ended or the program is stopping
+void replay_finish(struct replay *replay) {
+    replay->finished = true;
+    vclock_sem_post(&replay->fix_ready);
+    vclock_sem_post(&replay->fix_consumed);
+}
+
+void replay_close(struct replay *replay) {
+    sem_destroy(&replay->fix_ready);
+    sem_destroy(&replay->fix_consumed);
+    free(replay->fixes);
+    replay->fixes = NULL;
+    replay->count = 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include "gpsd/gpsd-dev/include/libgps.h"
+
+#define REPLAY_DEFAULT_WARP 1.0
+
+// Position source replaying a recorded flight log (CSV, GPX or gpsd JSON) at a multiple of real time
+struct replay {
+    struct gps_fix_t *fixes; // Sorted by time. The time is the original fix time from the log
+    size_t count;
+    size_t next;
+    double warp;             // 0 = as fast as possible, paced by the transmit loop
+    uint64_t start_ns;       // CLOCK_MONOTONIC time the first fix was replayed
+
+    // Handshake with the transmit loop when replaying as fast as possible
+    sem_t fix_ready;
+    sem_t fix_consumed;
+    _Atomic bool finished;
+};
+
+int replay_open(struct replay *replay, const char *path, double warp);
+int replay_next(struct replay *replay, struct gps_data_t *gpsdata);
+void replay_fix_ready(struct replay *replay);
+int replay_wait_fix(struct replay *replay);
+void replay_finish(struct replay *replay);
+void replay_close(struct replay *replay);
+
+#endif //_REPLAY_H_
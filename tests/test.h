@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Each test is a program that checks one module and exits with EXIT_FAILURE if any check failed
+static int test_failures = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            printf("%s:%d: Check failed: %s\n", __FILE__, __LINE__, #condition); \
+            test_failures++; \
+        } \
+    } while (0)
+
+static inline int test_result(void) {
+    printf("%s\n", test_failures ? "FAILED" : "PASSED");
+    return test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif //_TEST_H_
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "test.h"
+#include "alloc_guard.h"
+
+/*
+ * Checks that the guard reports the allocations made after it was armed, except those of exempt threads,
+ * and that it fails when it was never armed. The allocations go through a volatile pointer, so the
+ * compiler cannot drop a malloc() and free() pair.
+ */
+
+static void *volatile pointer;
+static sem_t start, done;
+
+static void allocate() {
+    pointer = malloc(64);
+    free(pointer);
+    pointer = calloc(4, 16);
+    pointer = realloc(pointer, 256);
+    free(pointer);
+}
+
+// Like the signing thread, which allocates in OpenSSL for every signature
+static void *exempt_loop(void *arg) {
+    (void) arg;
+    alloc_guard_exempt_thread();
+    sem_wait(&start);
+    allocate();
+    sem_post(&done);
+    return NULL;
+}
+
+int main() {
+    // The buffer of stdout is allocated on the first print
+    printf("Alloc guard test\n");
+    CHECK(alloc_guard_finish() == -1);
+
+    sem_init(&start, 0, 0);
+    sem_init(&done, 0, 0);
+    pthread_t thread;
+    pthread_create(&thread, NULL, exempt_loop, NULL);
+
+    alloc_guard_arm();
+    sem_post(&start);
+    sem_wait(&done);
+    CHECK(alloc_guard_finish() == 0);
+    pthread_join(thread, NULL);
+
+    // Not counted while disarmed
+    allocate();
+    alloc_guard_arm();
+    allocate();
+    CHECK(alloc_guard_finish() == -1);
+
+    sem_destroy(&start);
+    sem_destroy(&done);
+    return test_result();
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "test.h"
+#include "gpsmod.h"
+#include "utils.h"
+#include "vclock.h"
+
+/*
+ * Checks the position extrapolation of gps_predict_location(). The test runs on the simulated clock, so
+ * the fix age is exact: a fix is applied the way the GPS thread does it, the clock is moved on and the
+ * predicted Location is compared with the distance flown in that time.
+ */
+
+#define EARTH_RADIUS_M 6378137.0
+#define DEG_TO_RAD (M_PI / 180.0)
+
+static struct ODID_UAS_Data uasData;
+
+static void apply_fix(int mode, double speed, double track, double climb, int64_t fix_time_ns) {
+    struct gps_data_t gpsdata;
+    memset(&gpsdata, 0, sizeof(gpsdata));
+    gpsdata.fix.mode = mode;
+    gpsdata.fix.latitude = 51.4791;
+    gpsdata.fix.longitude = -0.0013;
+    gpsdata.fix.altMSL = 100.0;
+    gpsdata.fix.altitude = gpsdata.fix.altHAE = NAN;
+    gpsdata.fix.speed = speed;
+    gpsdata.fix.track = track;
+    gpsdata.fix.climb = climb;
+    gpsdata.fix.eph = gpsdata.fix.epv = gpsdata.fix.eps = NAN;
+    gpsdata.fix.time.tv_sec = (time_t) (fix_time_ns / 1000000000LL);
+    gpsdata.fix.time.tv_nsec = (long) (fix_time_ns % 1000000000LL);
+    process_gps_data(&gpsdata, &uasData);
+    gps_fix_received(&gpsdata, &uasData, get_time_ns());
+}
+
+// Metres north and east of the fix position
+static void offset_m(const ODID_Location_data *location, double *north, double *east) {
+    *north = (location->Latitude - uasData.Location.Latitude) * DEG_TO_RAD * EARTH_RADIUS_M;
+    *east = (location->Longitude - uasData.Location.Longitude) * DEG_TO_RAD * EARTH_RADIUS_M *
+            cos(uasData.Location.Latitude * DEG_TO_RAD);
+}
+
+static float timestamp_since_hour(int64_t time_ns) {
+    return (float) ((time_ns % (3600 * 1000000000LL) / 100000000LL) / 10.0);
+}
+
+static bool near(double value, double expected, double tolerance) {
+    return fabs(value - expected) <= tolerance;
+}
+
+int main() {
+    vclock_simulate();
+    memset(&uasData, 0, sizeof(uasData));
+    // Start on a whole second of CLOCK_REALTIME, so the fix times are exact
+    vclock_sleep_ns(1000000000ULL - (uint64_t) (vclock_realtime_ns() % 1000000000LL));
+    int64_t fix_ns = vclock_realtime_ns();
+    double north, east;
+
+    // 10 m/s east, climbing at 2 m/s. Predicted 500 ms after the fix time
+    apply_fix(MODE_3D, 10.0, 90.0, 2.0, fix_ns);
+    vclock_sleep_ns(500000000ULL);
+    ODID_Location_data location = uasData.Location;
+    gps_predict_location(&location, 1000);
+    offset_m(&location, &north, &east);
+    CHECK(near(north, 0, 1e-6) && near(east, 5.0, 1e-3));
+    CHECK(near(location.AltitudeGeo, 101.0, 1e-4) && near(location.AltitudeBaro, 101.0, 1e-4));
+    CHECK(location.TimeStamp == timestamp_since_hour(fix_ns + 500000000LL));
+    // Only the copy changes
+    CHECK(uasData.Location.AltitudeGeo == 100.0f && uasData.Location.TimeStamp == timestamp_since_hour(fix_ns));
+
+    // The extrapolation stops at the maximum age
+    vclock_sleep_ns(2000000000ULL);
+    location = uasData.Location;
+    gps_predict_location(&location, 1000);
+    offset_m(&location, &north, &east);
+    CHECK(near(east, 10.0, 1e-3) && near(location.AltitudeGeo, 102.0, 1e-4));
+    CHECK(location.TimeStamp == timestamp_since_hour(fix_ns + 1000000000LL));
+
+    // North-west at 20 m/s, 250 ms
+    fix_ns = vclock_realtime_ns();
+    apply_fix(MODE_3D, 20.0, 315.0, 0.0, fix_ns);
+    vclock_sleep_ns(250000000ULL);
+    location = uasData.Location;
+    gps_predict_location(&location, 1000);
+    offset_m(&location, &north, &east);
+    CHECK(near(north, 5.0 * M_SQRT1_2, 1e-3) && near(east, -5.0 * M_SQRT1_2, 1e-3));
+    CHECK(near(location.AltitudeGeo, 100.0, 1e-4));
+
+    // Without a fix time, the age is counted from when the fix was read
+    apply_fix(MODE_3D, 10.0, 0.0, NAN, 0);
+    vclock_sleep_ns(300000000ULL);
+    location = uasData.Location;
+    gps_predict_location(&location, 1000);
+    offset_m(&location, &north, &east);
+    CHECK(near(north, 3.0, 1e-3) && near(east, 0, 1e-6));
+
+    // So it is when the fix time is far off the system clock
+    apply_fix(MODE_3D, 10.0, 0.0, NAN, vclock_realtime_ns() - 20 * 1000000000LL);
+    vclock_sleep_ns(400000000ULL);
+    location = uasData.Location;
+    gps_predict_location(&location, 1000);
+    offset_m(&location, &north, &east);
+    CHECK(near(north, 4.0, 1e-3));
+
+    // A 2D fix has no climb rate
+    fix_ns = vclock_realtime_ns();
+    apply_fix(MODE_2D, 10.0, 180.0, 5.0, fix_ns);
+    vclock_sleep_ns(100000000ULL);
+    location = uasData.Location;
+    gps_predict_location(&location, 1000);
+    offset_m(&location, &north, &east);
+    CHECK(near(north, -1.0, 1e-3) && location.AltitudeGeo == uasData.Location.AltitudeGeo);
+
+    // Without a speed, the Location is left as it is
+    apply_fix(MODE_3D, NAN, 90.0, 0.0, vclock_realtime_ns());
+    vclock_sleep_ns(500000000ULL);
+    location = uasData.Location;
+    gps_predict_location(&location, 1000);
+    CHECK(memcmp(&location, &uasData.Location, sizeof(location)) == 0);
+
+    return test_result();
+}
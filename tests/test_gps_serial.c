@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "test.h"
+#include "gps_serial.h"
+
+/*
+ * Plays receiver output into a pty and reads it back through the serial position source, the way it
+ * reads a GPS receiver. The NMEA stream is taken from a file (tests/data/nmea_epochs.nmea: one epoch
+ * without a fix, then ten epochs of RMC, VTG, GGA, GSA and GST, with a broken checksum in the fifth GGA).
+ * It is written in chunks of varying size, so sentences are split across reads. Each epoch must give one
+ * fix. The UBX NAV-PVT frames are generated here, together with frames that must be ignored.
+ */
+
+#define BASE_TIME_S 1621339200 // 2021-05-18T12:00:00Z
+#define UBX_FRAMES 5
+
+struct writer {
+    int fd;
+    const uint8_t *data;
+    size_t length;
+    uint64_t frame_written_ns[UBX_FRAMES]; // When the rest of each NAV-PVT frame was written
+};
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_all(int fd, const uint8_t *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written <= 0)
+            return;
+        data += written;
+        length -= written;
+    }
+}
+
+static void *nmea_writer(void *arg) {
+    struct writer *writer = arg;
+    size_t offset = 0;
+    for (int i = 0; offset < writer->length; i++) {
+        size_t chunk = 7 + (i * 13) % 58;
+        if (chunk > writer->length - offset)
+            chunk = writer->length - offset;
+        write_all(writer->fd, writer->data + offset, chunk);
+        offset += chunk;
+        usleep(500);
+    }
+    return NULL;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t) (value >> (8 * i));
+}
+
+static size_t ubx_frame(uint8_t *frame, uint8_t class, uint8_t id, const uint8_t *payload, size_t length) {
+    frame[0] = 0xB5;
+    frame[1] = 0x62;
+    frame[2] = class;
+    frame[3] = id;
+    frame[4] = (uint8_t) length;
+    frame[5] = (uint8_t) (length >> 8);
+    memcpy(&frame[6], payload, length);
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = 2; i < 6 + length; i++) {
+        ck_a += frame[i];
+        ck_b += ck_a;
+    }
+    frame[6 + length] = ck_a;
+    frame[7 + length] = ck_b;
+    return 8 + length;
+}
+
+// NAV-PVT of a 3D fix, moving north-east and sinking. The last one has a negative nano second correction
+static size_t nav_pvt(uint8_t *frame, int index) {
+    uint8_t payload[92] = { 0 };
+    payload[4] = 2021 & 0xFF;
+    payload[5] = 2021 >> 8;
+    payload[6] = 5;
+    payload[7] = 18;
+    payload[8] = 12;
+    payload[10] = (uint8_t) (30 + index);
+    payload[11] = 0x07; // validDate, validTime, fullyResolved
+    put_u32(&payload[16], (uint32_t) (index == UBX_FRAMES - 1 ? -5000000 : 200000000));
+    payload[20] = 3;    // 3D fix
+    payload[21] = 0x01; // gnssFixOK
+    put_u32(&payload[24], (uint32_t) (-13000 + index));   // lon 1e-7 deg
+    put_u32(&payload[28], (uint32_t) (514791000 + index)); // lat 1e-7 deg
+    put_u32(&payload[32], 102300 + index * 100);          // height above ellipsoid mm
+    put_u32(&payload[36], 55300 + index * 100);           // height above mean sea level mm
+    put_u32(&payload[40], 1500);                          // hAcc mm
+    put_u32(&payload[44], 2500);                          // vAcc mm
+    put_u32(&payload[56], 500);                           // velD mm/s
+    put_u32(&payload[60], 5144);                          // gSpeed mm/s
+    put_u32(&payload[64], 4500000);                       // headMot 1e-5 deg
+    put_u32(&payload[68], 300);                           // sAcc mm/s
+    return ubx_frame(frame, 0x01, 0x07, payload, sizeof(payload));
+}
+
+static void *ubx_writer(void *arg) {
+    struct writer *writer = arg;
+    uint8_t frame[8 + 92];
+    uint8_t other[8 + 16] = { 0 };
+    const char *gsa = "$GNGSA,A,3,05,12,15,18,20,24,25,29,,,,,1.60,0.90,1.30*13\r\n";
+    for (int i = 0; i < UBX_FRAMES; i++) {
+        // Ignored: NAV-STATUS, NMEA without a fix and a NAV-PVT with a broken checksum
+        write_all(writer->fd, other, ubx_frame(other, 0x01, 0x03, (const uint8_t *) "0123456789abcdef", 16));
+        write_all(writer->fd, (const uint8_t *) gsa, strlen(gsa));
+        size_t length = nav_pvt(frame, i);
+        frame[length - 1] ^= 0xFF;
+        write_all(writer->fd, frame, length);
+
+        length = nav_pvt(frame, i);
+        write_all(writer->fd, frame, length / 3);
+        usleep(1000);
+        writer->frame_written_ns[i] = monotonic_ns();
+        write_all(writer->fd, frame + length / 3, length - length / 3);
+        usleep(10000);
+    }
+    return NULL;
+}
+
+// Reads fixes until the writer has been quiet for a while. Records when each fix was read
+static int read_fixes(struct gps_serial *serial, struct gps_data_t *gpsdata, uint64_t *read_ns, int max) {
+    struct pollfd pfd = { .fd = serial->fd, .events = POLLIN };
+    int fixes = 0;
+    while (poll(&pfd, 1, 500) > 0) {
+        int result = gps_serial_read(serial, gpsdata);
+        if (result < 0)
+            break;
+        for (int i = 0; i < result; i++) {
+            if (read_ns && fixes < max)
+                read_ns[fixes] = monotonic_ns();
+            fixes++;
+        }
+    }
+    return fixes;
+}
+
+// Appends the checksum to the sentence body between '$' and '*'
+static size_t nmea_sentence(uint8_t *buf, size_t size, const char *body) {
+    uint8_t checksum = 0;
+    for (const char *p = body; *p; p++)
+        checksum ^= (uint8_t) *p;
+    return (size_t) snprintf((char *) buf, size, "$%s*%02X\r\n", body, checksum);
+}
+
+static bool near(double value, double expected, double tolerance) {
+    return fabs(value - expected) <= tolerance;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <NMEA stream file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    static uint8_t nmea[16384];
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    size_t nmea_length = fread(nmea, 1, sizeof(nmea), file);
+    fclose(file);
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("pty");
+        return EXIT_FAILURE;
+    }
+    struct gps_serial serial;
+    CHECK(gps_serial_open(&serial, ptsname(master), 115200) == 0);
+
+    struct gps_data_t gpsdata;
+    memset(&gpsdata, 0, sizeof(gpsdata));
+    struct writer writer = { .fd = master, .data = nmea, .length = nmea_length };
+    pthread_t thread;
+    pthread_create(&thread, NULL, nmea_writer, &writer);
+    int fixes = read_fixes(&serial, &gpsdata, NULL, 0);
+    pthread_join(thread, NULL);
+
+    // One fix per epoch, also for the one with the broken GGA. The no-fix epoch gives none
+    CHECK(fixes == 10);
+    struct gps_fix_t *fix = &gpsdata.fix;
+    CHECK(fix->mode == MODE_3D);
+    CHECK(fix->time.tv_sec == BASE_TIME_S + 20 && fix->time.tv_nsec == 0);
+    CHECK(near(fix->latitude, 51 + 28.846 / 60, 1e-9));
+    CHECK(near(fix->longitude, -7.8 / 60, 1e-9));
+    CHECK(near(fix->altMSL, 55.3, 1e-9) && near(fix->sep, 47.0, 1e-9) && near(fix->altHAE, 102.3, 1e-9));
+    CHECK(near(fix->speed, 18.52 / 3.6, 1e-9)); // From the VTG that follows the RMC
+    CHECK(near(fix->track, 90.0, 1e-9));
+    CHECK(near(fix->epx, 0.6, 1e-9) && near(fix->epy, 0.8, 1e-9) && near(fix->eph, 1.0, 1e-9));
+    CHECK(near(fix->epv, 1.5, 1e-9));
+
+    // An epoch without GST is completed when the next one starts, without the accuracy of the one before
+    static const char *const next_epochs[] = {
+            "GNRMC,120021.00,A,5128.85600,N,00007.80000,W,10.000,90.00,180521,,,A",
+            "GNGGA,120021.00,5128.85600,N,00007.80000,W,1,12,0.90,56.3,M,47.0,M,,",
+            "GNRMC,120022.00,A,5128.86600,N,00007.80000,W,10.000,90.00,180521,,,A",
+    };
+    int completed[3];
+    for (int i = 0; i < 3; i++) {
+        uint8_t sentence[NMEA_MAX_LENGTH + 8];
+        completed[i] = gps_serial_feed(&serial, sentence, nmea_sentence(sentence, sizeof(sentence), next_epochs[i]),
+                                       &gpsdata);
+    }
+    CHECK(completed[0] == 0 && completed[1] == 0 && completed[2] == 1);
+    CHECK(fix->time.tv_sec == BASE_TIME_S + 21 && near(fix->altMSL, 56.3, 1e-9));
+    CHECK(isnan(fix->epv) && isnan(fix->eph) && isfinite(fix->speed));
+
+    memset(&gpsdata, 0, sizeof(gpsdata));
+    uint64_t read_ns[UBX_FRAMES];
+    pthread_create(&thread, NULL, ubx_writer, &writer);
+    fixes = read_fixes(&serial, &gpsdata, read_ns, UBX_FRAMES);
+    pthread_join(thread, NULL);
+
+    CHECK(fixes == UBX_FRAMES);
+    CHECK(fix->mode == MODE_3D);
+    CHECK(fix->time.tv_sec == BASE_TIME_S + 30 + UBX_FRAMES - 2 && fix->time.tv_nsec == 995000000L);
+    CHECK(near(fix->longitude, (-13000 + UBX_FRAMES - 1) * 1e-7, 1e-12));
+    CHECK(near(fix->latitude, (514791000 + UBX_FRAMES - 1) * 1e-7, 1e-12));
+    CHECK(near(fix->altHAE, 102.3 + (UBX_FRAMES - 1) * 0.1, 1e-9));
+    CHECK(near(fix->altMSL, 55.3 + (UBX_FRAMES - 1) * 0.1, 1e-9));
+    CHECK(near(fix->eph, 1.5, 1e-9) && near(fix->epv, 2.5, 1e-9) && near(fix->eps, 0.3, 1e-9));
+    CHECK(near(fix->climb, -0.5, 1e-9) && near(fix->speed, 5.144, 1e-9) && near(fix->track, 45.0, 1e-9));
+
+    if (fixes == UBX_FRAMES) {
+        double sum_us = 0, max_us = 0;
+        for (int i = 0; i < UBX_FRAMES; i++) {
+            double latency_us = (double) (read_ns[i] - writer.frame_written_ns[i]) / 1e3;
+            sum_us += latency_us;
+            max_us = fmax(max_us, latency_us);
+        }
+        printf("pty: NAV-PVT write-to-fix latency avg %.1f us, max %.1f us\n", sum_us / UBX_FRAMES, max_us);
+    }
+
+    gps_serial_close(&serial);
+    close(master);
+    return test_result();
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "test.h"
+#include "gpsd_client.h"
+
+/*
+ * Streams TPV reports from a fake gpsd server on the loopback interface to the gpsd client, at 10 and
+ * 20 Hz like a fast receiver. The other report classes gpsd sends are mixed in, and some reports arrive
+ * split over two writes. Checks that every fix is parsed with its values and prints the CPU time the
+ * client needs per fix.
+ */
+
+#define FIXES_PER_RATE 20
+#define BASE_LATITUDE 51.4791
+#define BASE_LONGITUDE -0.0013
+#define BASE_TIME_S 1621339200 // 2021-05-18T12:00:00Z
+
+static const char *const version =
+        "{\"class\":\"VERSION\",\"release\":\"3.22\",\"rev\":\"3.22\",\"proto_major\":3,\"proto_minor\":14}\n";
+static const char *const devices =
+        "{\"class\":\"DEVICES\",\"devices\":[{\"class\":\"DEVICE\",\"path\":\"/dev/ttyACM0\",\"driver\":\"u-blox\","
+        "\"activated\":\"2021-05-18T12:00:00.000Z\",\"native\":1,\"bps\":9600,\"cycle\":1.00}]}\n";
+static const char *const sky =
+        "{\"class\":\"SKY\",\"device\":\"/dev/ttyACM0\",\"hdop\":0.9,\"satellites\":[{\"PRN\":5,\"el\":45,"
+        "\"az\":120,\"ss\":40,\"used\":true},{\"PRN\":12,\"el\":30,\"az\":250,\"ss\":35,\"used\":true}]}\n";
+
+struct server {
+    int listen_fd;
+    int rate_hz;
+    bool watch_received;
+};
+
+static double fix_latitude(int index) {
+    return BASE_LATITUDE + index * 1e-5;
+}
+
+static int format_tpv(char *buf, size_t size, int index, int rate_hz) {
+    long ms = (long) index * 1000 / rate_hz;
+    struct tm tm;
+    time_t seconds = BASE_TIME_S + ms / 1000;
+    gmtime_r(&seconds, &tm);
+    return snprintf(buf, size, "{\"class\":\"TPV\",\"device\":\"/dev/ttyACM0\",\"mode\":3,"
+                    "\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03ldZ\",\"ept\":0.005,\"lat\":%.9f,\"lon\":%.9f,"
+                    "\"altHAE\":%.3f,\"epx\":2.1,\"epy\":2.4,\"epv\":5.0,\"track\":90.0,\"speed\":%.3f,"
+                    "\"climb\":-0.5,\"eps\":0.2}\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+                    tm.tm_min, tm.tm_sec, ms % 1000, fix_latitude(index), BASE_LONGITUDE, 100.0 + index,
+                    (double) index / 10);
+}
+
+static void send_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = write(fd, data, length);
+        if (sent <= 0)
+            return;
+        data += sent;
+        length -= sent;
+    }
+}
+
+static void *server_loop(void *arg) {
+    struct server *server = arg;
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0)
+        return NULL;
+
+    char watch[256];
+    ssize_t length = read(fd, watch, sizeof(watch) - 1);
+    if (length > 0) {
+        watch[length] = '\0';
+        server->watch_received = strstr(watch, "?WATCH={\"enable\":true,\"json\":true") != NULL;
+    }
+    send_all(fd, version, strlen(version));
+    send_all(fd, devices, strlen(devices));
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (int i = 0; i < FIXES_PER_RATE; i++) {
+        char tpv[512];
+        int tpv_length = format_tpv(tpv, sizeof(tpv), i, server->rate_hz);
+        if (i % 4 == 1) {
+            // Split in the middle of a number
+            send_all(fd, tpv, tpv_length / 2);
+            usleep(1000);
+            send_all(fd, tpv + tpv_length / 2, tpv_length - tpv_length / 2);
+        } else {
+            send_all(fd, tpv, tpv_length);
+        }
+        if (i % 5 == 0)
+            send_all(fd, sky, strlen(sky));
+
+        next.tv_nsec += 1000000000L / server->rate_hz;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    close(fd);
+    return NULL;
+}
+
+static double thread_cpu_us() {
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void stream_at(int rate_hz) {
+    struct server server = { .rate_hz = rate_hz };
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_length = sizeof(addr);
+    server.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server.listen_fd < 0 || bind(server.listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(server.listen_fd, 1) < 0 || getsockname(server.listen_fd, (struct sockaddr *) &addr, &addr_length) < 0) {
+        perror("Fake gpsd server");
+        exit(EXIT_FAILURE);
+    }
+    char port[8];
+    snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+    pthread_t thread;
+    pthread_create(&thread, NULL, server_loop, &server);
+
+    struct gpsd_client client;
+    CHECK(gpsd_client_open(&client, "127.0.0.1", port, NULL) == 0);
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event event = { .events = EPOLLIN };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client.fd, &event);
+
+    struct gps_data_t gpsdata;
+    memset(&gpsdata, 0, sizeof(gpsdata));
+    int fixes = 0, reads = 0;
+    bool values_match = true;
+    double cpu_start_us = thread_cpu_us();
+    while (true) {
+        struct epoll_event ready;
+        if (epoll_wait(epoll_fd, &ready, 1, 2000) <= 0)
+            break;
+        int result = gpsd_client_read(&client, &gpsdata);
+        if (result < 0)
+            break; // The server has closed the connection
+        reads++;
+        if (result == 0)
+            continue;
+        fixes += result;
+
+        // The fix is the latest one read
+        int index = fixes - 1;
+        struct gps_fix_t *fix = &gpsdata.fix;
+        long ms = (long) index * 1000 / rate_hz;
+        if (fix->mode != MODE_3D || fabs(fix->latitude - fix_latitude(index)) > 1e-9 ||
+            fabs(fix->longitude - BASE_LONGITUDE) > 1e-9 || fabs(fix->altHAE - (100.0 + index)) > 1e-6 ||
+            fabs(fix->speed - (double) index / 10) > 1e-6 || fix->track != 90.0 || fix->climb != -0.5 ||
+            fix->time.tv_sec != BASE_TIME_S + ms / 1000 || fix->time.tv_nsec != (ms % 1000) * 1000000L)
+            values_match = false;
+        if (!isnan(fix->epc) || !isnan(fix->altMSL))
+            values_match = false; // Not sent, so not set
+    }
+    double cpu_us = thread_cpu_us() - cpu_start_us;
+
+    CHECK(server.watch_received);
+    CHECK(fixes == FIXES_PER_RATE);
+    CHECK(values_match);
+    printf("gpsd client at %d Hz: %d fixes in %d reads, %.1f us CPU per fix\n", rate_hz, fixes, reads,
+           fixes > 0 ? cpu_us / fixes : 0);
+
+    pthread_join(thread, NULL);
+    close(epoll_fd);
+    gpsd_client_close(&client);
+    close(server.listen_fd);
+}
+
+static void parse_reports() {
+    struct gps_fix_t fix;
+    memset(&fix, 0, sizeof(fix));
+    CHECK(gpsd_parse_tpv(version, strlen(version), &fix) == 0);
+    CHECK(gpsd_parse_tpv(sky, strlen(sky), &fix) == 0);
+    const char *truncated = "{\"class\":\"TPV\",\"lat\":";
+    CHECK(gpsd_parse_tpv(truncated, strlen(truncated), &fix) == -1);
+    CHECK(gpsd_parse_tpv("not json", 8, &fix) == -1);
+
+    const char *tpv = "{ \"class\" : \"TPV\", \"mode\" : 2, \"lat\" : -33.5, \"lon\" : 151.25 }\n";
+    CHECK(gpsd_parse_tpv(tpv, strlen(tpv), &fix) == 1);
+    CHECK(fix.mode == MODE_2D && fix.latitude == -33.5 && fix.longitude == 151.25 && isnan(fix.altHAE));
+
+    struct timespec ts;
+    CHECK(gpsd_parse_time("2021-05-18T12:34:56.789Z", 24, &ts) == 0);
+    CHECK(ts.tv_sec == BASE_TIME_S + 34 * 60 + 56 && ts.tv_nsec == 789000000L);
+    CHECK(gpsd_parse_time("2021-05-18 12:34:56Z", 20, &ts) == -1);
+}
+
+int main() {
+    parse_reports();
+    stream_at(10);
+    stream_at(20);
+    return test_result();
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "test.h"
+#include "hostapd_ctrl.h"
+
+/*
+ * Runs the control connections against stand-ins for several hostapd interfaces. Each stand-in is a unix
+ * datagram socket in HOSTAPD_CTRL_DIR that answers like hostapd does. Checks that every interface is
+ * found, that the replies are told apart, that unsolicited events are skipped and that a connection
+ * comes back after its hostapd was restarted.
+ */
+
+sem_t semaphore; // Posted by hostapd_ctrl_init() in the transmitter
+
+struct stand_in {
+    const char *name;
+    bool send_event; // Sends an event before each reply
+    int fd;
+    pthread_t thread;
+    atomic_bool running;
+};
+
+static struct stand_in stand_ins[] = {
+        { .name = "wlan0" },
+        { .name = "wlan1", .send_event = true },
+        { .name = "wlan1-1" },
+};
+#define STAND_IN_COUNT (int) (sizeof(stand_ins) / sizeof(stand_ins[0]))
+
+static void *stand_in_loop(void *arg) {
+    struct stand_in *stand_in = arg;
+    char request[256];
+    while (atomic_load(&stand_in->running)) {
+        struct sockaddr_un from;
+        socklen_t from_length = sizeof(from);
+        ssize_t length = recvfrom(stand_in->fd, request, sizeof(request) - 1, 0, (struct sockaddr *) &from,
+                                  &from_length);
+        if (length <= 0)
+            continue;
+        request[length] = '\0';
+
+        if (stand_in->send_event) {
+            const char *event = "<3>CTRL-EVENT-TEST OK";
+            sendto(stand_in->fd, event, strlen(event), 0, (struct sockaddr *) &from, from_length);
+        }
+        const char *reply = "UNKNOWN COMMAND\n";
+        if (strcmp(request, "PING") == 0)
+            reply = "PONG\n";
+        else if (strncmp(request, "SET ", 4) == 0 || strcmp(request, "UPDATE_BEACON") == 0)
+            reply = "OK\n";
+        sendto(stand_in->fd, reply, strlen(reply), 0, (struct sockaddr *) &from, from_length);
+    }
+    return NULL;
+}
+
+static void stand_in_path(const struct stand_in *stand_in, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s", HOSTAPD_CTRL_DIR, stand_in->name);
+}
+
+static void stand_in_start(struct stand_in *stand_in) {
+    struct sockaddr_un addr;
+    stand_in_path(stand_in, &addr);
+    unlink(addr.sun_path);
+    stand_in->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (stand_in->fd < 0 || bind(stand_in->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("Stand-in socket");
+        exit(EXIT_FAILURE);
+    }
+    struct timeval timeout = { .tv_usec = 50000 }; // For checking whether to stop
+    setsockopt(stand_in->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    atomic_store(&stand_in->running, true);
+    pthread_create(&stand_in->thread, NULL, stand_in_loop, stand_in);
+}
+
+static void stand_in_stop(struct stand_in *stand_in) {
+    struct sockaddr_un addr;
+    stand_in_path(stand_in, &addr);
+    atomic_store(&stand_in->running, false);
+    pthread_join(stand_in->thread, NULL);
+    close(stand_in->fd);
+    unlink(addr.sun_path);
+}
+
+static struct hostapd_ctrl *find(struct hostapd_ctrl *ifaces, int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(ifaces[i].name, name) == 0)
+            return &ifaces[i];
+    }
+    return NULL;
+}
+
+int main() {
+    mkdir(HOSTAPD_CTRL_DIR, 0755);
+    for (int i = 0; i < STAND_IN_COUNT; i++)
+        stand_in_start(&stand_ins[i]);
+    // Entries other than sockets are skipped
+    FILE *file = fopen(HOSTAPD_CTRL_DIR "/not_a_socket", "w");
+    if (file)
+        fclose(file);
+
+    struct hostapd_ctrl ifaces[HOSTAPD_CTRL_MAX_INTERFACES];
+    int count = hostapd_ctrl_open_beacon_ifaces(ifaces, HOSTAPD_CTRL_MAX_INTERFACES, true);
+    CHECK(count == STAND_IN_COUNT);
+    for (int i = 0; i < STAND_IN_COUNT; i++)
+        CHECK(find(ifaces, count, stand_ins[i].name) != NULL);
+
+    for (int i = 0; i < count; i++) {
+        char reply[64];
+        CHECK(hostapd_ctrl_command(&ifaces[i], "SET vendor_elements dd05fa0bbc0d00") == 0);
+        CHECK(hostapd_ctrl_command(&ifaces[i], "UPDATE_BEACON") == 0);
+        CHECK(hostapd_ctrl_request(&ifaces[i], "PING", reply, sizeof(reply)) == 5);
+        CHECK(strcmp(reply, "PONG\n") == 0);
+        CHECK(hostapd_ctrl_command(&ifaces[i], "NOT_A_COMMAND") == 1);
+    }
+
+    // No more connections than asked for
+    struct hostapd_ctrl limited[2];
+    int limited_count = hostapd_ctrl_open_beacon_ifaces(limited, 2, true);
+    CHECK(limited_count == 2);
+    for (int i = 0; i < limited_count; i++)
+        hostapd_ctrl_close(&limited[i]);
+
+    // hostapd restarts: The requests fail until the connection has been re-opened
+    struct hostapd_ctrl *restarted = find(ifaces, count, stand_ins[0].name);
+    if (restarted) {
+        stand_in_stop(&stand_ins[0]);
+        CHECK(hostapd_ctrl_command(restarted, "UPDATE_BEACON") < 0);
+        CHECK(hostapd_ctrl_reconnect(restarted) != 0);
+        CHECK(restarted->fd < 0);
+        CHECK(hostapd_ctrl_command(restarted, "UPDATE_BEACON") < 0);
+
+        stand_in_start(&stand_ins[0]);
+        CHECK(hostapd_ctrl_reconnect(restarted) == 0);
+        CHECK(strcmp(restarted->name, stand_ins[0].name) == 0);
+        CHECK(hostapd_ctrl_command(restarted, "UPDATE_BEACON") == 0);
+    }
+
+    for (int i = 0; i < count; i++)
+        hostapd_ctrl_close(&ifaces[i]);
+    for (int i = 0; i < STAND_IN_COUNT; i++)
+        stand_in_stop(&stand_ins[i]);
+    unlink(HOSTAPD_CTRL_DIR "/not_a_socket");
+    rmdir(HOSTAPD_CTRL_DIR);
+    return test_result();
+}
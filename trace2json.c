@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+/*
+ * Converts a trace dump written by transmit on SIGUSR2 to the Chrome trace event JSON format.
+ * Open the result in chrome://tracing or https://ui.perfetto.dev
+ *
+ * Usage: trace2json [<trace file> [<json file>]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace_ring.h"
+
+static int read_exact(FILE *file, void *data, size_t size) {
+    return fread(data, 1, size, file) == size ? 0 : -1;
+}
+
+static void print_name(FILE *out, const char *name, size_t size) {
+    for (size_t i = 0; i < size && name[i]; i++) {
+        if (name[i] == '"' || name[i] == '\\')
+            fputc('\\', out);
+        if ((unsigned char) name[i] >= 0x20)
+            fputc(name[i], out);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *input = argc > 1 ? argv[1] : TRACE_DUMP_FILE;
+    FILE *file = fopen(input, "rb");
+    if (!file) {
+        perror(input);
+        return EXIT_FAILURE;
+    }
+    FILE *out = stdout;
+    if (argc > 2 && !(out = fopen(argv[2], "w"))) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    struct trace_file_header header;
+    if (read_exact(file, &header, sizeof(header)) != 0 ||
+        memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_FILE_VERSION || header.name_size == 0) {
+        fprintf(stderr, "%s is not a transmit trace dump\n", input);
+        return EXIT_FAILURE;
+    }
+    char *names = calloc(header.name_count, header.name_size);
+    if (!names || read_exact(file, names, (size_t) header.name_count * header.name_size) != 0) {
+        fprintf(stderr, "%s: Truncated name table\n", input);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    const char *separator = "";
+    uint64_t events = 0;
+    for (uint32_t t = 0; t < header.thread_count; t++) {
+        struct trace_thread_header thread;
+        if (read_exact(file, &thread, sizeof(thread)) != 0) {
+            fprintf(stderr, "%s: Truncated after %u threads\n", input, t);
+            break;
+        }
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"",
+                separator, thread.tid);
+        print_name(out, thread.thread_name, sizeof(thread.thread_name));
+        fprintf(out, "\"}}");
+        separator = ",\n";
+
+        // The ring may have overwritten the begin events of the oldest end events. Those are dropped
+        int depth = 0;
+        for (uint32_t i = 0; i < thread.event_count; i++) {
+            struct trace_event event;
+            if (read_exact(file, &event, sizeof(event)) != 0) {
+                fprintf(stderr, "%s: Truncated events of thread %u\n", input, thread.tid);
+                break;
+            }
+            if (event.phase == TRACE_PHASE_END && depth == 0)
+                continue;
+            depth += event.phase == TRACE_PHASE_BEGIN ? 1 : -1;
+
+            fprintf(out, "%s{\"name\":\"", separator);
+            if (event.id < header.name_count)
+                print_name(out, names + (size_t) event.id * header.name_size, header.name_size);
+            else
+                fprintf(out, "event %u", event.id);
+            fprintf(out, "\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%lu.%03lu", event.phase, thread.tid,
+                    (unsigned long) (event.timestamp_ns / 1000), (unsigned long) (event.timestamp_ns % 1000));
+            if (event.phase == TRACE_PHASE_BEGIN && event.arg)
+                fprintf(out, ",\"args\":{\"arg\":\"0x%X\"}", event.arg);
+            fprintf(out, "}");
+            events++;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    fprintf(stderr, "Converted %lu events of %u threads\n", (unsigned long) events, header.thread_count);
+
+    free(names);
+    fclose(file);
+    if (out != stdout)
+        fclose(out);
+    return EXIT_SUCCESS;
+}
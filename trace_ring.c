@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "trace_ring.h"
+
+/*
+ * Every thread records into its own ring, allocated on its first event. Recording an event is a clock read
+ * and a store into the ring, without locks or shared cache lines. Old events are overwritten, so the rings
+ * always hold the most recent history of each thread.
+ * trace_dump() only uses async-signal-safe calls and is run directly from the SIGUSR2 handler. Events
+ * recorded while the dump is written may appear torn in the file.
+ */
+
+static const char trace_names[TRACE_ID_AMOUNT][TRACE_NAME_SIZE] = {
+        [TRACE_TRANSMIT_LOOP] = "transmit_loop",
+        [TRACE_CREATE_MESSAGE_PACK] = "create_message_pack",
+        [TRACE_SEND_CMD] = "send_cmd",
+        [TRACE_HOSTAPD_REQUEST] = "hostapd_ctrl_request",
+        [TRACE_PROCESS_GPS_DATA] = "process_gps_data",
+        [TRACE_SLEEP] = "sleep",
+        [TRACE_AUTH_SIGN] = "auth_sign",
+};
+
+__thread struct trace_ring *trace_thread_ring = NULL;
+static struct trace_ring *rings[TRACE_MAX_THREADS];
+static _Atomic int ring_count = 0;
+
+// Returns NULL when all rings are taken. Further threads are then not traced
+struct trace_ring *trace_register_thread() {
+    if (atomic_load(&ring_count) >= TRACE_MAX_THREADS)
+        return NULL;
+    struct trace_ring *ring = calloc(1, sizeof(struct trace_ring));
+    if (!ring)
+        return NULL;
+    ring->tid = (uint32_t) syscall(SYS_gettid);
+    pthread_getname_np(pthread_self(), ring->thread_name, sizeof(ring->thread_name));
+
+    int index = atomic_fetch_add(&ring_count, 1);
+    if (index >= TRACE_MAX_THREADS) {
+        free(ring);
+        return NULL;
+    }
+    rings[index] = ring;
+    trace_thread_ring = ring;
+    return ring;
+}
+
+static int write_all(int fd, const void *data, size_t length) {
+    const char *ptr = data;
+    while (length > 0) {
+        ssize_t written = write(fd, ptr, length);
+        if (written <= 0)
+            return -1;
+        ptr += written;
+        length -= written;
+    }
+    return 0;
+}
+
+static int write_ring(int fd, struct trace_ring *ring) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+    uint64_t first = (head - count) & (TRACE_RING_SIZE - 1);
+
+    struct trace_thread_header header = { 0 };
+    header.tid = ring->tid;
+    memcpy(header.thread_name, ring->thread_name, sizeof(header.thread_name));
+    header.event_count = (uint32_t) count;
+    if (write_all(fd, &header, sizeof(header)) != 0)
+        return -1;
+
+    // The oldest events are at the end of the array once the ring has wrapped
+    uint64_t until_end = count < TRACE_RING_SIZE - first ? count : TRACE_RING_SIZE - first;
+    if (write_all(fd, &ring->events[first], until_end * sizeof(struct trace_event)) != 0)
+        return -1;
+    return write_all(fd, &ring->events[0], (count - until_end) * sizeof(struct trace_event));
+}
+
+void trace_dump() {
+    int fd = open(TRACE_DUMP_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+
+    // A thread that is still registering is skipped
+    struct trace_ring *snapshot[TRACE_MAX_THREADS];
+    int threads = atomic_load(&ring_count), thread_count = 0;
+    for (int i = 0; i < threads && i < TRACE_MAX_THREADS; i++) {
+        if (rings[i])
+            snapshot[thread_count++] = rings[i];
+    }
+
+    struct trace_file_header header = { 0 };
+    memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_FILE_VERSION;
+    header.thread_count = thread_count;
+    header.name_count = TRACE_ID_AMOUNT;
+    header.name_size = TRACE_NAME_SIZE;
+
+    int ret = write_all(fd, &header, sizeof(header));
+    if (ret == 0)
+        ret = write_all(fd, trace_names, sizeof(trace_names));
+    for (int i = 0; i < thread_count && ret == 0; i++)
+        ret = write_ring(fd, snapshot[i]);
+    close(fd);
+
+    static const char done[] = "Trace written to " TRACE_DUMP_FILE "\n";
+    static const char failed[] = "Failed to write the trace to " TRACE_DUMP_FILE "\n";
+    if (ret == 0)
+        ret = write(STDOUT_FILENO, done, sizeof(done) - 1);
+    else
+        ret = write(STDOUT_FILENO, failed, sizeof(failed) - 1);
+    (void) ret;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _TRACE_RING_H_
+#define _TRACE_RING_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define TRACE_MAX_THREADS 32
+#define TRACE_RING_SIZE 8192 // Events per thread. Must be a power of two
+#define TRACE_NAME_SIZE 32
+#define TRACE_THREAD_NAME_SIZE 16
+#define TRACE_DUMP_FILE "/tmp/odid_transmit.trace"
+
+#define TRACE_FILE_MAGIC "ODIDTRC1"
+#define TRACE_FILE_VERSION 1
+
+#define TRACE_PHASE_BEGIN 'B'
+#define TRACE_PHASE_END 'E'
+
+enum trace_id {
+    TRACE_TRANSMIT_LOOP,       // One iteration of the single message or message pack transmit loop
+    TRACE_CREATE_MESSAGE_PACK,
+    TRACE_SEND_CMD,            // HCI command until its event has been read. The argument is the OCF
+    TRACE_HOSTAPD_REQUEST,     // hostapd control interface request
+    TRACE_PROCESS_GPS_DATA,
+    TRACE_SLEEP,               // Timed waits of the transmit and NAN loops
+    TRACE_AUTH_SIGN,           // Signing a message set. The argument is the number of messages
+    TRACE_ID_AMOUNT
+};
+
+struct trace_event {
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC
+    uint16_t id;
+    uint8_t phase;
+    uint8_t reserved;
+    uint32_t arg;
+};
+
+struct trace_ring {
+    _Atomic uint64_t head; // Total number of events written. Only the owning thread writes
+    uint32_t tid;
+    char thread_name[TRACE_THREAD_NAME_SIZE];
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+/*
+ * The dump file starts with struct trace_file_header, followed by TRACE_ID_AMOUNT names of
+ * TRACE_NAME_SIZE bytes each. Then for every thread a struct trace_thread_header follows with
+ * its events, oldest first.
+ */
+struct trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t thread_count;
+    uint32_t name_count;
+    uint32_t name_size;
+};
+
+struct trace_thread_header {
+    uint32_t tid;
+    char thread_name[TRACE_THREAD_NAME_SIZE];
+    uint32_t event_count;
+};
+
+extern __thread struct trace_ring *trace_thread_ring;
+struct trace_ring *trace_register_thread(void);
+
+static inline void trace_record(enum trace_id id, uint8_t phase, uint32_t arg) {
+    struct trace_ring *ring = trace_thread_ring;
+    if (!ring && !(ring = trace_register_thread()))
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct trace_event *event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    event->timestamp_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+    event->id = id;
+    event->phase = phase;
+    event->arg = arg;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static inline void trace_begin(enum trace_id id, uint32_t arg) {
+    trace_record(id, TRACE_PHASE_BEGIN, arg);
+}
+
+static inline void trace_end(enum trace_id id) {
+    trace_record(id, TRACE_PHASE_END, 0);
+}
+
+void trace_dump(void);
+
+#endif //_TRACE_RING_H_
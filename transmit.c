@@ -12,32 +12,105 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <errno.h>
 #include <sys/resource.h>
-#include "ap_interface.h"
+#include <sys/epoll.h>
+#include "hostapd_ctrl.h"
 #include "bluetooth.h"
 #include "wifi_beacon.h"
+#include "wifi_nan.h"
 #include "gpsmod.h"
+#include "replay.h"
+#include "config_file.h"
+#include "handover.h"
+#include "metrics.h"
+#include "trace_ring.h"
+#include "btsnoop.h"
+#include "compliance.h"
+#include "hci_profile.h"
+#include "location_fixed.h"
+#include "location_batch.h"
+#include "auth_signer.h"
+#include "realtime.h"
+#include "alloc_guard.h"
+#include "vclock.h"
 
 sem_t semaphore;
 pthread_t id, gps_thread;
 
-#define MINIMUM(a,b) (((a)<(b))?(a):(b))
-
 #define BASIC_ID_POS_ZERO 0
 #define BASIC_ID_POS_ONE 1
+#define PACK_LOCATION_POS 2
+#define PACK_SIGNED_MESSAGES 5 // Messages covered by the Auth signature, see create_signed_messages()
+#define LOCATION_TIMESTAMP_OFFSET 21 // TimeStamp (2 bytes) and TSAccuracy
+#define LOCATION_TIMESTAMP_SIZE 3
+#define LOCATION_REFRESH_MS 500 // Half the required Location update period, so that 1 Hz fixes are never skipped
+#define PUSH_INTERVAL_DEFAULT_MS 100
+#define UPDATE_PERIOD_US 4000000    // Message pack update interval before the first upload
+#define PACK_ROUND_NS 40000000000ULL // Duration of one round of send_packs()
+#define MESSAGE_GAP_US 100000       // Between two single messages
+#define BEACON_MESSAGE_GAP_US 1000000 // Keeps a single message in the Beacon for several beacon intervals
 
 static struct config_data config = { 0 };
 static bool kill_program = false;
+static bool handover_requested = false;
+
+static int64_t last_update_ns = 0;    // CLOCK_REALTIME of the last data update sent to the transports
+static int64_t adopted_update_ns = 0; // The last update of the previous process, until the first own update
+static struct handover_state handover;
+static bool handover_adopted = false;
+
+// The transports are initialized in parallel. Each one is used as soon as it is ready
+static _Atomic bool transport_ready[TRANSPORT_AMOUNT] = { false };
+static _Atomic bool transports_changed = false; // A transport became ready and needs the current data
+static bool first_frame_sent[TRANSPORT_AMOUNT] = { false };
+static _Atomic bool startup_failed = false;
+static uint64_t start_ns;
+static sem_t transmit_wake; // Posted to wake the transmit loop early
+static _Atomic bool fix_pending = false; // Set for a new GPS fix, cleared when the Location is encoded
+static pthread_t beacon_init_thread;
+static pthread_t bluetooth_init_thread;
+static bool bluetooth_init_started = false;
 
 static struct fixsource_t source;
 static struct gps_data_t gpsdata;
+static struct gpsd_client gps_client;
+static struct gps_serial gps_serial;
+static struct replay replay;
+
+// For checking the message counters at the end of a simulation
+static uint8_t counters_start[ODID_MSG_COUNTER_AMOUNT];
+static uint64_t counter_updates[ODID_MSG_COUNTER_AMOUNT];
+
+// The last encoded Location, for spacing fix-triggered updates and measuring the fix-to-air latency
+static struct {
+    uint64_t encoded_ns;
+    uint64_t fix_received_ns; // The fix it was encoded from. 0 without a GPS source
+    uint64_t on_air_fix_ns;   // The last fix that reached the transports
+    int samples;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} location_push = { 0 };
+
+// The message pack last handed to the transports
+static struct {
+    bool valid;
+    struct ODID_MessagePack_encoded pack_enc;
+    uint64_t uploaded_ns;
+    int checks;
+    int skipped;
+} uploaded_pack = { 0 };
 
 struct gps_loop_args {
     struct gps_data_t *gpsdata;
+    struct gpsd_client *client;
+    struct gps_serial *serial; // Used instead of client when not NULL
+    struct replay *replay;
     struct ODID_UAS_Data *uasData;
     int exit_status;
 };
@@ -119,26 +192,111 @@ static void fill_example_gps_data(struct ODID_UAS_Data *uasData) {
     uasData->Location.TimeStamp = 360.52f;
 }
 
-static void cleanup(int exit_code) {
+static void save_handover_state() {
+    struct handover_state state = { 0 };
+    state.magic = HANDOVER_MAGIC;
+    state.version = HANDOVER_VERSION;
+    state.use_btl = config.use_btl;
+    state.use_bt4 = config.use_bt4;
+    state.use_bt5 = config.use_bt5;
+    state.use_packs = config.use_packs;
+    state.handle_bt4 = config.handle_bt4;
+    state.handle_bt5 = config.handle_bt5;
     if (config.use_btl || config.use_bt4 || config.use_bt5)
-        close_bluetooth(&config);
+        get_bluetooth_address(state.mac);
+    memcpy(state.msg_counters, config.msg_counters, sizeof(state.msg_counters));
+    state.pack_valid = uploaded_pack.valid;
+    memcpy(&state.pack_enc, &uploaded_pack.pack_enc, sizeof(state.pack_enc));
+    state.last_update_ns = last_update_ns;
+    state.written_ns = handover_realtime_ns();
 
-    if (config.use_beacon) {
+    if (handover_save(HANDOVER_STATE_FILE, &state) == 0)
+        printf("Handover state written to %s. Advertising is left running\n", HANDOVER_STATE_FILE);
+    else
+        handover_requested = false; // Without a state file to adopt, stop the transmission as usual
+}
+
+// Verifies that each message counter ended where its number of updates says after the simulated run
+static void simulation_report() {
+    static const char *const counter_names[ODID_MSG_COUNTER_AMOUNT] = {
+            "Basic ID", "Location", "Auth", "Self ID", "System", "Operator ID", "Packed"
+    };
+    for (int i = 0; i < ODID_MSG_COUNTER_AMOUNT; i++) {
+        if (counter_updates[i] == 0)
+            continue;
+        uint64_t total = counters_start[i] + counter_updates[i];
+        printf("Simulation: %s counter %lu updates, %lu wraps, now %u%s\n", counter_names[i],
+               (unsigned long) counter_updates[i], (unsigned long) (total / 256), config.msg_counters[i],
+               (uint8_t) total == config.msg_counters[i] ? "" : " (inconsistent)");
+    }
+}
+
+static void cleanup(int exit_code) {
+    // The shutdown itself allocates
+    if (alloc_guard_finish() != 0)
+        exit_code = EXIT_FAILURE;
+
+    // The summaries are taken before the threads are joined below, which lets the simulated time run on
+    compliance_stop();
+    if (config.simulate_s > 0)
+        simulation_report();
+    vclock_stop();
+
+    if (bluetooth_init_started)
+        vclock_thread_join(bluetooth_init_thread, NULL);
+
+    if (handover_requested)
+        save_handover_state();
+
+    if (config.config_file[0])
+        config_file_close();
+
+    if (location_push.samples > 0)
+        printf("GPS: fix-to-air latency avg %.1f ms, max %.1f ms over %d fixes\n",
+               (double) location_push.sum_ns / location_push.samples / 1e6,
+               (double) location_push.max_ns / 1e6, location_push.samples);
+
+    auth_signer_stop();
+    realtime_stop();
+    metrics_stop();
+
+    if (config.use_nan)
+        close_nan();
+
+    if (config.use_btl || config.use_bt4 || config.use_bt5) {
+        if (handover_requested)
+            detach_bluetooth();
+        else
+            close_bluetooth(&config);
+    }
+    btsnoop_close();
+
+    // Without a connection to hostapd there is nothing to close
+    if (config.use_beacon && transport_ready[TRANSPORT_BEACON]) {
+        close_beacon();
         send_quit();
 
         int *ptr;
-        pthread_join(id, (void **) &ptr);
-        printf("Return value from ap_interface_init: %i\n", *ptr);
+        vclock_thread_join(id, (void **) &ptr);
+        printf("Return value from hostapd_ctrl_init: %i\n", *ptr);
 
         sem_destroy(&semaphore);
     }
 
     if(config.use_gps) {
+        if (config.replay_file[0])
+            replay_finish(&replay);
+
         int *ptr;
-        pthread_join(gps_thread, (void **) &ptr);
+        vclock_thread_join(gps_thread, (void **) &ptr);
         printf("Return value from gps_loop: %d\n", *ptr);
 
-        gps_close(&gpsdata);
+        if (config.replay_file[0])
+            replay_close(&replay);
+        else if (config.gps_serial[0])
+            gps_serial_close(&gps_serial);
+        else
+            gpsd_client_close(&gps_client);
     }
 
     exit(exit_code);
@@ -148,16 +306,296 @@ static void sig_handler(int signo) {
     if (signo == SIGINT || signo == SIGSTOP || signo == SIGKILL || signo == SIGTERM) {
         kill_program = true;
     }
+    if (signo == SIGHUP)
+        config_file_request_reload();
+    if (signo == SIGUSR1) {
+        handover_requested = true;
+        kill_program = true;
+    }
+    if (signo == SIGUSR2)
+        trace_dump();
+}
+
+/*
+ * Called after new data has been handed to the transports. After adopting the state of a previous
+ * process, the first update reports how long the data on air was frozen during the restart.
+ * The advertising itself continues throughout.
+ */
+static void set_transport_ready(enum transport transport) {
+    printf("%s ready after %.1f ms\n", transport_names[transport], (double) (get_time_ns() - start_ns) / 1e6);
+    transport_ready[transport] = true;
+    // Adopted Beacon and Bluetooth transports already carry the current data
+    if (!handover_adopted || transport == TRANSPORT_NAN)
+        transports_changed = true;
+    vclock_sem_post(&transmit_wake);
+}
+
+static void signature_published() {
+    // With extrapolation the Location changes on every pack, so each new signature would trigger the next one
+    if (config.extrapolate_max_ms == 0)
+        vclock_sem_post(&transmit_wake);
+}
+
+static void first_frame(enum transport transport) {
+    if (first_frame_sent[transport])
+        return;
+    first_frame_sent[transport] = true;
+    printf("%s: Time to first frame %.1f ms\n", transport_names[transport],
+           (double) (get_time_ns() - start_ns) / 1e6);
+}
+
+static bool all_transports_ready(struct config_data *config) {
+    return (!config->use_beacon || transport_ready[TRANSPORT_BEACON]) &&
+           (!(config->use_btl || config->use_bt4 || config->use_bt5) || transport_ready[TRANSPORT_BLUETOOTH]) &&
+           (!config->use_nan || transport_ready[TRANSPORT_NAN]);
+}
+
+// Counts the transmit loop updates with all transports up. The steady state starts after the warm-up
+static void update_done(struct config_data *config) {
+    static int warm_updates = 0;
+    if (all_transports_ready(config) && ++warm_updates == ALLOC_GUARD_WARMUP_UPDATES)
+        alloc_guard_arm();
+    if (config->simulate_s > 0 && get_time_ns() - start_ns >= (uint64_t) config->simulate_s * 1000000000ULL)
+        kill_program = true;
+}
+
+static bool any_transport_ready() {
+    for (int i = 0; i < TRANSPORT_AMOUNT; i++) {
+        if (transport_ready[i])
+            return true;
+    }
+    return false;
+}
+
+// Sleeps for up to period_us. Returns early when a transport becomes ready or the program is stopping
+static void wake_wait(unsigned int period_us) {
+    uint64_t deadline_ns = get_time_ns() + period_us * 1000ULL;
+    if (vclock_sem_wait(&transmit_wake, deadline_ns) != 0 && errno == ETIMEDOUT) {
+        uint64_t now_ns = get_time_ns();
+        uint64_t lateness_ns = now_ns > deadline_ns ? now_ns - deadline_ns : 0;
+        if (lateness_ns > 0)
+            metrics_observe_ns(METRICS_SCHEDULER_LATENESS, lateness_ns);
+        realtime_latency(REALTIME_TRANSMIT, lateness_ns);
+    }
+}
+
+static void *beacon_init(void *arg) {
+    (void) arg;
+    vclock_sem_wait(&semaphore, VCLOCK_FOREVER); // Posted by the hostapd interface thread once connected
+    if (init_beacon(&config) != 0) {
+        startup_failed = true;
+        kill_program = true;
+        vclock_sem_post(&transmit_wake);
+        return NULL;
+    }
+    set_transport_ready(TRANSPORT_BEACON);
+    return NULL;
+}
+
+static void *bluetooth_init(void *arg) {
+    (void) arg;
+    pthread_setname_np(pthread_self(), "bt-init");
+    realtime_thread(REALTIME_HCI);
+    if (handover_adopted)
+        adopt_bluetooth(handover.mac);
+    else
+        init_bluetooth(&config);
+    set_transport_ready(TRANSPORT_BLUETOOTH);
+    return NULL;
+}
+
+static void transports_updated() {
+    last_update_ns = handover_realtime_ns();
+    if (adopted_update_ns == 0)
+        return;
+    printf("Handover: Data updates resumed %.1f ms after the last update of the previous process. "
+           "Advertising was not interrupted\n", (double) (last_update_ns - adopted_update_ns) / 1e6);
+    adopted_update_ns = 0;
+}
+
+/*
+ * Re-reads the configuration file and applies only what changed, without restarting the transports.
+ * Changed static messages are picked up when the next message pack or message is encoded. Changed
+ * advertising intervals are applied to the affected advertising set only.
+ */
+static void reload_config(struct ODID_UAS_Data *uasData, struct config_data *config) {
+    struct config_data new_config = *config;
+    struct ODID_UAS_Data new_data = *uasData;
+    if (config_file_load(config->config_file, &new_config, &new_data) != 0) {
+        printf("Config: Keeping the current configuration\n");
+        return;
+    }
+
+    if (new_config.handle_bt4 != config->handle_bt4 || new_config.handle_bt5 != config->handle_bt5) {
+        printf("Config: Changing advertising set handles requires a restart\n");
+        new_config.handle_bt4 = config->handle_bt4;
+        new_config.handle_bt5 = config->handle_bt5;
+    }
+
+    if (new_config.rt_deadline_us != config->rt_deadline_us ||
+        memcmp(new_config.rt_priority, config->rt_priority, sizeof(config->rt_priority)) != 0 ||
+        memcmp(new_config.rt_cpu, config->rt_cpu, sizeof(config->rt_cpu)) != 0) {
+        printf("Config: Changing the real-time settings requires a restart\n");
+        new_config.rt_deadline_us = config->rt_deadline_us;
+        memcpy(new_config.rt_priority, config->rt_priority, sizeof(config->rt_priority));
+        memcpy(new_config.rt_cpu, config->rt_cpu, sizeof(config->rt_cpu));
+    }
+
+    if (transport_ready[TRANSPORT_BLUETOOTH])
+        update_bluetooth_intervals(config, &new_config);
+    if (config->use_nan && new_config.nan_interval_ms != config->nan_interval_ms)
+        nan_set_interval(new_config.nan_interval_ms);
+
+    // The Location message is owned by the GPS thread and not touched here
+    if (memcmp(new_data.BasicID, uasData->BasicID, sizeof(uasData->BasicID)) != 0) {
+        printf("Config: Basic ID changed\n");
+        memcpy(uasData->BasicID, new_data.BasicID, sizeof(uasData->BasicID));
+    }
+    if (memcmp(&new_data.SelfID, &uasData->SelfID, sizeof(uasData->SelfID)) != 0) {
+        printf("Config: Self ID changed\n");
+        uasData->SelfID = new_data.SelfID;
+    }
+    if (memcmp(&new_data.System, &uasData->System, sizeof(uasData->System)) != 0) {
+        printf("Config: System changed\n");
+        uasData->System = new_data.System;
+    }
+    if (memcmp(&new_data.OperatorID, &uasData->OperatorID, sizeof(uasData->OperatorID)) != 0) {
+        printf("Config: Operator ID changed\n");
+        uasData->OperatorID = new_data.OperatorID;
+    }
+
+    *config = new_config;
+    printf("Config: Reloaded %s\n", config->config_file);
+}
+
+static void check_config_reload(struct ODID_UAS_Data *uasData, struct config_data *config) {
+    if (config->config_file[0] && config_file_changed())
+        reload_config(uasData, config);
+}
+
+static const char *gps_source_name(struct config_data *config) {
+    if (config->replay_file[0])
+        return "replay";
+    return config->gps_serial[0] ? "serial" : "gpsd";
+}
+
+// With w 0, the replay is paced by the transmit loop: every transmission waits for the next fix
+static bool replay_paced(struct config_data *config) {
+    return config->replay_file[0] && config->replay_warp <= 0;
+}
+
+// The replay only starts when all transports are up, so that no fix is used up before it can be sent
+static void wait_replay_fix(struct config_data *config) {
+    trace_begin(TRACE_SLEEP, 0);
+    if (!all_transports_ready(config))
+        wake_wait(UPDATE_PERIOD_US);
+    else if (replay_wait_fix(&replay) != 0)
+        kill_program = true;
+    trace_end(TRACE_SLEEP);
+}
+
+/*
+ * Called by the GPS and replay threads for every new fix. Wakes the transmit loop so the fix goes on air
+ * right away instead of with the next periodic update. Only the first fix since the last encode posts,
+ * so the wake-ups cannot pile up while the loop is rate limited.
+ */
+static void fix_arrived() {
+    if (!atomic_exchange(&fix_pending, true))
+        vclock_sem_post(&transmit_wake);
+}
+
+static void encode_location(struct ODID_UAS_Data *uasData, union ODID_Message_encoded *encoded,
+                            struct config_data *config) {
+    atomic_store(&fix_pending, false);
+    location_push.encoded_ns = get_time_ns();
+    location_push.fix_received_ns = config->use_gps ? gps_fix_received_ns() : 0;
+    ODID_Location_data location = uasData->Location;
+    if (config->use_gps && config->extrapolate_max_ms > 0)
+        gps_predict_location(&location, config->extrapolate_max_ms);
+    if (encodeLocationMessage((ODID_Location_encoded *) encoded, &location) != ODID_SUCCESS)
+        printf("Error: Failed to encode Location\n");
+    if (config->use_gps)
+        gps_location_encoded(gps_source_name(config));
+}
+
+// Called when the transports have taken the last encoded Location. Each fix is measured once
+static void location_on_air() {
+    uint64_t fix_ns = location_push.fix_received_ns;
+    if (fix_ns == 0 || fix_ns == location_push.on_air_fix_ns)
+        return;
+    location_push.on_air_fix_ns = fix_ns;
+    uint64_t latency_ns = get_time_ns() - fix_ns;
+    metrics_observe_ns(METRICS_FIX_TO_AIR, latency_ns);
+    location_push.sum_ns += latency_ns;
+    location_push.max_ns = MAXIMUM(location_push.max_ns, latency_ns);
+    location_push.samples++;
+}
+
+// The earliest time a fix-triggered update may be sent, push_interval_ms after the last Location encode
+static uint64_t next_push_ns(struct config_data *config) {
+    return location_push.encoded_ns + (uint64_t) config->push_interval_ms * 1000000ULL;
+}
+
+static uint8_t next_msg_counter(struct config_data *config, ODID_MsgCounter_t counter) {
+    uint8_t value = config->msg_counters[counter]++;
+    counter_updates[counter]++;
+    if (config->msg_counters[counter] == 0)
+        metrics_counter_wrap(counter);
+    return value;
 }
 
 static void send_message(union ODID_Message_encoded *encoded, struct config_data *config, uint8_t msg_counter) {
-    if (config->use_btl)
-        send_bluetooth_message(encoded, msg_counter, config);
-    if (config->use_bt4 || config->use_bt5)
-        send_bluetooth_message_extended_api(encoded, msg_counter, config);
-    if (config->use_beacon)
+    uint8_t message_type = encoded->rawData[0] >> 4;
+    if (transport_ready[TRANSPORT_BLUETOOTH]) {
+        if (config->use_btl)
+            send_bluetooth_message(encoded, msg_counter, config);
+        if (config->use_bt4 || config->use_bt5)
+            send_bluetooth_message_extended_api(encoded, msg_counter, config);
+        metrics_frame_sent(TRANSPORT_BLUETOOTH, message_type);
+        compliance_message(TRANSPORT_BLUETOOTH, message_type);
+        first_frame(TRANSPORT_BLUETOOTH);
+    }
+    if (config->use_beacon && transport_ready[TRANSPORT_BEACON]) {
         send_beacon_message(encoded, msg_counter);
-    usleep(100000);
+        metrics_frame_sent(TRANSPORT_BEACON, message_type);
+        compliance_message(TRANSPORT_BEACON, message_type);
+        first_frame(TRANSPORT_BEACON);
+    }
+    transports_updated();
+}
+
+static void push_location(struct ODID_UAS_Data *uasData, struct config_data *config) {
+    union ODID_Message_encoded encoded = { 0 };
+    encode_location(uasData, &encoded, config);
+    send_message(&encoded, config, next_msg_counter(config, ODID_MSG_COUNTER_LOCATION));
+    location_on_air();
+}
+
+// Waits between two single messages. A GPS fix arriving meanwhile is sent at once as an extra Location message
+static void message_gap(struct ODID_UAS_Data *uasData, struct config_data *config) {
+    unsigned int gap_us = config->use_beacon && transport_ready[TRANSPORT_BEACON] ? BEACON_MESSAGE_GAP_US
+                                                                                   : MESSAGE_GAP_US;
+    uint64_t end_ns = get_time_ns() + gap_us * 1000ULL;
+    while (!kill_program) {
+        uint64_t now_ns = get_time_ns();
+        uint64_t wake_ns = end_ns;
+        if (atomic_load(&fix_pending)) {
+            if (now_ns >= next_push_ns(config)) {
+                push_location(uasData, config);
+                continue;
+            }
+            wake_ns = MINIMUM(wake_ns, next_push_ns(config));
+        }
+        if (now_ns >= end_ns)
+            break;
+        wake_wait((wake_ns - now_ns) / 1000);
+    }
+}
+
+static void send_single(struct ODID_UAS_Data *uasData, union ODID_Message_encoded *encoded,
+                        struct config_data *config, uint8_t msg_counter) {
+    send_message(encoded, config, msg_counter);
+    message_gap(uasData, config);
 }
 
 // When using the WiFi Beacon transport method, the standards require that all messages are wrapped
@@ -166,45 +604,75 @@ static void send_single_messages(struct ODID_UAS_Data *uasData, struct config_da
     union ODID_Message_encoded encoded;
     memset(&encoded, 0, sizeof(union ODID_Message_encoded));
 
+    check_config_reload(uasData, config);
+    while (!any_transport_ready() && !kill_program)
+        wake_wait(1000000);
+
+    trace_begin(TRACE_TRANSMIT_LOOP, 0);
     for (int i = 0; i < 1; i++) {
         if (encodeBasicIDMessage((ODID_BasicID_encoded *) &encoded, &uasData->BasicID[BASIC_ID_POS_ZERO]) != ODID_SUCCESS)
             printf("Error: Failed to encode Basic ID\n");
-        send_message(&encoded, config, config->msg_counters[ODID_MSG_COUNTER_BASIC_ID]++);
+        send_single(uasData, &encoded, config, next_msg_counter(config, ODID_MSG_COUNTER_BASIC_ID));
         if (encodeBasicIDMessage((ODID_BasicID_encoded *) &encoded, &uasData->BasicID[BASIC_ID_POS_ONE]) != ODID_SUCCESS)
             printf("Error: Failed to encode Basic ID\n");
-        send_message(&encoded, config, config->msg_counters[ODID_MSG_COUNTER_BASIC_ID]++);
+        send_single(uasData, &encoded, config, next_msg_counter(config, ODID_MSG_COUNTER_BASIC_ID));
 
-        if (encodeLocationMessage((ODID_Location_encoded *) &encoded, &uasData->Location) != ODID_SUCCESS)
-            printf("Error: Failed to encode Location\n");
-        send_message(&encoded, config, config->msg_counters[ODID_MSG_COUNTER_LOCATION]++);
+        encode_location(uasData, &encoded, config);
+        send_message(&encoded, config, next_msg_counter(config, ODID_MSG_COUNTER_LOCATION));
+        location_on_air();
+        message_gap(uasData, config);
 
         if (encodeAuthMessage((ODID_Auth_encoded *) &encoded, &uasData->Auth[0]) != ODID_SUCCESS)
             printf("Error: Failed to encode Auth 0\n");
-        send_message(&encoded, config, config->msg_counters[ODID_MSG_COUNTER_AUTH]++);
+        send_single(uasData, &encoded, config, next_msg_counter(config, ODID_MSG_COUNTER_AUTH));
         if (encodeAuthMessage((ODID_Auth_encoded *) &encoded, &uasData->Auth[1]) != ODID_SUCCESS)
             printf("Error: Failed to encode Auth 1\n");
-        send_message(&encoded, config, config->msg_counters[ODID_MSG_COUNTER_AUTH]++);
+        send_single(uasData, &encoded, config, next_msg_counter(config, ODID_MSG_COUNTER_AUTH));
         if (encodeAuthMessage((ODID_Auth_encoded *) &encoded, &uasData->Auth[2]) != ODID_SUCCESS)
             printf("Error: Failed to encode Auth 2\n");
-        send_message(&encoded, config, config->msg_counters[ODID_MSG_COUNTER_AUTH]++);
+        send_single(uasData, &encoded, config, next_msg_counter(config, ODID_MSG_COUNTER_AUTH));
 
         if (encodeSelfIDMessage((ODID_SelfID_encoded *) &encoded, &uasData->SelfID) != ODID_SUCCESS)
             printf("Error: Failed to encode Self ID\n");
-        send_message(&encoded, config, config->msg_counters[ODID_MSG_COUNTER_SELF_ID]++);
+        send_single(uasData, &encoded, config, next_msg_counter(config, ODID_MSG_COUNTER_SELF_ID));
 
         if (encodeSystemMessage((ODID_System_encoded *) &encoded, &uasData->System) != ODID_SUCCESS)
             printf("Error: Failed to encode System\n");
-        send_message(&encoded, config, config->msg_counters[ODID_MSG_COUNTER_SYSTEM]++);
+        send_single(uasData, &encoded, config, next_msg_counter(config, ODID_MSG_COUNTER_SYSTEM));
 
         if (encodeOperatorIDMessage((ODID_OperatorID_encoded *) &encoded, &uasData->OperatorID) != ODID_SUCCESS)
             printf("Error: Failed to encode Operator ID\n");
-        send_message(&encoded, config, config->msg_counters[ODID_MSG_COUNTER_OPERATOR_ID]++);
+        send_single(uasData, &encoded, config, next_msg_counter(config, ODID_MSG_COUNTER_OPERATOR_ID));
     }
+    update_done(config);
+    trace_end(TRACE_TRANSMIT_LOOP);
+    if (replay_paced(config))
+        wait_replay_fix(config);
+}
+
+/*
+ * With a signing key, the pack carries BasicID 0 and 1, Location, System and Operator ID, followed by the
+ * Auth pages of the Message Set Signature covering these five messages. Self ID is left out to stay
+ * within the nine messages of a pack. The signature is computed on the signer thread, so the pages can
+ * belong to the previous message set for a short while after a change. Until the first signature is
+ * ready, the pack is sent without Auth messages.
+ */
+static void create_signed_messages(struct ODID_UAS_Data *uasData, ODID_MessagePack_data *pack_data) {
+    if (encodeSystemMessage((ODID_System_encoded *) &pack_data->Messages[3], &uasData->System) != ODID_SUCCESS)
+        printf("Error: Failed to encode System\n");
+    if (encodeOperatorIDMessage((ODID_OperatorID_encoded *) &pack_data->Messages[4],
+                                &uasData->OperatorID) != ODID_SUCCESS)
+        printf("Error: Failed to encode Operator ID\n");
+    int pages = auth_signer_update(pack_data->Messages, PACK_SIGNED_MESSAGES,
+                                   (ODID_Auth_encoded *) &pack_data->Messages[PACK_SIGNED_MESSAGES]);
+    pack_data->MsgPackSize = PACK_SIGNED_MESSAGES + pages;
 }
 
-static void create_message_pack(struct ODID_UAS_Data *uasData, struct ODID_MessagePack_encoded *pack_enc) {
+static void create_message_pack(struct ODID_UAS_Data *uasData, struct ODID_MessagePack_encoded *pack_enc,
+                                struct config_data *config) {
     union ODID_Message_encoded encoded = { 0 };
     ODID_MessagePack_data pack_data = { 0 };
+    trace_begin(TRACE_CREATE_MESSAGE_PACK, 0);
     pack_data.SingleMessageSize = ODID_MESSAGE_SIZE;
     pack_data.MsgPackSize = 9;
     if (encodeBasicIDMessage((ODID_BasicID_encoded *) &encoded, &uasData->BasicID[BASIC_ID_POS_ZERO]) != ODID_SUCCESS)
@@ -213,55 +681,174 @@ static void create_message_pack(struct ODID_UAS_Data *uasData, struct ODID_Messa
     if (encodeBasicIDMessage((ODID_BasicID_encoded *) &encoded, &uasData->BasicID[BASIC_ID_POS_ONE]) != ODID_SUCCESS)
         printf("Error: Failed to encode Basic ID\n");
     memcpy(&pack_data.Messages[1], &encoded, ODID_MESSAGE_SIZE);
-    if (encodeLocationMessage((ODID_Location_encoded *) &encoded, &uasData->Location) != ODID_SUCCESS)
-        printf("Error: Failed to encode Location\n");
-    memcpy(&pack_data.Messages[2], &encoded, ODID_MESSAGE_SIZE);
-    if (encodeAuthMessage((ODID_Auth_encoded *) &encoded, &uasData->Auth[0]) != ODID_SUCCESS)
-        printf("Error: Failed to encode Auth 0\n");
-    memcpy(&pack_data.Messages[3], &encoded, ODID_MESSAGE_SIZE);
-    if (encodeAuthMessage((ODID_Auth_encoded *) &encoded, &uasData->Auth[1]) != ODID_SUCCESS)
-        printf("Error: Failed to encode Auth 1\n");
-    memcpy(&pack_data.Messages[4], &encoded, ODID_MESSAGE_SIZE);
-    if (encodeAuthMessage((ODID_Auth_encoded *) &encoded, &uasData->Auth[2]) != ODID_SUCCESS)
-        printf("Error: Failed to encode Auth 2\n");
-    memcpy(&pack_data.Messages[5], &encoded, ODID_MESSAGE_SIZE);
-    if (encodeSelfIDMessage((ODID_SelfID_encoded *) &encoded, &uasData->SelfID) != ODID_SUCCESS)
-        printf("Error: Failed to encode Self ID\n");
-    memcpy(&pack_data.Messages[6], &encoded, ODID_MESSAGE_SIZE);
-    if (encodeSystemMessage((ODID_System_encoded *) &encoded, &uasData->System) != ODID_SUCCESS)
-        printf("Error: Failed to encode System\n");
-    memcpy(&pack_data.Messages[7], &encoded, ODID_MESSAGE_SIZE);
-    if (encodeOperatorIDMessage((ODID_OperatorID_encoded *) &encoded, &uasData->OperatorID) != ODID_SUCCESS)
-        printf("Error: Failed to encode Operator ID\n");
-    memcpy(&pack_data.Messages[8], &encoded, ODID_MESSAGE_SIZE);
+    encode_location(uasData, &encoded, config);
+    memcpy(&pack_data.Messages[PACK_LOCATION_POS], &encoded, ODID_MESSAGE_SIZE);
+    if (config->auth_key_file[0]) {
+        create_signed_messages(uasData, &pack_data);
+    } else {
+        if (encodeAuthMessage((ODID_Auth_encoded *) &encoded, &uasData->Auth[0]) != ODID_SUCCESS)
+            printf("Error: Failed to encode Auth 0\n");
+        memcpy(&pack_data.Messages[3], &encoded, ODID_MESSAGE_SIZE);
+        if (encodeAuthMessage((ODID_Auth_encoded *) &encoded, &uasData->Auth[1]) != ODID_SUCCESS)
+            printf("Error: Failed to encode Auth 1\n");
+        memcpy(&pack_data.Messages[4], &encoded, ODID_MESSAGE_SIZE);
+        if (encodeAuthMessage((ODID_Auth_encoded *) &encoded, &uasData->Auth[2]) != ODID_SUCCESS)
+            printf("Error: Failed to encode Auth 2\n");
+        memcpy(&pack_data.Messages[5], &encoded, ODID_MESSAGE_SIZE);
+        if (encodeSelfIDMessage((ODID_SelfID_encoded *) &encoded, &uasData->SelfID) != ODID_SUCCESS)
+            printf("Error: Failed to encode Self ID\n");
+        memcpy(&pack_data.Messages[6], &encoded, ODID_MESSAGE_SIZE);
+        if (encodeSystemMessage((ODID_System_encoded *) &encoded, &uasData->System) != ODID_SUCCESS)
+            printf("Error: Failed to encode System\n");
+        memcpy(&pack_data.Messages[7], &encoded, ODID_MESSAGE_SIZE);
+        if (encodeOperatorIDMessage((ODID_OperatorID_encoded *) &encoded, &uasData->OperatorID) != ODID_SUCCESS)
+            printf("Error: Failed to encode Operator ID\n");
+        memcpy(&pack_data.Messages[8], &encoded, ODID_MESSAGE_SIZE);
+    }
     if (encodeMessagePack(pack_enc, &pack_data) != ODID_SUCCESS)
         printf("Error: Failed to encode message pack_data\n");
+    trace_end(TRACE_CREATE_MESSAGE_PACK);
+}
+
+/*
+ * The encoder quantizes the Location fields (e.g. 1e-7 degrees, 0.5 m altitude, 0.25 m/s speed), so most
+ * GPS reports while hovering produce the same on-air bytes. The pack is only uploaded when the encoded
+ * bytes differ from the previous upload, or when it is older than the refresh interval. A pack that only
+ * differs in the Location timestamp is uploaded once the on-air timestamp is LOCATION_REFRESH_MS old.
+ * The refresh interval is capped at PACK_REFRESH_MAX_MS, so the pack on air is never older than the update
+ * rate compliance allows, also without GPS fixes.
+ */
+static int pack_refresh_ms(struct config_data *config) {
+    return MINIMUM(config->pack_refresh_ms, PACK_REFRESH_MAX_MS);
+}
+
+static bool pack_needs_upload(const struct ODID_MessagePack_encoded *pack_enc, struct config_data *config) {
+    const uint8_t *new_bytes = (const uint8_t *) pack_enc;
+    const uint8_t *old_bytes = (const uint8_t *) &uploaded_pack.pack_enc;
+    size_t timestamp = offsetof(struct ODID_MessagePack_encoded, Messages) +
+                       PACK_LOCATION_POS * ODID_MESSAGE_SIZE + LOCATION_TIMESTAMP_OFFSET;
+    size_t rest = timestamp + LOCATION_TIMESTAMP_SIZE;
+    uint64_t now_ns = get_time_ns();
+    int refresh_ms = pack_refresh_ms(config);
+    if (memcmp(new_bytes + timestamp, old_bytes + timestamp, LOCATION_TIMESTAMP_SIZE) != 0)
+        refresh_ms = MINIMUM(refresh_ms, LOCATION_REFRESH_MS);
+
+    uploaded_pack.checks++;
+    if (!atomic_exchange(&transports_changed, false) && uploaded_pack.valid &&
+        now_ns - uploaded_pack.uploaded_ns < (uint64_t) refresh_ms * 1000000ULL &&
+        memcmp(new_bytes, old_bytes, timestamp) == 0 &&
+        memcmp(new_bytes + rest, old_bytes + rest, sizeof(*pack_enc) - rest) == 0) {
+        uploaded_pack.skipped++;
+        return false;
+    }
+
+    memcpy(&uploaded_pack.pack_enc, pack_enc, sizeof(*pack_enc));
+    uploaded_pack.uploaded_ns = now_ns;
+    uploaded_pack.valid = true;
+    return true;
+}
+
+// Time until the uploaded pack must be refreshed, at most UPDATE_PERIOD_US
+static unsigned int pack_refresh_wait_us(struct config_data *config) {
+    if (!uploaded_pack.valid)
+        return UPDATE_PERIOD_US;
+    uint64_t due_ns = uploaded_pack.uploaded_ns + (uint64_t) pack_refresh_ms(config) * 1000000ULL;
+    uint64_t now_ns = get_time_ns();
+    return due_ns > now_ns ? (unsigned int) MINIMUM((due_ns - now_ns) / 1000, UPDATE_PERIOD_US) : 0;
+}
+
+/*
+ * Waits until the next message pack update is due. That is when the uploaded pack must be refreshed, or
+ * earlier when a GPS fix arrives or a transport becomes ready. Updates are spaced by at least
+ * push_interval_ms, so a fast GPS receiver cannot push more updates than hostapd and the Bluetooth
+ * controller take. A replayed fix wakes the loop like a live one, so the update rate follows the replay
+ * speed. A replay with w 0 keeps its handshake of one update per fix.
+ */
+static void wait_pack_update(struct config_data *config) {
+    if (replay_paced(config)) {
+        wait_replay_fix(config);
+        return;
+    }
+    trace_begin(TRACE_SLEEP, 0);
+    wake_wait(pack_refresh_wait_us(config));
+    uint64_t now_ns = get_time_ns();
+    if (!kill_program && now_ns < next_push_ns(config))
+        vclock_sleep_until(next_push_ns(config));
+    trace_end(TRACE_SLEEP);
 }
 
 static void send_packs(struct ODID_UAS_Data *uasData, struct config_data *config) {
     struct ODID_MessagePack_encoded pack_enc = { 0 };
-    create_message_pack(uasData, &pack_enc);
+    uint64_t end_ns = get_time_ns() + PACK_ROUND_NS;
 
-    for (int i = 0; i < 10; i++) {
-        if (config->use_beacon)
-            send_beacon_message_pack(&pack_enc, config->msg_counters[ODID_MSG_COUNTER_PACKED]++);
-        if (config->use_bt5)
-            send_bluetooth_message_pack(&pack_enc, config->msg_counters[ODID_MSG_COUNTER_PACKED]++, config);
-        sleep(4);
+    for (int i = 0; get_time_ns() < end_ns && !kill_program; i++) {
+        trace_begin(TRACE_TRANSMIT_LOOP, i);
+        check_config_reload(uasData, config);
+        // The pack is rebuilt right before each transmission, so it carries the latest (extrapolated) position
+        create_message_pack(uasData, &pack_enc, config);
+        if (pack_needs_upload(&pack_enc, config)) {
+            if (config->use_nan && transport_ready[TRANSPORT_NAN]) {
+                nan_update_pack(&pack_enc);
+                first_frame(TRANSPORT_NAN);
+            }
+            if (config->use_beacon && transport_ready[TRANSPORT_BEACON]) {
+                send_beacon_message_pack(&pack_enc, next_msg_counter(config, ODID_MSG_COUNTER_PACKED));
+                metrics_frame_sent(TRANSPORT_BEACON, ODID_MESSAGETYPE_PACKED);
+                compliance_pack(TRANSPORT_BEACON, &pack_enc);
+                first_frame(TRANSPORT_BEACON);
+            }
+            if (config->use_bt5 && transport_ready[TRANSPORT_BLUETOOTH]) {
+                send_bluetooth_message_pack(&pack_enc, next_msg_counter(config, ODID_MSG_COUNTER_PACKED), config);
+                metrics_frame_sent(TRANSPORT_BLUETOOTH, ODID_MESSAGETYPE_PACKED);
+                compliance_pack(TRANSPORT_BLUETOOTH, &pack_enc);
+                first_frame(TRANSPORT_BLUETOOTH);
+            }
+            transports_updated();
+        }
+        location_on_air();
+        update_done(config);
+        trace_end(TRACE_TRANSMIT_LOOP);
+        wait_pack_update(config);
     }
+
+    if (uploaded_pack.checks > 0)
+        printf("Message pack: %d of %d uploads skipped as unchanged (%.0f %%)\n", uploaded_pack.skipped,
+               uploaded_pack.checks, 100.0 * uploaded_pack.skipped / uploaded_pack.checks);
 }
 
 void print_help() {
     printf("Program for transmitting static drone ID data on Wi-Fi Beacon or Bluetooth.\n");
     printf("Must be run with sudo rights in order to work.\n");
     printf("Options: b Enable Wi-Fi Beacon transmission\n");
+    printf("         m Update all hostapd interfaces found in /var/run/hostapd (multi-radio Beacon)\n");
     printf("         l Enable Bluetooth 4 Legacy Advertising transmission\n");
     printf("           using the non-Extended Advertising HCI API commands\n");
     printf("         4 Enable Bluetooth 4 Legacy Advertising transmission\n");
     printf("           using the Extended Advertising HCI API commands\n");
     printf("         5 Enable Bluetooth 5 Long Range + Extended Advertising transmission\n");
+    printf("         n <interface> Enable Wi-Fi NAN transmission on the given monitor mode interface\n");
     printf("         p Use message packs instead of single messages\n");
-    printf("         g Use gpsd to dynamically update location messages after each loop of messages\n");
+    printf("         g Use gpsd to update the Location message as soon as each new fix arrives\n");
+    printf("         s <device>[:<baudrate>] Read NMEA/UBX directly from a serial port instead of gpsd\n");
+    printf("         r <file> Replay a flight log (.csv, .gpx or gpsd JSON) instead of using a GPS receiver\n");
+    printf("         w <factor> Replay speed. 1 = real time, 0 = as fast as the transmissions allow\n");
+    printf("         c <file> Load the configuration file. It is re-read on SIGHUP or when it changes\n");
+    printf("         a Adopt the advertising state handed over by a previous instance (see SIGUSR1)\n");
+    printf("         t <file> Capture the HCI commands and events to a btsnoop file\n");
+    printf("         M <socket> Serve Prometheus metrics on the given Unix socket path\n");
+    printf("         x <milliseconds> Extrapolate the GPS position to the transmit time, up to the given fix age\n");
+    printf("         R Real-time mode: Lock the memory and run the transmit, HCI and GPS threads with SCHED_FIFO\n");
+    printf("         k <file> Sign the message packs with this Ed25519 private key (PEM), using Auth messages\n");
+    printf("         --profile-controller [<iterations>] Time a fixed HCI command workload on the Bluetooth\n");
+    printf("           controller and print the round-trip percentiles per command. Nothing is transmitted\n");
+    printf("         --stress-controller [<seconds>] Ramp the advertising data update rate on the Bluetooth\n");
+    printf("           controller for each advertising mode and report the sustained maximum\n");
+    printf("         --bench-location [<messages>] Check the fixed-point Location encoder against the reference\n");
+    printf("           encoder and time both. Nothing is transmitted\n");
+    printf("         --bench-batch [<UAS>] Check the batch Location encoder for a random fleet against the\n");
+    printf("           reference encoder and measure its throughput per core. Nothing is transmitted\n");
+    printf("         --simulate [<seconds>] Run on a simulated clock with mock Bluetooth, hostapd and NAN backends\n");
+    printf("           for the given simulated time (default 3600 s) and report the counters and memory use\n");
     printf("E.g. sudo ./transmit b p\n\n");
     printf("Wi-Fi Beacon transmit only works when running\n");
     printf("\"sudo hostapd/hostapd/hostapd beacon.conf\" in a separate shell.\n");
@@ -285,6 +872,9 @@ static void parse_command_line(int argc, char *argv[], struct config_data *confi
             case 'b':
                 config->use_beacon = true;
                 break;
+            case 'm':
+                config->use_multi_beacon = true;
+                break;
             case 'l':
                 config->use_btl = true;
                 break;
@@ -294,18 +884,128 @@ static void parse_command_line(int argc, char *argv[], struct config_data *confi
             case '5':
                 config->use_bt5 = true;
                 break;
+            case 'n':
+                if (i + 1 >= argc) {
+                    printf("\nError: Option n requires a monitor mode interface name.\n\n");
+                    exit(EXIT_FAILURE);
+                }
+                config->use_nan = true;
+                strncpy(config->nan_iface, argv[++i], sizeof(config->nan_iface) - 1);
+                break;
+            case 'r':
+                if (i + 1 >= argc) {
+                    printf("\nError: Option r requires a flight log file.\n\n");
+                    exit(EXIT_FAILURE);
+                }
+                config->use_gps = true;
+                strncpy(config->replay_file, argv[++i], sizeof(config->replay_file) - 1);
+                break;
+            case 'w':
+                if (i + 1 >= argc) {
+                    printf("\nError: Option w requires a replay speed factor.\n\n");
+                    exit(EXIT_FAILURE);
+                }
+                config->replay_warp = atof(argv[++i]);
+                break;
+            case 'a':
+                config->adopt_state = true;
+                break;
+            case 'R':
+                config->realtime = true;
+                break;
+            case 't':
+                if (i + 1 >= argc) {
+                    printf("\nError: Option t requires a file name.\n\n");
+                    exit(EXIT_FAILURE);
+                }
+                strncpy(config->btsnoop_file, argv[++i], sizeof(config->btsnoop_file) - 1);
+                break;
+            case 'M':
+                if (i + 1 >= argc) {
+                    printf("\nError: Option M requires a socket path.\n\n");
+                    exit(EXIT_FAILURE);
+                }
+                strncpy(config->metrics_socket, argv[++i], sizeof(config->metrics_socket) - 1);
+                break;
+            case 'c':
+                if (i + 1 >= argc) {
+                    printf("\nError: Option c requires a configuration file.\n\n");
+                    exit(EXIT_FAILURE);
+                }
+                strncpy(config->config_file, argv[++i], sizeof(config->config_file) - 1);
+                break;
+            case 'x':
+                if (i + 1 >= argc) {
+                    printf("\nError: Option x requires the maximum extrapolation time in milliseconds.\n\n");
+                    exit(EXIT_FAILURE);
+                }
+                config->extrapolate_max_ms = atoi(argv[++i]);
+                break;
             case 'p':
                 config->use_packs = true;
                 break;
+            case 'k':
+                if (i + 1 >= argc) {
+                    printf("\nError: Option k requires an Ed25519 private key file.\n\n");
+                    exit(EXIT_FAILURE);
+                }
+                strncpy(config->auth_key_file, argv[++i], sizeof(config->auth_key_file) - 1);
+                break;
             case 'g':
                 config->use_gps = true;
                 break;
+            case 's': {
+                if (i + 1 >= argc) {
+                    printf("\nError: Option s requires a serial device.\n\n");
+                    exit(EXIT_FAILURE);
+                }
+                config->use_gps = true;
+                strncpy(config->gps_serial, argv[++i], sizeof(config->gps_serial) - 1);
+                char *baudrate = strchr(config->gps_serial, ':');
+                if (baudrate) {
+                    *baudrate = '\0';
+                    config->gps_baudrate = atoi(baudrate + 1);
+                }
+                break;
+            }
+            case '-':
+                if (strcmp(argv[i], "--profile-controller") == 0) {
+                    config->profile_iterations = HCI_PROFILE_DEFAULT_ITERATIONS;
+                    if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                        config->profile_iterations = atoi(argv[++i]);
+                } else if (strcmp(argv[i], "--stress-controller") == 0) {
+                    config->stress_step_s = BT_STRESS_DEFAULT_STEP_S;
+                    if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                        config->stress_step_s = atoi(argv[++i]);
+                } else if (strcmp(argv[i], "--bench-location") == 0) {
+                    config->bench_location_messages = LOCATION_FIXED_DEFAULT_MESSAGES;
+                    if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                        config->bench_location_messages = atoi(argv[++i]);
+                } else if (strcmp(argv[i], "--simulate") == 0) {
+                    config->simulate_s = VCLOCK_DEFAULT_SIMULATE_S;
+                    if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                        config->simulate_s = atoi(argv[++i]);
+                } else if (strcmp(argv[i], "--bench-batch") == 0) {
+                    config->bench_batch_uas = LOCATION_BATCH_DEFAULT_UAS;
+                    if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                        config->bench_batch_uas = atoi(argv[++i]);
+                } else {
+                    printf("\nError: Unknown option %s.\n\n", argv[i]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             default:
                 break;
         }
     }
-    if (config->use_beacon)
+    if (config->profile_iterations > 0 || config->stress_step_s > 0 || config->bench_location_messages > 0 ||
+        config->bench_batch_uas > 0)
+        return;
+
+    if (config->use_beacon && config->simulate_s == 0)
         printf("\nReminder: Wi-Fi Beacon only works when running\n\"sudo hostapd/hostapd/hostapd beacon.conf\" in a separate shell.\n\n");
+    if (config->use_multi_beacon && !config->use_beacon)
+        printf("\nWarning: Option m has no effect without Wi-Fi Beacon (option b).\n\n");
     if (config->use_beacon && !config->use_packs)
         printf("\nWarning: Transmitting single messages on Wi-Fi beacon is violating\nthe standards. Enable message packs.\n\n");
 
@@ -317,87 +1017,269 @@ static void parse_command_line(int argc, char *argv[], struct config_data *confi
         printf("\nError: BT4 cannot use message packs.\n\n");
         exit(EXIT_FAILURE);
     }
+    if (config->use_nan && !config->use_packs) {
+        printf("\nError: Wi-Fi NAN requires message packs.\n\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config->auth_key_file[0] && !config->use_packs) {
+        printf("\nError: Option k requires message packs (p).\n\n");
+        exit(EXIT_FAILURE);
+    }
     if (config->use_bt4 && config->use_bt5)
         printf("\nWarning: Doing simultaneous BT4 and BT5 will not necessarily work.\n\n");
     if (config->use_bt5 && !config->use_packs)
         printf("\nWarning: Transmitting single messages on Bluetooth 5 Long Range is violating\nthe standards. Enable message packs.\n\n");
 
-    if (!config->use_beacon && !config->use_btl && !config->use_bt4 && !config->use_bt5) {
+    if (!config->use_beacon && !config->use_nan && !config->use_btl && !config->use_bt4 && !config->use_bt5) {
         print_help();
         exit(EXIT_SUCCESS);
     }
 
-    if (config->use_gps)
+    if (config->simulate_s > 0 && config->use_gps && !config->replay_file[0]) {
+        printf("\nError: The simulation uses a flight log replay (r) as GPS source instead of g or s.\n\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config->use_gps && !config->replay_file[0])
         printf("\nWarning: Fetching GPS data requires a configured GPS sensor.\n\n");
+    if (config->replay_warp < 0) {
+        printf("\nError: The replay speed factor cannot be negative.\n\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config->extrapolate_max_ms > 0 && !config->use_gps)
+        printf("\nWarning: Option x has no effect without a GPS source (option g or s).\n\n");
+}
+
+static double thread_cpu_us() {
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
 }
 
 void gps_loop(struct gps_loop_args *args) {
     struct gps_data_t *gpsdata = args->gpsdata;
     struct ODID_UAS_Data *uasData = args->uasData;
+    struct gpsd_client *client = args->client;
+    struct gps_serial *serial = args->serial;
+    int fd = serial ? serial->fd : client->fd;
+
+    pthread_setname_np(pthread_self(), "gps");
+    trace_register_thread(); // Allocates the trace ring before the alloc guard is armed
+    realtime_thread(REALTIME_GPS);
+    args->exit_status = 0;
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        fprintf(stderr, "Failed to register the GPS source with epoll, exiting...");
+        kill_program = true;
+        args->exit_status = 1;
+        pthread_exit((void*) &args->exit_status);
+    }
 
-    char gpsd_message[GPS_JSON_RESPONSE_MAX];
     int retries = 0;      // cycles to wait before gpsd timeout
     int read_retries = 0;
+    int cpu_fixes = 0;
+    double cpu_start_us = thread_cpu_us();
+    uint64_t wall_start_ns = get_time_ns();
     while(true) {
         if(kill_program)
             break;
 
-        int ret;
-        ret = gps_waiting(gpsdata, GPS_WAIT_TIME_MICROSECS);
-        if (!ret) {
+        struct epoll_event ready;
+        int ret = epoll_wait(epoll_fd, &ready, 1, GPS_WAIT_TIME_MICROSECS / 1000);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
             printf("Socket not ready, retrying...\n");
             if (retries++ > MAX_GPS_WAIT_RETRIES) {
-                    fprintf(stderr, "Max socket wait retries reached, exiting...");
+                fprintf(stderr, "Max socket wait retries reached, exiting...");
                 kill_program = true;
                 args->exit_status = 1;
-                pthread_exit((void*) &args->exit_status);
+                break;
             }
             continue;
-        } else {
-            retries = 0;
-            gpsd_message[0] = '\0';
-
-            if (gps_read(gpsdata, gpsd_message, sizeof(gpsd_message)) == -1) {
-                printf("Failed to read from socket, retrying...\n");
-                if(read_retries++ > MAX_GPS_READ_RETRIES) {
-                    fprintf(stderr, "Max socket read retries reached, exiting...");
-                    kill_program = true;
-                    args->exit_status = 1;
-                    pthread_exit((void*) &args->exit_status);
-                }
-                continue;
+        }
+        retries = 0;
+
+        uint64_t received_ns = get_time_ns();
+        int fixes = serial ? gps_serial_read(serial, gpsdata) : gpsd_client_read(client, gpsdata);
+        if (fixes < 0) {
+            printf("Failed to read from socket, retrying...\n");
+            if(read_retries++ > MAX_GPS_READ_RETRIES) {
+                fprintf(stderr, "Max socket read retries reached, exiting...");
+                kill_program = true;
+                args->exit_status = 1;
+                break;
             }
-            read_retries = 0;
+            continue;
+        }
+        read_retries = 0;
+        if (fixes == 0)
+            continue;
 
-            process_gps_data(gpsdata, uasData);
+        process_gps_data(gpsdata, uasData);
+        gps_fix_received(gpsdata, uasData, received_ns);
+        fix_arrived();
+        realtime_latency(REALTIME_GPS, get_time_ns() - received_ns);
+
+        cpu_fixes += fixes;
+        if (cpu_fixes >= GPS_CPU_REPORT_FIXES) {
+            double cpu_us = thread_cpu_us();
+            uint64_t wall_ns = get_time_ns();
+            printf("GPS: %d fixes at %.1f Hz, %.1f us CPU per fix\n", cpu_fixes,
+                   cpu_fixes / ((double) (wall_ns - wall_start_ns) / 1e9), (cpu_us - cpu_start_us) / cpu_fixes);
+            cpu_fixes = 0;
+            cpu_start_us = cpu_us;
+            wall_start_ns = wall_ns;
         }
     }
 
+    close(epoll_fd);
+    alloc_guard_exempt_thread(); // The program is stopping. pthread_exit() loads the unwinder on first use
+    pthread_exit(&args->exit_status);
+}
+
+void replay_loop(struct gps_loop_args *args) {
+    struct gps_data_t *gpsdata = args->gpsdata;
+    struct ODID_UAS_Data *uasData = args->uasData;
+    struct replay *log = args->replay;
+    int fixes = 0;
+
+    pthread_setname_np(pthread_self(), "replay");
+    trace_register_thread(); // Allocates the trace ring before the alloc guard is armed
+    realtime_thread(REALTIME_GPS);
     args->exit_status = 0;
+    while (!kill_program && replay_next(log, gpsdata) > 0) {
+        uint64_t received_ns = get_time_ns();
+        process_gps_data(gpsdata, uasData);
+        gps_fix_received(gpsdata, uasData, received_ns);
+        replay_fix_ready(log);
+        if (log->warp > 0)
+            fix_arrived();
+        fixes++;
+    }
+
+    if (fixes > 0) {
+        double seconds = (double) (get_time_ns() - log->start_ns) / 1e9;
+        printf("Replay: %d fixes in %.3f s (%.1f fixes/s)\n", fixes, seconds, fixes / seconds);
+    }
+    kill_program = true;
+    replay_finish(log);
+    vclock_sem_post(&transmit_wake);
+    alloc_guard_exempt_thread(); // The program is stopping. pthread_exit() loads the unwinder on first use
     pthread_exit(&args->exit_status);
 }
 
 int main(int argc, char *argv[])
 {
+    start_ns = get_time_ns();
+    sem_init(&transmit_wake, 0, 0);
+
+    config.nan_interval_ms = NAN_DEFAULT_INTERVAL_MS;
+    config.gps_baudrate = GPS_SERIAL_DEFAULT_BAUDRATE;
+    config.pack_refresh_ms = PACK_REFRESH_MAX_MS;
+    config.push_interval_ms = PUSH_INTERVAL_DEFAULT_MS;
+    config.rt_priority[REALTIME_TRANSMIT] = REALTIME_DEFAULT_TRANSMIT_PRIORITY;
+    config.rt_priority[REALTIME_HCI] = REALTIME_DEFAULT_HCI_PRIORITY;
+    config.rt_priority[REALTIME_GPS] = REALTIME_DEFAULT_GPS_PRIORITY;
+    for (int i = 0; i < REALTIME_THREAD_AMOUNT; i++)
+        config.rt_cpu[i] = -1;
+    config.rt_deadline_us = REALTIME_DEFAULT_DEADLINE_US;
+    config.replay_warp = REPLAY_DEFAULT_WARP;
+    config.interval_btl_ms = BT_LEGACY_DEFAULT_INTERVAL_MS;
+    config.interval_bt4_ms = BT4_DEFAULT_INTERVAL_MS;
+    config.interval_bt5_ms = BT5_DEFAULT_INTERVAL_MS;
+
     parse_command_line(argc, argv, &config);
+    if (config.bench_location_messages > 0)
+        exit(location_fixed_benchmark(config.bench_location_messages) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    if (config.bench_batch_uas > 0)
+        exit(location_batch_benchmark(config.bench_batch_uas) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    if (config.profile_iterations > 0 || config.stress_step_s > 0) {
+        if (config.btsnoop_file[0] && btsnoop_open(config.btsnoop_file) != 0)
+            exit(EXIT_FAILURE);
+        if (config.profile_iterations > 0)
+            profile_bluetooth_controller(config.profile_iterations);
+        else
+            stress_bluetooth_controller(config.stress_step_s);
+        btsnoop_close();
+        exit(EXIT_SUCCESS);
+    }
+    if (config.simulate_s > 0) {
+        vclock_simulate();
+        start_ns = get_time_ns(); // The start-up times are measured on the simulated clock
+    }
+    signal(SIGUSR1, sig_handler);
+    signal(SIGUSR2, sig_handler);
 
     config.handle_bt4 = 0; // The Extended Advertising set number used for BT4
     config.handle_bt5 = 1; // The Extended Advertising set number used for BT5
 
-    if (config.use_beacon) {
-        sem_init(&semaphore,0,0);
-        pthread_create(&id, NULL, ap_interface_init, NULL);
-        sem_wait(&semaphore);
-    }
-
     struct ODID_UAS_Data uasData;
     odid_initUasData(&uasData);
     fill_example_data(&uasData);
     if(!config.use_gps)
         fill_example_gps_data(&uasData);
 
-    if (config.use_btl || config.use_bt4 || config.use_bt5)
-        init_bluetooth(&config);
+    if (config.config_file[0]) {
+        if (config_file_load(config.config_file, &config, &uasData) != 0)
+            cleanup(EXIT_FAILURE);
+        if (config_file_watch(config.config_file) != 0)
+            printf("Warning: Unable to watch %s for changes. Use SIGHUP to reload it\n", config.config_file);
+        signal(SIGHUP, sig_handler);
+    }
+
+    struct handover_state state;
+    if (config.adopt_state && handover_load(HANDOVER_STATE_FILE, &state) == 0) {
+        if (state.use_btl != config.use_btl || state.use_bt4 != config.use_bt4 ||
+            state.use_bt5 != config.use_bt5 || state.use_packs != config.use_packs) {
+            printf("The handover state is for different transports. Starting from scratch\n");
+        } else {
+            handover = state;
+            handover_adopted = true;
+            config.handle_bt4 = state.handle_bt4;
+            config.handle_bt5 = state.handle_bt5;
+            memcpy(config.msg_counters, state.msg_counters, sizeof(config.msg_counters));
+            uploaded_pack.valid = state.pack_valid;
+            memcpy(&uploaded_pack.pack_enc, &state.pack_enc, sizeof(uploaded_pack.pack_enc));
+            uploaded_pack.uploaded_ns = get_time_ns();
+            adopted_update_ns = state.last_update_ns;
+            printf("Adopted the handover state written %.1f ms ago\n",
+                   (double) (handover_realtime_ns() - state.written_ns) / 1e6);
+        }
+    }
+
+    memcpy(counters_start, config.msg_counters, sizeof(counters_start));
+
+    // Before any thread is started, so that all of their memory is locked
+    if (realtime_start(&config) != 0)
+        cleanup(EXIT_FAILURE);
+    if (config.metrics_socket[0] && metrics_start(config.metrics_socket) != 0)
+        cleanup(EXIT_FAILURE);
+    if (compliance_start() != 0)
+        printf("Warning: Unable to start the update rate compliance monitor\n");
+    if (config.auth_key_file[0] && auth_signer_start(config.auth_key_file, signature_published) != 0)
+        cleanup(EXIT_FAILURE);
+
+    // hostapd, Bluetooth and the GPS source are brought up concurrently
+    if (config.use_beacon) {
+        sem_init(&semaphore,0,0);
+        vclock_thread_create(&id, hostapd_ctrl_init, NULL);
+        vclock_thread_create(&beacon_init_thread, beacon_init, NULL);
+        pthread_detach(beacon_init_thread);
+    }
+
+    if (config.use_btl || config.use_bt4 || config.use_bt5) {
+        if (config.btsnoop_file[0] && btsnoop_open(config.btsnoop_file) != 0)
+            cleanup(EXIT_FAILURE);
+        vclock_thread_create(&bluetooth_init_thread, bluetooth_init, NULL);
+        bluetooth_init_started = true;
+    }
+
+    if (config.use_nan) {
+        if (init_nan(&config) != 0)
+            cleanup(EXIT_FAILURE);
+        set_transport_ready(TRANSPORT_NAN);
+    }
 
     if(config.use_gps) {
         signal(SIGINT,  sig_handler);
@@ -405,17 +1287,34 @@ int main(int argc, char *argv[])
         signal(SIGSTOP, sig_handler);
         signal(SIGTERM, sig_handler);
 
-        if(init_gps(&source, &gpsdata) != 0) {
+        if (config.replay_file[0]) {
+            if (replay_open(&replay, config.replay_file, config.replay_warp) != 0)
+                cleanup(EXIT_FAILURE);
+        } else if (config.gps_serial[0]) {
+            if (gps_serial_open(&gps_serial, config.gps_serial, config.gps_baudrate) != 0) {
+                fprintf(stderr, "Failed to open %s: %s\n", config.gps_serial, strerror(errno));
+                cleanup(EXIT_FAILURE);
+            }
+        } else if(init_gps(&source, &gps_client) != 0) {
             fprintf(stderr,
                     "No gpsd running or network error: %d, %s\n",
-                    errno, gps_errstr(errno));
+                    errno, strerror(errno));
             cleanup(EXIT_FAILURE);
         }
 
+        printf("GPS source ready after %.1f ms\n", (double) (get_time_ns() - start_ns) / 1e6);
+
         struct gps_loop_args args;
         args.gpsdata = &gpsdata;
+        args.client = &gps_client;
+        args.serial = config.gps_serial[0] ? &gps_serial : NULL;
+        args.replay = &replay;
         args.uasData = &uasData;
-        pthread_create(&gps_thread, NULL, (void*) &gps_loop, &args);
+        if (config.replay_file[0])
+            vclock_thread_create(&gps_thread, (void*) &replay_loop, &args);
+        else
+            vclock_thread_create(&gps_thread, (void*) &gps_loop, &args);
+        realtime_thread(REALTIME_TRANSMIT);
 
         while (true)
         {
@@ -429,11 +1328,15 @@ int main(int argc, char *argv[])
                 send_single_messages(&uasData, &config);
         }
     } else {
-        if (config.use_packs)
-            send_packs(&uasData, &config);
-        else
-            send_single_messages(&uasData, &config);
+        realtime_thread(REALTIME_TRANSMIT);
+        // A simulation runs for its whole duration instead of a single round
+        do {
+            if (config.use_packs)
+                send_packs(&uasData, &config);
+            else
+                send_single_messages(&uasData, &config);
+        } while (config.simulate_s > 0 && !kill_program);
     }
 
-    cleanup(EXIT_SUCCESS);
+    cleanup(startup_failed ? EXIT_FAILURE : EXIT_SUCCESS);
 }
@@ -10,6 +10,7 @@
  */
 
 #include "utils.h"
+#include "vclock.h"
 
 // Convert a single uint8_t to two chars representing the value in ASCII format
 // 0 - 9 => 0x30 - 0x39, A - F => 0x41 - 0x46
@@ -29,3 +30,7 @@ void uchar_to_ascii(char *out, uint8_t in) {
         *out = (char) (0x41 + low - 0xA);
 }
 
+// Monotonic time in nanoseconds, used for measuring latencies. Simulated with --simulate
+uint64_t get_time_ns(void) {
+    return vclock_now_ns();
+}
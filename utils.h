@@ -15,23 +15,63 @@
 #include <stdbool.h>
 #include <opendroneid.h>
 
+#define MINIMUM(a,b) (((a)<(b))?(a):(b))
+#define MAXIMUM(a,b) (((a)>(b))?(a):(b))
+
+#define PACK_REFRESH_MAX_MS 900 // Every pack carries the Location, which must be updated at least once per second
+
+// Thread classes of the real-time mode. The NAN thread runs with the transmit settings
+enum realtime_thread { REALTIME_TRANSMIT, REALTIME_HCI, REALTIME_GPS, REALTIME_THREAD_AMOUNT };
+
 struct config_data {
     bool use_beacon;
+    bool use_multi_beacon; // Update all hostapd interfaces found, not just the first
 
     bool use_btl; // Bluetooth Legacy Advertising
     bool use_bt4; // Bluetooth Legacy Advertising using Extended Advertising APIs
     bool use_bt5; // Bluetooth Long Range with Extended Advertising
+    int interval_btl_ms;
+    int interval_bt4_ms;
+    int interval_bt5_ms;
+
+    bool use_nan; // Wi-Fi NAN Service Discovery Frames injected on a monitor interface
+    char nan_iface[16];
+    int nan_interval_ms;
 
     bool use_gps;
+    char gps_serial[64]; // Read NMEA/UBX directly from this serial port instead of using gpsd
+    int gps_baudrate;
+    char replay_file[128]; // Replay this flight log instead of reading a GPS receiver
+    double replay_warp;    // Replay speed factor. 0 = as fast as possible
+    int extrapolate_max_ms; // Extrapolate the position to transmit time, up to this fix age. 0 = disabled
+    int pack_refresh_ms;    // Upload an unchanged message pack again after this long. At most 900 ms
+    int push_interval_ms;   // Minimum time between two fix-triggered Location updates
     
     uint8_t handle_bt4;
     uint8_t handle_bt5;
 
     bool use_packs; // Message packs
+    char auth_key_file[128]; // Sign the message packs with this Ed25519 private key (PEM). Empty = disabled
+
+    char config_file[128]; // Loaded at startup and re-read on SIGHUP or when the file changes
+    bool adopt_state;      // Take over the running advertising from a previous instance
+    char metrics_socket[108]; // Unix socket path for the Prometheus metrics. Empty = disabled
+    char btsnoop_file[128];   // Capture the HCI commands and events to this btsnoop file. Empty = disabled
+    int profile_iterations;   // --profile-controller: Profile the Bluetooth controller instead of transmitting
+    int stress_step_s;        // --stress-controller: Find the advertising data update rate ceiling
+    int bench_location_messages; // --bench-location: Benchmark the fixed-point Location encoder
+    int bench_batch_uas;         // --bench-batch: Benchmark the batch Location encoder with this many UAS
+    int simulate_s;              // --simulate: Run this many seconds on a simulated clock with mock backends
+
+    bool realtime;                              // Lock the memory and use SCHED_FIFO for the threads below
+    int rt_priority[REALTIME_THREAD_AMOUNT];    // SCHED_FIFO priority, 1 - 99
+    int rt_cpu[REALTIME_THREAD_AMOUNT];         // Pin the thread to this CPU. -1 = any
+    int rt_deadline_us;                         // Wake-ups later than this count as deadline misses
 
     uint8_t msg_counters[ODID_MSG_COUNTER_AMOUNT];
 };
 
 void uchar_to_ascii(char *out, uint8_t in);
+uint64_t get_time_ns(void);
 
 #endif //_UTILS_H_
@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "vclock.h"
+#include "utils.h"
+
+/*
+ * All sleeps, timed waits and time stamps of the transmitter go through this clock. Normally it is
+ * CLOCK_MONOTONIC. In the simulation (--simulate) the time only advances when every thread taking part
+ * is blocked in one of the waits below. It then jumps to the earliest deadline, so hours of operation
+ * run as fast as the code between the waits executes. Only one of the threads taking part runs at a
+ * time. A thread continues when all others are blocked, in the order of the deadlines and otherwise in
+ * the order in which the threads started to wait, so a run does not depend on the scheduling of the
+ * host and repeats exactly.
+ *
+ * The threads taking part are the one calling vclock_simulate() and those started with
+ * vclock_thread_create(). Other threads that wait here take part for the duration of the wait. Posts
+ * to a semaphore that is waited for here must use vclock_sem_post(), so the waiter is woken.
+ */
+
+struct waiter {
+    bool active;
+    bool released;        // Chosen to run next
+    sem_t *sem;           // NULL for a sleep
+    uint64_t deadline_ns; // VCLOCK_FOREVER without a timeout
+    uint64_t order;       // When the wait started
+};
+
+struct thread_start {
+    bool used;            // Until the thread has been joined
+    pthread_t thread;
+    bool left;            // No longer taking part
+    struct waiter *first; // Queued for the start of the thread
+    sem_t finished;       // Posted when the thread has stopped taking part
+    void *(*start)(void *);
+    void *arg;
+};
+
+static bool simulated = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t advanced = PTHREAD_COND_INITIALIZER;
+static _Atomic uint64_t now_ns;    // The simulated CLOCK_MONOTONIC
+static int64_t realtime_offset_ns; // CLOCK_REALTIME minus CLOCK_MONOTONIC when the simulation started
+static int threads = 0;            // Taking part in the simulation
+static int waiting = 0;            // Of these, blocked in a wait and not released
+static uint64_t wait_order = 0;
+static struct waiter waiters[VCLOCK_MAX_WAITERS];
+static struct thread_start thread_starts[VCLOCK_MAX_THREADS];
+static __thread bool taking_part = false;
+static __thread struct thread_start *own_start = NULL;
+
+static struct {
+    uint64_t start_ns;      // Simulated
+    uint64_t wall_start_ns;
+    long rss_start_kb;
+    uint64_t advances;
+} stats;
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct timespec to_timespec(uint64_t time_ns) {
+    struct timespec ts = { .tv_sec = (time_t) (time_ns / 1000000000ULL), .tv_nsec = (long) (time_ns % 1000000000ULL) };
+    return ts;
+}
+
+static long resident_kb() {
+    long pages = 0, resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (!file)
+        return 0;
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(file);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Switches to the simulated time, starting at the current time. The calling thread takes part
+void vclock_simulate() {
+    struct timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    uint64_t start_ns = monotonic_ns();
+    realtime_offset_ns = (int64_t) realtime.tv_sec * 1000000000LL + realtime.tv_nsec - (int64_t) start_ns;
+    atomic_store(&now_ns, start_ns);
+    stats.start_ns = start_ns;
+    stats.wall_start_ns = start_ns;
+    stats.rss_start_kb = resident_kb();
+    threads = 1;
+    taking_part = true;
+    simulated = true;
+    printf("Simulation: Running on a simulated clock with mock Bluetooth, hostapd and NAN backends\n");
+}
+
+bool vclock_simulated() {
+    return simulated;
+}
+
+// Prints the summary of the simulation
+void vclock_stop() {
+    if (!simulated)
+        return;
+    double seconds = (double) (atomic_load(&now_ns) - stats.start_ns) / 1e9;
+    double wall_seconds = (double) (monotonic_ns() - stats.wall_start_ns) / 1e9;
+    printf("Simulation: %.1f s of simulated time in %.3f s (%.0fx real time), %lu clock advances\n", seconds,
+           wall_seconds, wall_seconds > 0 ? seconds / wall_seconds : 0, (unsigned long) stats.advances);
+    printf("Simulation: Resident memory %ld kB at the start, %ld kB at the end\n", stats.rss_start_kb,
+           resident_kb());
+}
+
+uint64_t vclock_now_ns() {
+    if (simulated)
+        return atomic_load(&now_ns);
+    return monotonic_ns();
+}
+
+int64_t vclock_realtime_ns() {
+    if (simulated)
+        return (int64_t) atomic_load(&now_ns) + realtime_offset_ns;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool can_continue(struct waiter *waiter) {
+    int value = 0;
+    if (waiter->sem && sem_getvalue(waiter->sem, &value) == 0 && value > 0)
+        return true;
+    return waiter->deadline_ns <= atomic_load(&now_ns);
+}
+
+/*
+ * Releases the next waiter when all threads taking part are blocked. That is the one waiting longest of
+ * those that can continue. If none can, the time first moves to the earliest deadline. Called with the
+ * lock held. Returns true if a waiter was released.
+ */
+static bool advance() {
+    if (waiting < threads)
+        return false;
+
+    struct waiter *next = NULL;
+    for (int i = 0; i < VCLOCK_MAX_WAITERS; i++) {
+        struct waiter *waiter = &waiters[i];
+        if (waiter->active && !waiter->released && can_continue(waiter) && (!next || waiter->order < next->order))
+            next = waiter;
+    }
+    if (!next) {
+        for (int i = 0; i < VCLOCK_MAX_WAITERS; i++) {
+            struct waiter *waiter = &waiters[i];
+            if (!waiter->active || waiter->released)
+                continue;
+            if (!next || waiter->deadline_ns < next->deadline_ns ||
+                (waiter->deadline_ns == next->deadline_ns && waiter->order < next->order))
+                next = waiter;
+        }
+        if (!next || next->deadline_ns == VCLOCK_FOREVER) {
+            printf("Simulation: All threads are blocked without a timeout\n");
+            exit(EXIT_FAILURE);
+        }
+        atomic_store(&now_ns, next->deadline_ns);
+        stats.advances++;
+    }
+    next->released = true;
+    waiting--;
+    pthread_cond_broadcast(&advanced);
+    return true;
+}
+
+// Queues a waiter. Called with the lock held
+static struct waiter *add_waiter(sem_t *sem, uint64_t deadline_ns) {
+    struct waiter *waiter = NULL;
+    for (int i = 0; i < VCLOCK_MAX_WAITERS && !waiter; i++) {
+        if (!waiters[i].active)
+            waiter = &waiters[i];
+    }
+    if (!waiter) {
+        printf("Simulation: More than %d threads waiting\n", VCLOCK_MAX_WAITERS);
+        exit(EXIT_FAILURE);
+    }
+    waiter->active = true;
+    waiter->sem = sem;
+    waiter->deadline_ns = deadline_ns;
+    waiter->order = wait_order++;
+    waiter->released = false;
+    waiting++;
+    return waiter;
+}
+
+// Blocks until the waiter is released and can continue. Called with the lock held
+static int wait_released(struct waiter *waiter) {
+    int result;
+    while (true) {
+        while (!waiter->released) {
+            if (!advance())
+                pthread_cond_wait(&advanced, &lock);
+        }
+        if (waiter->sem && sem_trywait(waiter->sem) == 0) {
+            result = 0;
+            break;
+        }
+        if (atomic_load(&now_ns) >= waiter->deadline_ns) {
+            errno = ETIMEDOUT;
+            result = -1;
+            break;
+        }
+        waiter->released = false;
+        waiting++;
+    }
+    waiter->active = false;
+    return result;
+}
+
+static int simulated_wait(sem_t *sem, uint64_t deadline_ns) {
+    pthread_mutex_lock(&lock);
+    bool temporary = !taking_part;
+    if (temporary)
+        threads++;
+    int result = wait_released(add_waiter(sem, deadline_ns));
+    if (temporary) {
+        threads--;
+        // The others may all be waiting for this thread to block again
+        pthread_cond_broadcast(&advanced);
+    }
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+void vclock_sleep_until(uint64_t deadline_ns) {
+    if (simulated) {
+        simulated_wait(NULL, deadline_ns);
+        return;
+    }
+    struct timespec due = to_timespec(deadline_ns);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+        ;
+}
+
+void vclock_sleep_ns(uint64_t duration_ns) {
+    vclock_sleep_until(vclock_now_ns() + duration_ns);
+}
+
+/*
+ * Waits until the semaphore is posted or the deadline has passed. Returns 0 when the semaphore was
+ * taken, otherwise -1 with errno set to ETIMEDOUT, or EINTR when a signal interrupted the wait.
+ */
+int vclock_sem_wait(sem_t *sem, uint64_t deadline_ns) {
+    if (simulated)
+        return simulated_wait(sem, deadline_ns);
+    if (deadline_ns == VCLOCK_FOREVER)
+        return sem_wait(sem);
+    struct timespec timeout = to_timespec(deadline_ns);
+    return sem_clockwait(sem, CLOCK_MONOTONIC, &timeout);
+}
+
+void vclock_sem_post(sem_t *sem) {
+    if (!simulated) {
+        sem_post(sem);
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    sem_post(sem);
+    pthread_cond_broadcast(&advanced);
+    pthread_mutex_unlock(&lock);
+}
+
+// Stops the calling thread from taking part, e.g. before it joins threads that still need the time to advance
+void vclock_thread_leave() {
+    if (!simulated || !taking_part)
+        return;
+    pthread_mutex_lock(&lock);
+    taking_part = false;
+    if (own_start)
+        own_start->left = true;
+    threads--;
+    pthread_cond_broadcast(&advanced);
+    pthread_mutex_unlock(&lock);
+}
+
+static void thread_done(void *arg) {
+    struct thread_start *thread_start = arg;
+    // In one step, so the time cannot move before the joining thread continues
+    pthread_mutex_lock(&lock);
+    if (taking_part) {
+        taking_part = false;
+        threads--;
+    }
+    thread_start->left = true;
+    sem_post(&thread_start->finished);
+    pthread_cond_broadcast(&advanced);
+    pthread_mutex_unlock(&lock);
+}
+
+static void *thread_main(void *arg) {
+    struct thread_start *thread_start = arg;
+    void *(*start)(void *) = thread_start->start;
+    void *start_arg = thread_start->arg;
+    pthread_mutex_lock(&lock);
+    taking_part = true;
+    own_start = thread_start;
+    wait_released(thread_start->first);
+    pthread_mutex_unlock(&lock);
+
+    void *result;
+    pthread_cleanup_push(thread_done, thread_start); // Also when the thread ends with pthread_exit()
+    result = start(start_arg);
+    pthread_cleanup_pop(1);
+    return result;
+}
+
+/*
+ * Starts a thread that takes part in the simulation. It is counted from now on and runs once the calling
+ * thread blocks. The same as pthread_create() otherwise.
+ */
+int vclock_thread_create(pthread_t *thread, void *(*start)(void *), void *arg) {
+    if (!simulated)
+        return pthread_create(thread, NULL, start, arg);
+
+    pthread_mutex_lock(&lock);
+    struct thread_start *thread_start = NULL;
+    for (int i = 0; i < VCLOCK_MAX_THREADS && !thread_start; i++) {
+        if (!thread_starts[i].used)
+            thread_start = &thread_starts[i];
+    }
+    if (!thread_start) {
+        pthread_mutex_unlock(&lock);
+        return EAGAIN;
+    }
+    thread_start->used = true;
+    thread_start->start = start;
+    thread_start->arg = arg;
+    thread_start->left = false;
+    sem_init(&thread_start->finished, 0, 0);
+    thread_start->first = add_waiter(NULL, atomic_load(&now_ns));
+    threads++;
+    pthread_mutex_unlock(&lock);
+
+    int error = pthread_create(&thread_start->thread, NULL, thread_main, thread_start);
+    if (error != 0) {
+        pthread_mutex_lock(&lock);
+        sem_destroy(&thread_start->finished);
+        thread_start->first->active = false;
+        thread_start->used = false;
+        waiting--;
+        threads--;
+        pthread_cond_broadcast(&advanced);
+        pthread_mutex_unlock(&lock);
+        return error;
+    }
+    *thread = thread_start->thread;
+    return 0;
+}
+
+/*
+ * Joins a thread started with vclock_thread_create(). In the simulation the caller waits like in
+ * vclock_sem_wait(), so the thread can run to its end. A thread that has left the simulation ends in real
+ * time, so no simulated time passes while joining it. The same as pthread_join() otherwise.
+ */
+int vclock_thread_join(pthread_t thread, void **result) {
+    struct thread_start *thread_start = NULL;
+    bool left = true;
+    if (simulated) {
+        pthread_mutex_lock(&lock);
+        for (int i = 0; i < VCLOCK_MAX_THREADS && !thread_start; i++) {
+            if (thread_starts[i].used && pthread_equal(thread_starts[i].thread, thread))
+                thread_start = &thread_starts[i];
+        }
+        if (thread_start)
+            left = thread_start->left;
+        pthread_mutex_unlock(&lock);
+    }
+    if (!left)
+        simulated_wait(&thread_start->finished, VCLOCK_FOREVER);
+
+    int error = pthread_join(thread, result);
+    if (thread_start) {
+        pthread_mutex_lock(&lock);
+        sem_destroy(&thread_start->finished);
+        thread_start->used = false;
+        pthread_mutex_unlock(&lock);
+    }
+    return error;
+}
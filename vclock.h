@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _VCLOCK_H_
+#define _VCLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define VCLOCK_FOREVER UINT64_MAX
+#define VCLOCK_DEFAULT_SIMULATE_S 3600
+#define VCLOCK_MAX_THREADS 16 // Threads started with vclock_thread_create() and not joined yet
+#define VCLOCK_MAX_WAITERS 32
+
+void vclock_simulate(void);
+bool vclock_simulated(void);
+void vclock_stop(void);
+
+uint64_t vclock_now_ns(void);
+int64_t vclock_realtime_ns(void);
+void vclock_sleep_until(uint64_t deadline_ns);
+void vclock_sleep_ns(uint64_t duration_ns);
+int vclock_sem_wait(sem_t *sem, uint64_t deadline_ns);
+void vclock_sem_post(sem_t *sem);
+
+int vclock_thread_create(pthread_t *thread, void *(*start)(void *), void *arg);
+int vclock_thread_join(pthread_t thread, void **result);
+void vclock_thread_leave(void);
+
+#endif //_VCLOCK_H_
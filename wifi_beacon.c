@@ -9,19 +9,127 @@
  * friissoren2@gmail.com
  */
 
+#include <stdio.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <semaphore.h>
-#include "ap_interface.h"
+#include "hostapd_ctrl.h"
 #include "utils.h"
 #include "wifi_beacon.h"
+#include "metrics.h"
+#include "trace_ring.h"
 
-extern struct wpa_ctrl *ctrl_conn;
-extern sem_t semaphore;
+/*
+ * Each hostapd interface (radio or BSS) has its own control connection and worker thread.
+ * An update is formatted once into beacon_cmd and all workers are released at the same time,
+ * so that the interfaces are updated concurrently from the same encoded snapshot.
+ */
+struct beacon_worker {
+    struct hostapd_ctrl iface;
+    pthread_t thread;
+    sem_t start;
+    sem_t done;
+    int result;
+    bool failing; // Only the first of consecutive failed updates is reported
+    uint64_t done_ns;
+};
+
+static struct beacon_worker workers[HOSTAPD_CTRL_MAX_INTERFACES];
+static int worker_count = 0;
+static bool workers_quit = false;
+static char beacon_cmd[64 + 2*(7 + 3 + ODID_PACK_MAX_MESSAGES*ODID_MESSAGE_SIZE)];
+
+static int update_iface(struct hostapd_ctrl *iface) {
+    int result = hostapd_ctrl_command(iface, beacon_cmd);
+    if (result == 0)
+        result = hostapd_ctrl_command(iface, "UPDATE_BEACON");
+    return result;
+}
 
-static void send_update_beacon() {
-    char *cmd[] = { "update_beacon" };
-    wpa_request(ctrl_conn, sizeof(cmd)/sizeof(cmd[0]), cmd);
-    sem_wait(&semaphore);
+static void *beacon_worker_loop(void *arg) {
+    struct beacon_worker *worker = arg;
+    pthread_setname_np(pthread_self(), "beacon");
+    trace_register_thread(); // Allocates the trace ring before the alloc guard is armed
+
+    while (true) {
+        sem_wait(&worker->start);
+        if (workers_quit)
+            break;
+
+        worker->result = update_iface(&worker->iface);
+        // Without a reply, hostapd may have been restarted. Reconnect and repeat the update once
+        if (worker->result < 0 && hostapd_ctrl_reconnect(&worker->iface) == 0)
+            worker->result = update_iface(&worker->iface);
+        worker->done_ns = get_time_ns();
+        sem_post(&worker->done);
+    }
+    return NULL;
+}
+
+// Sets the vendor specific element on all beacon interfaces and records the per interface
+// latency, plus the skew between the first and the last interface to finish the update
+static void update_beacons(const char *vendor_elements) {
+    snprintf(beacon_cmd, sizeof(beacon_cmd), "SET vendor_elements %s", vendor_elements);
+
+    uint64_t start_ns = get_time_ns();
+    for (int i = 0; i < worker_count; i++)
+        sem_post(&workers[i].start);
+    for (int i = 0; i < worker_count; i++)
+        sem_wait(&workers[i].done);
+
+    uint64_t first_ns = UINT64_MAX, last_ns = 0;
+    for (int i = 0; i < worker_count; i++) {
+        struct beacon_worker *worker = &workers[i];
+        metrics_observe_iface_ns(i, worker->done_ns - start_ns);
+        if (worker->result != 0 && !worker->failing)
+            printf("Beacon update on %s failed\n", worker->iface.name);
+        worker->failing = worker->result != 0;
+        first_ns = MINIMUM(first_ns, worker->done_ns);
+        last_ns = MAXIMUM(last_ns, worker->done_ns);
+    }
+    if (worker_count > 1)
+        metrics_observe_ns(METRICS_HOSTAPD_SKEW, last_ns - first_ns);
+}
+
+int init_beacon(struct config_data *config) {
+    worker_count = 0;
+    workers_quit = false;
+
+    struct hostapd_ctrl ifaces[HOSTAPD_CTRL_MAX_INTERFACES] = { 0 };
+    int count = hostapd_ctrl_open_beacon_ifaces(ifaces, HOSTAPD_CTRL_MAX_INTERFACES, config->use_multi_beacon);
+    if (count == 0) {
+        printf("Error: No hostapd interface available for beacon updates\n");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct beacon_worker *worker = &workers[i];
+        worker->iface = ifaces[i];
+        worker->failing = false;
+        metrics_set_iface_name(i, worker->iface.name);
+        sem_init(&worker->start, 0, 0);
+        sem_init(&worker->done, 0, 0);
+        if (pthread_create(&worker->thread, NULL, beacon_worker_loop, worker) != 0) {
+            printf("Error: Failed to start beacon worker for %s\n", worker->iface.name);
+            for (int j = i; j < count; j++)
+                hostapd_ctrl_close(&ifaces[j]);
+            break;
+        }
+        worker_count++;
+    }
+    return worker_count > 0 ? 0 : -1;
+}
+
+void close_beacon() {
+    workers_quit = true;
+    for (int i = 0; i < worker_count; i++) {
+        sem_post(&workers[i].start);
+        pthread_join(workers[i].thread, NULL);
+        sem_destroy(&workers[i].start);
+        sem_destroy(&workers[i].done);
+        hostapd_ctrl_close(&workers[i].iface);
+    }
+    worker_count = 0;
 }
 
 /*
@@ -49,11 +157,7 @@ void send_beacon_message(const union ODID_Message_encoded *encoded, uint8_t msg_
     for (int i = 0; i < ODID_MESSAGE_SIZE; i++)
         uchar_to_ascii((char *) &data[2*(WIFI_BEACON_HEADER_SIZE + i)], encoded->rawData[i]);
 
-    wpa_request(ctrl_conn, sizeof(cmd)/sizeof(cmd[0]), cmd);
-    sem_wait(&semaphore);
-
-    send_update_beacon();
-    sleep(1);
+    update_beacons(cmd[2]);
 }
 
 // See also description for send_beacon_message()
@@ -76,18 +180,11 @@ void send_beacon_message_pack(struct ODID_MessagePack_encoded *pack_enc, uint8_t
     for (int i = 0; i < 3 + amount*ODID_MESSAGE_SIZE; i++)
         uchar_to_ascii(&data[2*(WIFI_BEACON_HEADER_SIZE + i)], ((char *) pack_enc)[i]);
 
-    wpa_request(ctrl_conn, sizeof(cmd)/sizeof(cmd[0]), cmd);
-    sem_wait(&semaphore);
-    sleep(1);
-
-    send_update_beacon();
-    sleep(1);
+    update_beacons(cmd[2]);
 }
 
 void send_quit() {
-    char *cmd[] = { "quit" };
-    wpa_request(ctrl_conn, sizeof(cmd)/sizeof(cmd[0]), cmd);
-    sem_wait(&semaphore);
+    hostapd_ctrl_quit();
 }
 
 #include "wifi_beacon.h"
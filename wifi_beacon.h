@@ -13,7 +13,10 @@
 #define _WIFI_BEACON_H_
 
 #include <opendroneid.h>
+#include "utils.h"
 
+int init_beacon(struct config_data *config);
+void close_beacon();
 void send_beacon_message(const union ODID_Message_encoded *encoded, uint8_t msg_counter);
 void send_beacon_message_pack(struct ODID_MessagePack_encoded *pack_enc, uint8_t msg_counter);
 void send_quit();
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#include "wifi_nan.h"
+#include "metrics.h"
+#include "compliance.h"
+#include "utils.h"
+#include "trace_ring.h"
+#include "realtime.h"
+#include "vclock.h"
+
+/*
+ * Wi-Fi NAN Service Discovery Frames are injected as raw 802.11 frames on an interface in monitor mode.
+ * The frame consists of the following parts:
+ *     Radiotap header = Minimal header without any fields. The driver selects rate and channel
+ *     802.11 header = Action frame sent to the NAN Network ID with the NAN Cluster ID as BSSID
+ *     04, 09 = Public Action frame, Vendor Specific
+ *     50, 6F, 9A, 13 = The Wi-Fi Alliance OUI and the NAN OUI type
+ *     Service Descriptor Attribute = Carries the service info (message counter + message pack)
+ *     Service Descriptor Extension Attribute = Carries the service update indicator
+ */
+#define NAN_RADIOTAP_HEADER_SIZE 8
+#define NAN_80211_HEADER_SIZE 24
+#define NAN_ACTION_HEADER_SIZE 6
+#define NAN_SDA_HEADER_SIZE 13
+#define NAN_SDEA_SIZE 7
+#define NAN_FRAME_MAX_SIZE (NAN_RADIOTAP_HEADER_SIZE + NAN_80211_HEADER_SIZE + NAN_ACTION_HEADER_SIZE + \
+                            NAN_SDA_HEADER_SIZE + 1 + 3 + ODID_PACK_MAX_MESSAGES*ODID_MESSAGE_SIZE + NAN_SDEA_SIZE)
+
+static const uint8_t nan_network_id[6] = { 0x51, 0x6F, 0x9A, 0x01, 0x00, 0x00 };
+static const uint8_t nan_cluster_id[6] = { 0x50, 0x6F, 0x9A, 0x01, 0x00, 0x00 };
+// The first 6 bytes of SHA-256("org.opendroneid.remoteid")
+static const uint8_t nan_service_id[6] = { 0x88, 0x69, 0x19, 0x9D, 0x92, 0x09 };
+
+static int nan_socket = -1;
+static uint8_t nan_mac[6];
+static _Atomic int nan_interval_ms;
+static pthread_t nan_thread;
+static bool nan_running = false;
+
+// The latest message pack handed over from the main loop. Protected by pack_mutex
+static pthread_mutex_t pack_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct ODID_MessagePack_encoded nan_pack;
+static bool nan_pack_valid = false;
+static uint8_t nan_counter = 0;
+
+static int build_nan_frame(uint8_t *buf, const struct ODID_MessagePack_encoded *pack_enc, uint8_t msg_counter) {
+    int pack_size = 3 + pack_enc->MsgPackSize*ODID_MESSAGE_SIZE;
+    int service_info_length = 1 + pack_size;
+    int pos = 0;
+
+    // Radiotap header: version 0, length 8, no fields present
+    const uint8_t radiotap[NAN_RADIOTAP_HEADER_SIZE] = { 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    memcpy(&buf[pos], radiotap, sizeof(radiotap));
+    pos += sizeof(radiotap);
+
+    buf[pos++] = 0xD0; // Frame Control: Management frame, subtype 13 = Action
+    buf[pos++] = 0x00;
+    buf[pos++] = 0x00; // Duration
+    buf[pos++] = 0x00;
+    memcpy(&buf[pos], nan_network_id, 6); // Address 1: Destination
+    pos += 6;
+    memcpy(&buf[pos], nan_mac, 6);        // Address 2: Source
+    pos += 6;
+    memcpy(&buf[pos], nan_cluster_id, 6); // Address 3: BSSID
+    pos += 6;
+    buf[pos++] = 0x00; // Sequence Control. Filled in by the driver
+    buf[pos++] = 0x00;
+
+    buf[pos++] = 0x04; // Category: Public Action
+    buf[pos++] = 0x09; // Action: Vendor Specific
+    buf[pos++] = 0x50; // OUI: Wi-Fi Alliance
+    buf[pos++] = 0x6F;
+    buf[pos++] = 0x9A;
+    buf[pos++] = 0x13; // OUI Type: NAN
+
+    int sda_length = 6 + 1 + 1 + 1 + 1 + service_info_length;
+    buf[pos++] = 0x03; // Attribute ID: Service Descriptor Attribute
+    buf[pos++] = sda_length & 0xFF;
+    buf[pos++] = (sda_length >> 8) & 0xFF;
+    memcpy(&buf[pos], nan_service_id, 6);
+    pos += 6;
+    buf[pos++] = 0x01; // Instance ID
+    buf[pos++] = 0x00; // Requestor Instance ID
+    buf[pos++] = 0x10; // Service Control: Publish, Service Info present
+    buf[pos++] = service_info_length;
+    buf[pos++] = msg_counter; // Service Info: 8-bit message counter followed by the message pack
+    memcpy(&buf[pos], pack_enc, pack_size);
+    pos += pack_size;
+
+    buf[pos++] = 0x0E; // Attribute ID: Service Descriptor Extension Attribute
+    buf[pos++] = 0x04; // Length
+    buf[pos++] = 0x00;
+    buf[pos++] = 0x01; // Instance ID
+    buf[pos++] = 0x00; // Control: Service Update Indicator present
+    buf[pos++] = 0x02;
+    buf[pos++] = msg_counter; // Service Update Indicator
+
+    return pos;
+}
+
+static void send_nan_frame() {
+    struct ODID_MessagePack_encoded pack_enc;
+
+    pthread_mutex_lock(&pack_mutex);
+    bool valid = nan_pack_valid;
+    if (valid)
+        memcpy(&pack_enc, &nan_pack, sizeof(pack_enc));
+    pthread_mutex_unlock(&pack_mutex);
+    if (!valid)
+        return;
+
+    uint8_t frame[NAN_FRAME_MAX_SIZE];
+    int length = build_nan_frame(frame, &pack_enc, nan_counter++);
+    // In the simulation, the frame is built but not injected
+    if (!vclock_simulated() && send(nan_socket, frame, length, 0) < 0)
+        printf("Failed to send NAN frame: %s\n", strerror(errno));
+    else {
+        metrics_frame_sent(TRANSPORT_NAN, ODID_MESSAGETYPE_PACKED);
+        compliance_pack(TRANSPORT_NAN, &pack_enc);
+    }
+}
+
+// The NAN transport has its own cadence, independent of the Beacon and Bluetooth update loops
+static void *nan_loop(void *arg) {
+    (void) arg;
+    uint64_t next_ns = get_time_ns();
+    pthread_setname_np(pthread_self(), "nan");
+    trace_register_thread(); // Allocates the trace ring before the alloc guard is armed
+    realtime_thread(REALTIME_TRANSMIT);
+
+    while (nan_running) {
+        send_nan_frame();
+
+        next_ns += (uint64_t) nan_interval_ms * 1000000ULL;
+        trace_begin(TRACE_SLEEP, 0);
+        vclock_sleep_until(next_ns);
+        trace_end(TRACE_SLEEP);
+        uint64_t now_ns = get_time_ns();
+        uint64_t lateness_ns = now_ns > next_ns ? now_ns - next_ns : 0;
+        if (lateness_ns > 0)
+            metrics_observe_ns(METRICS_SCHEDULER_LATENESS, lateness_ns);
+        realtime_latency(REALTIME_TRANSMIT, lateness_ns);
+    }
+    return NULL;
+}
+
+static int open_nan_socket(struct config_data *config) {
+    int ifindex = (int) if_nametoindex(config->nan_iface);
+    if (ifindex == 0) {
+        printf("Error: Unknown NAN monitor interface %s\n", config->nan_iface);
+        return -1;
+    }
+
+    nan_socket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (nan_socket < 0) {
+        perror("NAN socket open failed");
+        return -1;
+    }
+
+    struct sockaddr_ll addr = { 0 };
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if (bind(nan_socket, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("NAN socket bind failed");
+        close(nan_socket);
+        nan_socket = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int init_nan(struct config_data *config) {
+    if (!vclock_simulated() && open_nan_socket(config) != 0)
+        return -1;
+
+    // Locally administered, unicast random MAC address
+    if (getrandom(nan_mac, sizeof(nan_mac), 0) != sizeof(nan_mac))
+        printf("Warning: Could not get random bytes for the NAN MAC address\n");
+    nan_mac[0] = (nan_mac[0] & 0xFE) | 0x02;
+
+    nan_interval_ms = config->nan_interval_ms;
+    nan_running = true;
+    if (vclock_thread_create(&nan_thread, nan_loop, NULL) != 0) {
+        nan_running = false;
+        if (nan_socket >= 0)
+            close(nan_socket);
+        nan_socket = -1;
+        return -1;
+    }
+    printf("NAN transmission on %s every %d ms\n", config->nan_iface, nan_interval_ms);
+    return 0;
+}
+
+void nan_update_pack(const struct ODID_MessagePack_encoded *pack_enc) {
+    pthread_mutex_lock(&pack_mutex);
+    memcpy(&nan_pack, pack_enc, sizeof(nan_pack));
+    nan_pack_valid = true;
+    pthread_mutex_unlock(&pack_mutex);
+}
+
+// Takes effect after the next frame
+void nan_set_interval(int interval_ms) {
+    nan_interval_ms = interval_ms;
+}
+
+void close_nan() {
+    if (!nan_running)
+        return;
+    nan_running = false;
+    vclock_thread_join(nan_thread, NULL);
+    if (nan_socket >= 0)
+        close(nan_socket);
+    nan_socket = -1;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2021, Soren Friis
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Open Drone ID Linux transmitter example.
+ *
+ * Maintainer: Soren Friis
+ * friissoren2@gmail.com
+ */
+
+#ifndef _WIFI_NAN_H_
+#define _WIFI_NAN_H_
+
+#include <opendroneid.h>
+#include "utils.h"
+
+#define NAN_DEFAULT_INTERVAL_MS 250
+
+int init_nan(struct config_data *config);
+void nan_update_pack(const struct ODID_MessagePack_encoded *pack_enc);
+void nan_set_interval(int interval_ms);
+void close_nan();
+
+#endif //_WIFI_NAN_H_